@@ -0,0 +1,170 @@
+#include <benchmark/benchmark.h>
+#include <random>
+
+#include "circular_buffer.h"
+#include "energy_threshold.h"
+#include "fixture_model.h"
+#include "leaky_integrator.h"
+#include "model.h"
+
+
+static std::vector<double> random_vector(std::size_t n, unsigned int seed = 1) {
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<double> dist(-1.0, 1.0);
+
+    std::vector<double> v(n);
+    for (auto& x: v) {
+        x = dist(rng);
+    }
+    return v;
+}
+
+
+static Model& fixture_model() {
+    static Model model(FixtureModel::generate(), torch::kCPU);
+    return model;
+}
+
+
+static Model& optimized_fixture_model() {
+    Model::Options options;
+    options.optimize = true;
+    options.cache = false;
+
+    static Model model(FixtureModel::generate(), torch::kCPU, options);
+    return model;
+}
+
+
+// ==============================================================================================
+
+static void BM_CircularBuffer_AddSamples(benchmark::State& state) {
+    auto vector_size = static_cast<std::size_t>(state.range(0));
+    CircularBuffer<float> buffer(FixtureModel::SEGMENT_LENGTH);
+    auto input = random_vector(vector_size);
+
+    for (auto _: state) {
+        buffer.add_samples(input.data(), input.size());
+        benchmark::ClobberMemory();
+    }
+
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+BENCHMARK(BM_CircularBuffer_AddSamples)->Arg(64)->Arg(256)->Arg(1024);
+
+
+static void BM_CircularBuffer_GetSamples(benchmark::State& state) {
+    CircularBuffer<float> buffer(static_cast<std::size_t>(state.range(0)));
+    auto input = random_vector(buffer.size());
+    buffer.add_samples(input.data(), input.size());
+
+    for (auto _: state) {
+        benchmark::DoNotOptimize(buffer.get_samples());
+    }
+}
+
+BENCHMARK(BM_CircularBuffer_GetSamples)->Arg(FixtureModel::SEGMENT_LENGTH)->Arg(32768);
+
+
+// ==============================================================================================
+
+static void BM_ResamplingBuffer_AddSamples(benchmark::State& state) {
+    auto input_sr = static_cast<int>(state.range(0));
+    auto output_sr = static_cast<int>(state.range(1));
+    const std::size_t vector_size = 64;
+
+    ResamplingBuffer buffer(FixtureModel::SEGMENT_LENGTH, vector_size, input_sr, output_sr);
+    auto input = random_vector(vector_size);
+
+    for (auto _: state) {
+        benchmark::DoNotOptimize(buffer.add_samples(input.data(), input.size()));
+    }
+
+    state.SetItemsProcessed(state.iterations() * static_cast<long>(vector_size));
+}
+
+BENCHMARK(BM_ResamplingBuffer_AddSamples)
+        ->Args({44100, 44100})
+        ->Args({48000, 44100})
+        ->Args({44100, 24000})
+        ->Args({48000, 24000})
+        ->Args({48000, 16000})
+        ->Args({96000, 48000});
+
+
+// ==============================================================================================
+
+static void BM_EnergyThreshold_Rms(benchmark::State& state) {
+    auto input = random_vector(static_cast<std::size_t>(state.range(0)));
+
+    for (auto _: state) {
+        benchmark::DoNotOptimize(EnergyThreshold::rms(input));
+    }
+
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+BENCHMARK(BM_EnergyThreshold_Rms)->Arg(882)->Arg(FixtureModel::SEGMENT_LENGTH);
+
+
+// ==============================================================================================
+
+static void BM_LeakyIntegrator_Process(benchmark::State& state) {
+    auto num_classes = static_cast<std::size_t>(state.range(0));
+    auto input = util::to_floats(random_vector(num_classes));
+
+    LeakyIntegrator integrator;
+    integrator.set_tau(500.0);
+
+    auto time = std::chrono::steady_clock::now();
+    integrator.process(input, time);
+
+    for (auto _: state) {
+        time += std::chrono::milliseconds(1);
+        benchmark::DoNotOptimize(integrator.process(input, time));
+    }
+}
+
+BENCHMARK(BM_LeakyIntegrator_Process)->Arg(8)->Arg(64);
+
+
+// ==============================================================================================
+
+static void BM_Model_Classify(benchmark::State& state) {
+    auto& model = state.range(0) ? optimized_fixture_model() : fixture_model();
+    auto window = util::to_floats(random_vector(static_cast<std::size_t>(model.get_segment_length())));
+
+    for (auto _: state) {
+        benchmark::DoNotOptimize(model.classify(window.data(), window.size()));
+    }
+
+    state.SetItemsProcessed(state.iterations());
+}
+
+// arg: 1 for the frozen, inference-optimised model
+BENCHMARK(BM_Model_Classify)->Arg(0)->Arg(1)->Unit(benchmark::kMicrosecond);
+
+
+static void BM_Model_ClassifyBatched(benchmark::State& state) {
+    auto& model = fixture_model();
+    auto batch_size = static_cast<std::size_t>(state.range(0));
+
+    std::vector<std::vector<float>> windows;
+    for (std::size_t i = 0; i < batch_size; ++i) {
+        windows.push_back(util::to_floats(random_vector(static_cast<std::size_t>(model.get_segment_length())
+                                                        , static_cast<unsigned int>(i))));
+    }
+
+    for (auto _: state) {
+        benchmark::DoNotOptimize(model.classify(windows));
+    }
+
+    // items = windows, so that the per-window cost can be compared directly with BM_Model_Classify
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+BENCHMARK(BM_Model_ClassifyBatched)->Arg(1)->Arg(4)->Arg(16)->Unit(benchmark::kMicrosecond);
+
+
+BENCHMARK_MAIN();
@@ -0,0 +1,269 @@
+#ifndef IPT_MAX_AUDIO_FILE_READER_H
+#define IPT_MAX_AUDIO_FILE_READER_H
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+
+enum class SampleFormat {
+    uint8, int8, int16, int24, int32, float32, float64
+};
+
+
+/**
+ * Streaming reader for WAV files (PCM / IEEE float, including WAVE_FORMAT_EXTENSIBLE) and headerless raw PCM.
+ * Frames are read in blocks and mixed down to mono doubles in [-1, 1]. All data is assumed little-endian.
+ */
+class AudioFileReader {
+public:
+    /** @throws std::runtime_error if the file cannot be opened or is not a supported WAV file */
+    static AudioFileReader open_wav(const std::string& path) {
+        AudioFileReader reader(path);
+        reader.parse_wav_header();
+        return reader;
+    }
+
+
+    /** @throws std::runtime_error if the file cannot be opened */
+    static AudioFileReader open_raw(const std::string& path, int sample_rate, int num_channels, SampleFormat format) {
+        AudioFileReader reader(path);
+        reader.m_sample_rate = sample_rate;
+        reader.m_num_channels = num_channels;
+        reader.m_format = format;
+
+        reader.m_stream.seekg(0, std::ios::end);
+        reader.m_remaining_bytes = static_cast<std::uint64_t>(reader.m_stream.tellg());
+        reader.m_stream.seekg(0, std::ios::beg);
+
+        reader.validate();
+        return reader;
+    }
+
+
+    /**
+     * Reads up to `max_frames` frames, mixed down to mono.
+     * @returns the number of frames read, 0 at end of file
+     */
+    std::size_t read(std::vector<double>& output, std::size_t max_frames) {
+        auto frame_size = bytes_per_sample() * static_cast<std::size_t>(m_num_channels);
+        auto num_frames = std::min<std::uint64_t>(max_frames, m_remaining_bytes / frame_size);
+
+        m_bytes.resize(static_cast<std::size_t>(num_frames) * frame_size);
+        m_stream.read(reinterpret_cast<char*>(m_bytes.data()), static_cast<std::streamsize>(m_bytes.size()));
+        num_frames = static_cast<std::uint64_t>(m_stream.gcount()) / frame_size;
+        m_remaining_bytes -= num_frames * frame_size;
+
+        output.resize(static_cast<std::size_t>(num_frames));
+
+        const double gain = 1.0 / static_cast<double>(m_num_channels);
+        const std::uint8_t* data = m_bytes.data();
+        for (std::size_t i = 0; i < output.size(); ++i) {
+            double sum = 0.0;
+            for (int c = 0; c < m_num_channels; ++c) {
+                sum += decode(data);
+                data += bytes_per_sample();
+            }
+            output[i] = sum * gain;
+        }
+
+        return output.size();
+    }
+
+
+    int get_sample_rate() const {
+        return m_sample_rate;
+    }
+
+
+    int get_num_channels() const {
+        return m_num_channels;
+    }
+
+
+    static SampleFormat parse_format(const std::string& s) {
+        if (s == "u8") return SampleFormat::uint8;
+        if (s == "s8") return SampleFormat::int8;
+        if (s == "s16") return SampleFormat::int16;
+        if (s == "s24") return SampleFormat::int24;
+        if (s == "s32") return SampleFormat::int32;
+        if (s == "f32") return SampleFormat::float32;
+        if (s == "f64") return SampleFormat::float64;
+        throw std::runtime_error("unknown sample format \"" + s + "\" (expected u8, s8, s16, s24, s32, f32 or f64)");
+    }
+
+
+private:
+    static constexpr std::uint16_t WAVE_FORMAT_PCM = 0x0001;
+    static constexpr std::uint16_t WAVE_FORMAT_IEEE_FLOAT = 0x0003;
+    static constexpr std::uint16_t WAVE_FORMAT_EXTENSIBLE = 0xFFFE;
+
+
+    explicit AudioFileReader(const std::string& path) : m_stream(path, std::ios::binary) {
+        if (!m_stream) {
+            throw std::runtime_error("could not open file \"" + path + "\"");
+        }
+    }
+
+
+    void parse_wav_header() {
+        std::array<std::uint8_t, 12> riff{};
+        if (!read_exact(riff.data(), riff.size())
+            || std::memcmp(riff.data(), "RIFF", 4) != 0
+            || std::memcmp(riff.data() + 8, "WAVE", 4) != 0) {
+            throw std::runtime_error("not a RIFF/WAVE file");
+        }
+
+        bool has_format = false;
+        std::array<std::uint8_t, 8> chunk{};
+
+        while (read_exact(chunk.data(), chunk.size())) {
+            auto chunk_size = static_cast<std::uint32_t>(read_le(chunk.data() + 4, 4));
+
+            if (std::memcmp(chunk.data(), "fmt ", 4) == 0) {
+                std::vector<std::uint8_t> fmt(chunk_size);
+                if (chunk_size < 16 || !read_exact(fmt.data(), fmt.size())) {
+                    throw std::runtime_error("invalid fmt chunk");
+                }
+
+                auto format_tag = static_cast<std::uint16_t>(read_le(fmt.data(), 2));
+                m_num_channels = static_cast<int>(read_le(fmt.data() + 2, 2));
+                m_sample_rate = static_cast<int>(read_le(fmt.data() + 4, 4));
+                auto bits = static_cast<int>(read_le(fmt.data() + 14, 2));
+
+                if (format_tag == WAVE_FORMAT_EXTENSIBLE && chunk_size >= 26) {
+                    // first two bytes of the sub-format GUID hold the actual format tag
+                    format_tag = static_cast<std::uint16_t>(read_le(fmt.data() + 24, 2));
+                }
+
+                m_format = wav_format(format_tag, bits);
+                has_format = true;
+                skip_padding(chunk_size);
+
+            } else if (std::memcmp(chunk.data(), "data", 4) == 0) {
+                if (!has_format) {
+                    throw std::runtime_error("data chunk before fmt chunk");
+                }
+                m_remaining_bytes = chunk_size;
+                validate();
+                return;
+
+            } else {
+                m_stream.seekg(static_cast<std::streamoff>(chunk_size + (chunk_size & 1)), std::ios::cur);
+            }
+        }
+
+        throw std::runtime_error("no data chunk found");
+    }
+
+
+    static SampleFormat wav_format(std::uint16_t format_tag, int bits) {
+        if (format_tag == WAVE_FORMAT_PCM) {
+            switch (bits) {
+                case 8: return SampleFormat::uint8;  // 8-bit WAV is unsigned
+                case 16: return SampleFormat::int16;
+                case 24: return SampleFormat::int24;
+                case 32: return SampleFormat::int32;
+                default: break;
+            }
+        } else if (format_tag == WAVE_FORMAT_IEEE_FLOAT) {
+            switch (bits) {
+                case 32: return SampleFormat::float32;
+                case 64: return SampleFormat::float64;
+                default: break;
+            }
+        }
+
+        throw std::runtime_error("unsupported WAV format (tag " + std::to_string(format_tag)
+                                 + ", " + std::to_string(bits) + " bits)");
+    }
+
+
+    void validate() const {
+        if (m_num_channels <= 0 || m_sample_rate <= 0) {
+            throw std::runtime_error("invalid channel count or sample rate");
+        }
+    }
+
+
+    void skip_padding(std::uint32_t chunk_size) {
+        if (chunk_size & 1) {
+            m_stream.seekg(1, std::ios::cur);
+        }
+    }
+
+
+    bool read_exact(std::uint8_t* data, std::size_t size) {
+        m_stream.read(reinterpret_cast<char*>(data), static_cast<std::streamsize>(size));
+        return static_cast<std::size_t>(m_stream.gcount()) == size;
+    }
+
+
+    static std::uint64_t read_le(const std::uint8_t* data, int num_bytes) {
+        std::uint64_t v = 0;
+        for (int i = num_bytes - 1; i >= 0; --i) {
+            v = (v << 8) | data[i];
+        }
+        return v;
+    }
+
+
+    std::size_t bytes_per_sample() const {
+        switch (m_format) {
+            case SampleFormat::uint8: return 1;
+            case SampleFormat::int8: return 1;
+            case SampleFormat::int16: return 2;
+            case SampleFormat::int24: return 3;
+            case SampleFormat::int32: return 4;
+            case SampleFormat::float32: return 4;
+            case SampleFormat::float64: return 8;
+        }
+        return 0;
+    }
+
+
+    double decode(const std::uint8_t* data) const {
+        switch (m_format) {
+            case SampleFormat::uint8:
+                return (static_cast<double>(data[0]) - 128.0) / 128.0;
+            case SampleFormat::int8:
+                return static_cast<double>(static_cast<std::int8_t>(data[0])) / 128.0;
+            case SampleFormat::int16:
+                return static_cast<double>(static_cast<std::int16_t>(read_le(data, 2))) / 32768.0;
+            case SampleFormat::int24: {
+                auto v = static_cast<std::int32_t>(read_le(data, 3) << 8) >> 8;
+                return static_cast<double>(v) / 8388608.0;
+            }
+            case SampleFormat::int32:
+                return static_cast<double>(static_cast<std::int32_t>(read_le(data, 4))) / 2147483648.0;
+            case SampleFormat::float32: {
+                auto bits = static_cast<std::uint32_t>(read_le(data, 4));
+                float f;
+                std::memcpy(&f, &bits, sizeof(f));
+                return static_cast<double>(f);
+            }
+            case SampleFormat::float64: {
+                auto bits = read_le(data, 8);
+                double d;
+                std::memcpy(&d, &bits, sizeof(d));
+                return d;
+            }
+        }
+        return 0.0;
+    }
+
+
+    std::ifstream m_stream;
+    int m_sample_rate = 0;
+    int m_num_channels = 0;
+    SampleFormat m_format = SampleFormat::int16;
+    std::uint64_t m_remaining_bytes = 0;
+
+    std::vector<std::uint8_t> m_bytes;
+};
+
+#endif //IPT_MAX_AUDIO_FILE_READER_H
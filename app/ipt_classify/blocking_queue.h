@@ -0,0 +1,70 @@
+#ifndef IPT_MAX_BLOCKING_QUEUE_H
+#define IPT_MAX_BLOCKING_QUEUE_H
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <optional>
+
+
+/**
+ * Bounded multi-producer / multi-consumer queue connecting the stages of the offline pipeline.
+ * `push` blocks while the queue is full (back-pressure), `pop` blocks while it's empty until `close()` is called.
+ */
+template<typename T>
+class BlockingQueue {
+public:
+    explicit BlockingQueue(std::size_t capacity) : m_capacity(capacity) {}
+
+
+    /** @returns false if the queue has been closed, in which case the item is discarded */
+    bool push(T item) {
+        std::unique_lock lock{m_mutex};
+        m_not_full.wait(lock, [this] { return m_closed || m_items.size() < m_capacity; });
+
+        if (m_closed) {
+            return false;
+        }
+
+        m_items.push_back(std::move(item));
+        m_not_empty.notify_one();
+        return true;
+    }
+
+
+    /** @returns nullopt once the queue is closed and all remaining items have been popped */
+    std::optional<T> pop() {
+        std::unique_lock lock{m_mutex};
+        m_not_empty.wait(lock, [this] { return m_closed || !m_items.empty(); });
+
+        if (m_items.empty()) {
+            return std::nullopt;
+        }
+
+        T item = std::move(m_items.front());
+        m_items.pop_front();
+        m_not_full.notify_one();
+        return item;
+    }
+
+
+    /** Signals that no more items will be pushed */
+    void close() {
+        std::lock_guard lock{m_mutex};
+        m_closed = true;
+        m_not_empty.notify_all();
+        m_not_full.notify_all();
+    }
+
+
+private:
+    std::size_t m_capacity;
+    std::deque<T> m_items;
+    bool m_closed = false;
+
+    std::mutex m_mutex;
+    std::condition_variable m_not_empty;
+    std::condition_variable m_not_full;
+};
+
+#endif //IPT_MAX_BLOCKING_QUEUE_H
@@ -0,0 +1,365 @@
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <thread>
+
+#include "inference_batcher.h"
+#include "leaky_integrator.h"
+#include "model.h"
+#include "window_stream.h"
+#include "audio_file_reader.h"
+#include "blocking_queue.h"
+#include "result_writer.h"
+
+
+static const char* USAGE = R"(usage: ipt_classify <model.ts> <input> [<input> ...] [options]
+
+Classifies audio files offline, faster than real time, with the same windowing, hop and
+energy gating as ipt~. Files are processed concurrently by a pool of jobs which all share
+one loaded model: windows from all jobs are batched together into single forward passes.
+Within each job, decoding and windowing run pipelined on separate threads.
+
+input:
+  WAV files (PCM 8/16/24/32-bit or float 32/64-bit, mixed down to mono), or headerless PCM with --raw
+
+options:
+  --output <path>        output file (default: stdout)
+  --format <csv|jsonl>   output format (default: csv)
+  --batch <n>            maximum number of windows per forward pass (default: 16)
+  --jobs <n>             number of files processed concurrently (default: number of cores)
+  --workers <n>          number of concurrent forward passes on the shared model (default: 1)
+  --threads <n>          threads used by each forward pass, 0 for libtorch's default (default: 0)
+  --max-delay <ms>       maximum time a window waits for its batch to fill up (default: 10)
+  --hop <ms>             hop between two classifications, 0 for once per vector (default: 10)
+  --vector <n>           input vector size in samples, sets the hop granularity (default: 64)
+  --threshold <db>       energy threshold in dB (default: -80, i.e. disabled)
+  --window <ms>          energy threshold window (default: 20)
+  --tau <ms>             smooth the output with ipt~'s leaky integrator on the audio clock, with this
+                         time constant, i.e. (1 - sensitivity) * sensitivityrange. The output then
+                         matches ipt~ with @audioclock 1 (default: 0, no smoothing)
+  --device <cpu|cuda|mps> inference device (default: cpu)
+  --optimize             freeze and optimize the model for inference, cached next to the model file
+  --executor <profiling|legacy|simple>
+                         TorchScript graph executor (default: profiling)
+  --resampling <high|medium|low|linear>
+                         quality of resampling to the model's rate (default: high)
+  --precision <fp32|bf16|int8>
+                         inference precision (default: fp32). bf16 falls back to fp32 on CPUs
+                         without native bf16, int8 requires a model quantised at export
+  --raw <rate> <channels> <u8|s8|s16|s24|s32|f32|f64>
+                         read input as headerless little-endian PCM
+)";
+
+
+struct Options {
+    std::string model_path;
+    std::vector<std::string> input_paths;
+    std::string output_path;
+    OutputFormat format = OutputFormat::csv;
+    std::size_t batch_size = 16;
+    int num_jobs = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+    int num_workers = 1;
+    int num_threads = 0;
+    int max_delay_ms = 10;
+    int hop_ms = 10;
+    std::size_t vector_size = 64;
+    double threshold_db = EnergyThreshold::MINIMUM_THRESHOLD;
+    int window_ms = WindowStream::DEFAULT_THRESHOLD_WINDOW_MS;
+    double tau_ms = 0.0;
+    torch::DeviceType device = torch::kCPU;
+    bool optimize = false;
+    Model::ExecutorMode executor = Model::ExecutorMode::profiling;
+    Model::Precision precision = Model::Precision::fp32;
+    ResamplingQuality resampling = ResamplingQuality::high;
+
+    bool raw = false;
+    int raw_sample_rate = 0;
+    int raw_num_channels = 0;
+    SampleFormat raw_format = SampleFormat::float32;
+};
+
+
+/** Result of a submitted window, along with its position in the file */
+struct PendingResult {
+    std::size_t end_sample;
+    std::future<ClassificationResult> result;
+};
+
+
+static const std::size_t DECODE_BLOCK_SIZE = 8192;
+static const std::size_t QUEUE_CAPACITY = 8;
+
+
+// ==============================================================================================
+
+static torch::DeviceType parse_device(std::string s) {
+    std::transform(s.begin(), s.end(), s.begin(), [](unsigned char c) { return std::tolower(c); });
+    if (s == "cpu") return torch::kCPU;
+    if (s == "cuda") return torch::kCUDA;
+    if (s == "mps") return torch::kMPS;
+    throw std::runtime_error("unknown device \"" + s + "\"");
+}
+
+
+static Model::ExecutorMode parse_executor(const std::string& s) {
+    if (s == "profiling") return Model::ExecutorMode::profiling;
+    if (s == "legacy") return Model::ExecutorMode::legacy;
+    if (s == "simple") return Model::ExecutorMode::simple;
+    throw std::runtime_error("unknown executor \"" + s + "\"");
+}
+
+
+/** @throws std::runtime_error on invalid arguments */
+static Options parse_options(int argc, char* argv[]) {
+    std::vector<std::string> args(argv + 1, argv + argc);
+    Options options;
+    std::vector<std::string> positional;
+
+    for (std::size_t i = 0; i < args.size(); ++i) {
+        auto next = [&args, &i]() -> const std::string& {
+            if (i + 1 >= args.size()) {
+                throw std::runtime_error("missing value for " + args[i]);
+            }
+            return args[++i];
+        };
+
+        const auto& arg = args[i];
+        if (arg == "--output") {
+            options.output_path = next();
+        } else if (arg == "--format") {
+            options.format = ResultWriter::parse_format(next());
+        } else if (arg == "--batch") {
+            options.batch_size = std::max(1, std::stoi(next()));
+        } else if (arg == "--jobs") {
+            options.num_jobs = std::max(1, std::stoi(next()));
+        } else if (arg == "--workers") {
+            options.num_workers = std::max(1, std::stoi(next()));
+        } else if (arg == "--threads") {
+            options.num_threads = std::max(0, std::stoi(next()));
+        } else if (arg == "--max-delay") {
+            options.max_delay_ms = std::max(0, std::stoi(next()));
+        } else if (arg == "--hop") {
+            options.hop_ms = std::max(0, std::stoi(next()));
+        } else if (arg == "--vector") {
+            options.vector_size = std::max(1, std::stoi(next()));
+        } else if (arg == "--threshold") {
+            options.threshold_db = std::stod(next());
+        } else if (arg == "--window") {
+            options.window_ms = std::max(0, std::stoi(next()));
+        } else if (arg == "--tau") {
+            options.tau_ms = std::max(0.0, std::stod(next()));
+        } else if (arg == "--device") {
+            options.device = parse_device(next());
+        } else if (arg == "--optimize") {
+            options.optimize = true;
+        } else if (arg == "--executor") {
+            options.executor = parse_executor(next());
+        } else if (arg == "--resampling") {
+            options.resampling = ResamplingBuffer::parse_quality(next());
+        } else if (arg == "--precision") {
+            options.precision = Model::parse_precision(next());
+        } else if (arg == "--raw") {
+            options.raw = true;
+            options.raw_sample_rate = std::stoi(next());
+            options.raw_num_channels = std::stoi(next());
+            options.raw_format = AudioFileReader::parse_format(next());
+        } else if (arg.rfind("--", 0) == 0) {
+            throw std::runtime_error("unknown option " + arg);
+        } else {
+            positional.push_back(arg);
+        }
+    }
+
+    if (positional.size() < 2) {
+        throw std::runtime_error("expected one model and at least one input file");
+    }
+
+    options.model_path = positional[0];
+    options.input_paths.assign(positional.begin() + 1, positional.end());
+    return options;
+}
+
+
+// ==============================================================================================
+
+/** Output shared between all jobs: rows from different files may interleave, rows within a file are in order */
+class SharedWriter {
+public:
+    SharedWriter(std::ostream& stream, OutputFormat format, std::vector<std::string> class_names)
+            : m_writer(stream, format, std::move(class_names)) {}
+
+    void write(const std::string& file, double time_s, const ClassificationResult& result) {
+        std::lock_guard lock{m_mutex};
+        m_writer.write(file, time_s, result);
+    }
+
+private:
+    ResultWriter m_writer;
+    std::mutex m_mutex;
+};
+
+
+/**
+ * Decode -> window -> (shared) inference pipeline over a single file. Decoding runs on its own thread, while the
+ * calling thread windows the audio with its own WindowStream, submits windows to the shared batcher and writes
+ * results in order as they complete. Any stage failing stops the pipeline for this file.
+ */
+static void classify_file(const std::string& path
+                          , const Options& options
+                          , InferenceBatcher& batcher
+                          , SharedWriter& writer) {
+    auto reader = options.raw
+                  ? AudioFileReader::open_raw(path, options.raw_sample_rate, options.raw_num_channels, options.raw_format)
+                  : AudioFileReader::open_wav(path);
+
+    const auto& model = batcher.get_model();
+    const double sample_rate = reader.get_sample_rate();
+
+    WindowStream stream{options.threshold_db, options.window_ms, options.hop_ms};
+    stream.set_resampling_quality(options.resampling);
+    stream.initialize(reader.get_sample_rate()
+                      , static_cast<int>(options.vector_size)
+                      , model.get_sample_rate()
+                      , model.get_segment_length());
+
+    BlockingQueue<std::vector<double>> blocks(QUEUE_CAPACITY);
+    std::exception_ptr decode_error;
+
+    std::thread decoder([&] {
+        try {
+            std::vector<double> block;
+            while (reader.read(block, DECODE_BLOCK_SIZE) > 0) {
+                if (!blocks.push(std::move(block))) {
+                    break;
+                }
+                block = {};
+            }
+        } catch (...) {
+            decode_error = std::current_exception();
+        }
+        blocks.close();
+    });
+
+    // results are timed by their position in the file, so that smoothing doesn't depend on how fast they are computed
+    LeakyIntegrator integrator;
+    integrator.set_tau(options.tau_ms);
+
+    std::deque<PendingResult> pending;
+    auto write_completed = [&](bool wait) {
+        while (!pending.empty()
+               && (wait || pending.front().result.wait_for(std::chrono::seconds(0)) == std::future_status::ready)) {
+            auto result = pending.front().result.get();
+            auto end_sample = static_cast<double>(pending.front().end_sample);
+            if (options.tau_ms > 0.0) {
+                result.distribution = integrator.process(result.distribution
+                                                         , LeakyIntegrator::audio_time_ms(end_sample, sample_rate));
+            }
+            writer.write(path, end_sample / sample_rate, result);
+            pending.pop_front();
+        }
+    };
+
+    try {
+        while (auto block = blocks.pop()) {
+            stream.for_each_due_window(block->data(), block->size(), [&](const float* window, std::size_t length) {
+                pending.push_back(PendingResult{stream.samples_received()
+                                                , batcher.submit(std::vector<float>(window, window + length))});
+            });
+            write_completed(false);
+        }
+
+        batcher.flush();
+        write_completed(true);
+
+    } catch (...) {
+        blocks.close();
+        decoder.join();
+        throw;
+    }
+
+    decoder.join();
+
+    if (decode_error) {
+        std::rethrow_exception(decode_error);
+    }
+}
+
+
+/** @returns the number of files that failed */
+static std::size_t run(const Options& options, std::ostream& output) {
+    Model::set_executor_mode(options.executor);
+
+    Model::Options model_options;
+    model_options.optimize = options.optimize;
+    model_options.precision = options.precision;
+    auto model = std::make_shared<Model>(options.model_path, options.device, model_options);
+    SharedWriter writer(output, options.format, model->get_class_names());
+
+    InferenceBatcher::Config config;
+    config.max_batch_size = options.batch_size;
+    config.max_delay = std::chrono::milliseconds(options.max_delay_ms);
+    config.num_workers = options.num_workers;
+    config.num_threads = options.num_threads;
+    InferenceBatcher batcher(model, config);
+
+    std::atomic<std::size_t> next_file{0};
+    std::atomic<std::size_t> num_failed{0};
+
+    auto job = [&] {
+        for (auto i = next_file++; i < options.input_paths.size(); i = next_file++) {
+            const auto& path = options.input_paths[i];
+            try {
+                classify_file(path, options, batcher, writer);
+            } catch (const std::exception& e) {
+                std::cerr << "error: " << path << ": " << e.what() << std::endl;
+                ++num_failed;
+            }
+        }
+    };
+
+    auto num_jobs = std::min(static_cast<std::size_t>(options.num_jobs), options.input_paths.size());
+    std::vector<std::thread> jobs;
+    for (std::size_t i = 0; i < num_jobs; ++i) {
+        jobs.emplace_back(job);
+    }
+    for (auto& t: jobs) {
+        t.join();
+    }
+
+    output.flush();
+    return num_failed;
+}
+
+
+int main(int argc, char* argv[]) {
+    Options options;
+    try {
+        options = parse_options(argc, argv);
+    } catch (const std::exception& e) {
+        std::cerr << "error: " << e.what() << "\n\n" << USAGE;
+        return 2;
+    }
+
+    try {
+        std::size_t num_failed;
+        if (options.output_path.empty()) {
+            num_failed = run(options, std::cout);
+        } else {
+            std::ofstream file(options.output_path);
+            if (!file) {
+                throw std::runtime_error("could not open output file \"" + options.output_path + "\"");
+            }
+            num_failed = run(options, file);
+        }
+
+        return num_failed == 0 ? 0 : 1;
+
+    } catch (const std::exception& e) {
+        std::cerr << "error: " << e.what() << std::endl;
+        return 1;
+    }
+}
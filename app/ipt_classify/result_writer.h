@@ -0,0 +1,111 @@
+#ifndef IPT_MAX_RESULT_WRITER_H
+#define IPT_MAX_RESULT_WRITER_H
+
+#include <cstdio>
+#include <iomanip>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "model.h"
+#include "utility.h"
+
+
+enum class OutputFormat {
+    csv, jsonl
+};
+
+
+/** Writes one timestamped class distribution per line, as CSV (with header) or JSON Lines */
+class ResultWriter {
+public:
+    ResultWriter(std::ostream& stream, OutputFormat format, std::vector<std::string> class_names)
+            : m_stream(stream), m_format(format), m_class_names(std::move(class_names)) {
+        m_stream << std::setprecision(6);
+
+        if (m_format == OutputFormat::csv) {
+            m_stream << "file,time,class,confidence";
+            for (const auto& name: m_class_names) {
+                m_stream << "," << escape_csv(name);
+            }
+            m_stream << "\n";
+        }
+    }
+
+
+    /** @param time_s end of the classified window, in seconds from the start of the file */
+    void write(const std::string& file, double time_s, const ClassificationResult& result) {
+        const auto& distribution = result.distribution;
+        auto index = util::argmax(distribution);
+        const auto& class_name = index < m_class_names.size() ? m_class_names[index] : std::to_string(index);
+
+        if (m_format == OutputFormat::csv) {
+            m_stream << escape_csv(file) << "," << time_s << "," << escape_csv(class_name) << "," << distribution[index];
+            for (auto p: distribution) {
+                m_stream << "," << p;
+            }
+            m_stream << "\n";
+        } else {
+            m_stream << "{\"file\":" << escape_json(file)
+                     << ",\"time\":" << time_s
+                     << ",\"class\":" << escape_json(class_name)
+                     << ",\"confidence\":" << distribution[index]
+                     << ",\"distribution\":[";
+            for (std::size_t i = 0; i < distribution.size(); ++i) {
+                m_stream << (i > 0 ? "," : "") << distribution[i];
+            }
+            m_stream << "]}\n";
+        }
+    }
+
+
+    static OutputFormat parse_format(const std::string& s) {
+        if (s == "csv") return OutputFormat::csv;
+        if (s == "jsonl") return OutputFormat::jsonl;
+        throw std::runtime_error("unknown output format \"" + s + "\" (expected csv or jsonl)");
+    }
+
+
+private:
+    static std::string escape_csv(const std::string& s) {
+        if (s.find_first_of(",\"\n") == std::string::npos) {
+            return s;
+        }
+
+        std::string escaped = "\"";
+        for (auto c: s) {
+            escaped += (c == '"') ? std::string("\"\"") : std::string(1, c);
+        }
+        return escaped + "\"";
+    }
+
+
+    static std::string escape_json(const std::string& s) {
+        std::string escaped = "\"";
+        for (auto c: s) {
+            switch (c) {
+                case '"': escaped += "\\\""; break;
+                case '\\': escaped += "\\\\"; break;
+                case '\n': escaped += "\\n"; break;
+                case '\t': escaped += "\\t"; break;
+                default:
+                    if (static_cast<unsigned char>(c) < 0x20) {
+                        char code[7];
+                        std::snprintf(code, sizeof(code), "\\u%04x", static_cast<unsigned char>(c));
+                        escaped += code;
+                    } else {
+                        escaped += c;
+                    }
+            }
+        }
+        return escaped + "\"";
+    }
+
+
+    std::ostream& m_stream;
+    OutputFormat m_format;
+    std::vector<std::string> m_class_names;
+};
+
+#endif //IPT_MAX_RESULT_WRITER_H
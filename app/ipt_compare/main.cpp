@@ -0,0 +1,287 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <optional>
+#include <random>
+
+#include "model.h"
+#include "window_stream.h"
+#include "audio_file_reader.h"
+
+
+static const char* USAGE = R"(usage: ipt_compare <model.ts> [<input.wav> ...] [options]
+
+Compares a reduced-precision model against the fp32 reference: both are warmed up and run on
+the same windows, and the forward-pass latency of each along with the top-1 agreement and the
+largest difference in class probability are reported.
+
+Windows are taken from the given WAV files with the same windowing as ipt~, or are synthetic
+noise when no input is given. Agreement on noise is only indicative: compare on real material.
+
+options:
+  --candidate <path>     model to compare against the reference (default: the reference model).
+                         Use this for a model quantised at export
+  --precision <fp32|bf16|int8>
+                         precision of the candidate (default: bf16, int8 when --candidate is given)
+  --optimize             freeze and optimize both models for inference
+  --batch <n>            windows per forward pass (default: 1)
+  --windows <n>          maximum number of windows compared (default: 500)
+  --hop <ms>             hop between two windows of an input file (default: 50)
+  --threads <n>          threads used by each forward pass, 0 for libtorch's default (default: 0)
+  --warmup <n>           warm-up passes of each model (default: 10)
+)";
+
+
+struct Options {
+    std::string reference_path;
+    std::string candidate_path;
+    std::vector<std::string> input_paths;
+    std::optional<Model::Precision> precision;
+    bool optimize = false;
+    std::size_t batch_size = 1;
+    std::size_t max_windows = 500;
+    int hop_ms = 50;
+    int num_threads = 0;
+    int warm_up_passes = 10;
+};
+
+
+/** Forward-pass latencies and results of one model over all windows */
+struct RunResult {
+    std::vector<double> latencies_ms;
+    std::vector<ClassificationResult> results;
+};
+
+
+static const std::size_t DECODE_BLOCK_SIZE = 8192;
+static const std::size_t NOISE_SEED = 1234;
+
+
+// ==============================================================================================
+
+/** @throws std::runtime_error on invalid arguments */
+static Options parse_options(int argc, char* argv[]) {
+    std::vector<std::string> args(argv + 1, argv + argc);
+    Options options;
+    std::vector<std::string> positional;
+
+    for (std::size_t i = 0; i < args.size(); ++i) {
+        auto next = [&args, &i]() -> const std::string& {
+            if (i + 1 >= args.size()) {
+                throw std::runtime_error("missing value for " + args[i]);
+            }
+            return args[++i];
+        };
+
+        const auto& arg = args[i];
+        if (arg == "--candidate") {
+            options.candidate_path = next();
+        } else if (arg == "--precision") {
+            options.precision = Model::parse_precision(next());
+        } else if (arg == "--optimize") {
+            options.optimize = true;
+        } else if (arg == "--batch") {
+            options.batch_size = std::max(1, std::stoi(next()));
+        } else if (arg == "--windows") {
+            options.max_windows = std::max(1, std::stoi(next()));
+        } else if (arg == "--hop") {
+            options.hop_ms = std::max(0, std::stoi(next()));
+        } else if (arg == "--threads") {
+            options.num_threads = std::max(0, std::stoi(next()));
+        } else if (arg == "--warmup") {
+            options.warm_up_passes = std::max(0, std::stoi(next()));
+        } else if (arg.rfind("--", 0) == 0) {
+            throw std::runtime_error("unknown option " + arg);
+        } else {
+            positional.push_back(arg);
+        }
+    }
+
+    if (positional.empty()) {
+        throw std::runtime_error("expected a model");
+    }
+
+    options.reference_path = positional[0];
+    options.input_paths.assign(positional.begin() + 1, positional.end());
+
+    if (options.candidate_path.empty()) {
+        options.candidate_path = options.reference_path;
+    }
+    return options;
+}
+
+
+// ==============================================================================================
+
+static std::vector<std::vector<float>> read_windows(const Options& options, const Model& model) {
+    std::vector<std::vector<float>> windows;
+
+    for (const auto& path: options.input_paths) {
+        auto reader = AudioFileReader::open_wav(path);
+
+        WindowStream stream{EnergyThreshold::MINIMUM_THRESHOLD, WindowStream::DEFAULT_THRESHOLD_WINDOW_MS, options.hop_ms};
+        stream.initialize(reader.get_sample_rate(), 64, model.get_sample_rate(), model.get_segment_length());
+
+        std::vector<double> block;
+        while (windows.size() < options.max_windows && reader.read(block, DECODE_BLOCK_SIZE) > 0) {
+            stream.for_each_due_window(block.data(), block.size(), [&](const float* window, std::size_t length) {
+                if (windows.size() < options.max_windows) {
+                    windows.emplace_back(window, window + length);
+                }
+            });
+        }
+    }
+
+    return windows;
+}
+
+
+/** Noise at amplitudes spread over the range ipt~ typically sees, from near silence to full scale */
+static std::vector<std::vector<float>> noise_windows(const Options& options, const Model& model) {
+    std::mt19937 generator(NOISE_SEED);
+    std::normal_distribution<float> distribution(0.0f, 1.0f);
+
+    std::vector<std::vector<float>> windows(options.max_windows);
+    for (std::size_t i = 0; i < windows.size(); ++i) {
+        auto gain = std::pow(10.0f, -3.0f * static_cast<float>(i % 7) / 6.0f) * 0.5f;
+        windows[i].resize(static_cast<std::size_t>(model.get_segment_length()));
+        for (auto& sample: windows[i]) {
+            sample = std::clamp(gain * distribution(generator), -1.0f, 1.0f);
+        }
+    }
+    return windows;
+}
+
+
+static RunResult run(Model& model, const std::vector<std::vector<float>>& windows, const Options& options) {
+    model.warm_up({options.batch_size}, options.warm_up_passes);
+
+    RunResult run;
+    run.results.reserve(windows.size());
+
+    for (std::size_t start = 0; start < windows.size(); start += options.batch_size) {
+        auto end = std::min(windows.size(), start + options.batch_size);
+        std::vector<std::vector<float>> batch(windows.begin() + static_cast<std::ptrdiff_t>(start)
+                                              , windows.begin() + static_cast<std::ptrdiff_t>(end));
+
+        auto t0 = std::chrono::steady_clock::now();
+        auto results = model.classify(batch);
+        auto t1 = std::chrono::steady_clock::now();
+
+        run.latencies_ms.push_back(std::chrono::duration<double, std::milli>(t1 - t0).count());
+        std::move(results.begin(), results.end(), std::back_inserter(run.results));
+    }
+
+    return run;
+}
+
+
+static double percentile(std::vector<double> values, double p) {
+    if (values.empty()) {
+        return 0.0;
+    }
+    std::sort(values.begin(), values.end());
+    auto index = static_cast<std::size_t>(p * static_cast<double>(values.size() - 1) + 0.5);
+    return values[index];
+}
+
+
+static double mean(const std::vector<double>& values) {
+    double sum = 0.0;
+    for (auto v: values) {
+        sum += v;
+    }
+    return values.empty() ? 0.0 : sum / static_cast<double>(values.size());
+}
+
+
+static void print_latency(const std::string& name, const Model& model, const RunResult& run) {
+    std::cout << std::left << std::setw(10) << name
+              << std::setw(6) << Model::precision_name(model.get_precision())
+              << " mean " << std::setw(9) << mean(run.latencies_ms)
+              << " p50 " << std::setw(9) << percentile(run.latencies_ms, 0.5)
+              << " p99 " << std::setw(9) << percentile(run.latencies_ms, 0.99) << " ms\n";
+}
+
+
+static void compare(const Options& options) {
+    Model::set_num_threads(options.num_threads);
+
+    Model::Options reference_options;
+    reference_options.optimize = options.optimize;
+    reference_options.precision = Model::Precision::fp32;
+
+    Model::Options candidate_options;
+    candidate_options.optimize = options.optimize;
+    candidate_options.precision = options.precision.value_or(options.candidate_path == options.reference_path
+                                                             ? Model::Precision::bf16
+                                                             : Model::Precision::int8);
+
+    Model reference(options.reference_path, torch::kCPU, reference_options);
+    Model candidate(options.candidate_path, torch::kCPU, candidate_options);
+
+    if (candidate.get_precision() != candidate_options.precision) {
+        std::cerr << "warning: " << Model::precision_name(candidate_options.precision)
+                  << " is not supported natively on this CPU, running the candidate in "
+                  << Model::precision_name(candidate.get_precision()) << std::endl;
+    }
+
+    if (candidate.get_class_names() != reference.get_class_names()
+        || candidate.get_segment_length() != reference.get_segment_length()) {
+        throw std::runtime_error("candidate and reference model have different classes or segment lengths");
+    }
+
+    auto windows = options.input_paths.empty() ? noise_windows(options, reference) : read_windows(options, reference);
+    if (windows.empty()) {
+        throw std::runtime_error("no windows in input");
+    }
+
+    auto reference_run = run(reference, windows, options);
+    auto candidate_run = run(candidate, windows, options);
+
+    std::size_t num_agreeing = 0;
+    float max_difference = 0.0f;
+    for (std::size_t i = 0; i < windows.size(); ++i) {
+        const auto& expected = reference_run.results[i].distribution;
+        const auto& actual = candidate_run.results[i].distribution;
+
+        auto expected_top = std::max_element(expected.begin(), expected.end()) - expected.begin();
+        auto actual_top = std::max_element(actual.begin(), actual.end()) - actual.begin();
+        num_agreeing += expected_top == actual_top ? 1 : 0;
+
+        for (std::size_t c = 0; c < expected.size() && c < actual.size(); ++c) {
+            max_difference = std::max(max_difference, std::abs(expected[c] - actual[c]));
+        }
+    }
+
+    std::cout << std::fixed << std::setprecision(3);
+    std::cout << windows.size() << " windows, batch size " << options.batch_size << "\n";
+    print_latency("reference", reference, reference_run);
+    print_latency("candidate", candidate, candidate_run);
+    std::cout << "speedup    " << mean(reference_run.latencies_ms) / mean(candidate_run.latencies_ms) << "x\n";
+    std::cout << "top-1 agreement " << 100.0 * static_cast<double>(num_agreeing) / static_cast<double>(windows.size())
+              << " %\n";
+    std::cout << "max probability difference " << max_difference << std::endl;
+}
+
+
+int main(int argc, char* argv[]) {
+    Options options;
+    try {
+        options = parse_options(argc, argv);
+    } catch (const std::exception& e) {
+        std::cerr << "error: " << e.what() << "\n\n" << USAGE;
+        return 2;
+    }
+
+    try {
+        compare(options);
+        return 0;
+    } catch (const std::exception& e) {
+        std::cerr << "error: " << e.what() << std::endl;
+        return 1;
+    }
+}
@@ -29,6 +29,7 @@ int main() {
     auto classifier = IptClassifier{model_path, device, energy_threshold_db, energy_threshold_ms};
 
     classifier.initialize_model();
+    classifier.warm_up();
     classifier.initialize_buffers(sr, input_vector_length);
 
     std::vector<ClassificationResult> output_classes;
@@ -41,11 +42,13 @@ int main() {
     while (num_inferences > 0) {
         auto audio_input_vector = random_vector(input_vector_length, rng, dist);
 
-        auto result = classifier.process(std::move(audio_input_vector));
+        auto results = classifier.process(std::move(audio_input_vector));
 
-        if (result) {
-            output_classes.push_back(*result);
-            --num_inferences;
+        for (auto& result: results) {
+            if (num_inferences > 0) {
+                output_classes.push_back(std::move(result));
+                --num_inferences;
+            }
         }
     }
 
@@ -1,9 +1,15 @@
 #include "c74_min.h"
 #include <torch/script.h>
 #include <chrono>
+#include <iterator>
+#include <numeric>
 
+#include "binary_semaphore.h"
+#include "inference_service.h"
 #include "ipt_classifier.h"
 #include "leaky_integrator.h"
+#include "spsc_ring_buffer.h"
+#include "thread_control.h"
 #include "utility.h"
 
 using namespace c74::min;
@@ -16,7 +22,25 @@ struct Docs {
     static const inline title THRESHOLD_TITLE = "Threshold";
     static const inline title WINDOW_TITLE = "Window";
     static const inline title CONFIDENCE_TITLE = "Confidence";
+    static const inline title CHANGES_TITLE = "Changes Only";
+    static const inline title DELTA_TITLE = "Confidence Delta";
+    static const inline title TOPK_TITLE = "Top-k";
     static const inline title PERIOD_TITLE = "Period";
+    static const inline title AUDIO_CLOCK_TITLE = "Audio Clock";
+    static const inline title HOP_TITLE = "Hop";
+    static const inline title RESAMPLING_TITLE = "Resampling Quality";
+    static const inline title SHARED_TITLE = "Shared Inference";
+    static const inline title STREAMING_TITLE = "Streaming Inference";
+    static const inline title FEATURES_TITLE = "Cached Features";
+    static const inline title DEADLINE_TITLE = "Deadline";
+    static const inline title WARMUP_TITLE = "Warm-up Passes";
+    static const inline title OPTIMIZE_TITLE = "Optimize";
+    static const inline title EXECUTOR_TITLE = "Executor";
+    static const inline title PRECISION_TITLE = "Precision";
+    static const inline title THREADS_TITLE = "Inference Threads";
+    static const inline title INTEROP_THREADS_TITLE = "Inter-op Threads";
+    static const inline title AFFINITY_TITLE = "Affinity";
+    static const inline title PRIORITY_TITLE = "Priority";
 
     static const inline description VERBOSE_DESCRIPTION = "Enable or disable verbose logging."
                                                           " When set to @verbose @1, the object provides detailed"
@@ -44,10 +68,87 @@ struct Docs {
     static const inline description CLASS_NAMES_DESCRIPTION = "Message to retrieve the list of class names from the model."
                                                             " Outputs the class names associated with the loaded model"
                                                             " via the dumpout outlet.";
+    static const inline description WARMUP_DESCRIPTION = "Set the number of warm-up passes run when a model is loaded."
+                                                            " Use an @int of @0 or greater. The model is run this many times"
+                                                            " on silence, for each batch size the object uses, before the"
+                                                            " first real classification, so that the first note played"
+                                                            " doesn't suffer from the much slower first inferences."
+                                                            " The warm-up time is output as 'warmup' and the latency of the"
+                                                            " first real inference as 'firstlatency' via the dumpout outlet.";
+    static const inline description OPTIMIZE_DESCRIPTION = "Enable or disable inference optimization of the model."
+                                                            " When set to @optimize @1, the model is frozen and optimized"
+                                                            " for inference when loaded (constant folding, operator fusion"
+                                                            " and, on CPU, MKLDNN layouts), which typically reduces the"
+                                                            " latency reported via the dumpout outlet. The optimized model"
+                                                            " is cached next to the model file, so that only the first load"
+                                                            " is slower. Only applies to models loaded after it is set,"
+                                                            " i.e. set it as an argument, or before a @load message.";
+    static const inline description EXECUTOR_DESCRIPTION = "Set the TorchScript graph executor."
+                                                            " Use @profiling (libtorch's default) to specialize the graph"
+                                                            " after profiling the first runs, @legacy to specialize it on"
+                                                            " the first run, or @simple to run the graph without any"
+                                                            " specialization, which avoids the slow first runs at the cost"
+                                                            " of fusion. @default leaves the current setting unchanged."
+                                                            " Note that this setting is shared by all objects.";
+    static const inline description PRECISION_DESCRIPTION = "Set the numerical precision of inference."
+                                                            " Use @fp32 (default), @bf16 to run the model in bfloat16,"
+                                                            " which is only applied on CPUs with native bfloat16 support"
+                                                            " and otherwise falls back to @fp32, or @int8 for a model that"
+                                                            " was quantised when exported. Reduced precision may change"
+                                                            " the classification slightly: use the ipt_compare tool to"
+                                                            " check the agreement with @fp32 on your own material."
+                                                            " Only applies to models loaded after it is set.";
+    static const inline description THREADS_DESCRIPTION = "Set the number of threads used by each inference."
+                                                            " Use an @int of @0 or greater. When set to @0, libtorch's default"
+                                                            " is used, typically one thread per core, which oversubscribes"
+                                                            " the cores when many objects run at once. Setting it to @1"
+                                                            " with many objects generally gives the most predictable latency.";
+    static const inline description INTEROP_THREADS_DESCRIPTION = "Set the number of threads running independent"
+                                                            " operators of the model concurrently. Use an @int of @0 or greater."
+                                                            " When set to @0, libtorch's default is used. Note that this"
+                                                            " setting is shared by all objects, and can only be changed"
+                                                            " before the first inference of the process, i.e. as an argument.";
+    static const inline description AFFINITY_DESCRIPTION = "Set the cores the inference thread may run on."
+                                                            " Use a list of core indices, e.g. to keep inference away from"
+                                                            " the cores used by audio. An empty list allows all cores"
+                                                            " (default). Only supported on Linux.";
+    static const inline description PRIORITY_DESCRIPTION = "Set the scheduling priority of the inference thread."
+                                                            " Use an @int between @0 and @99. When set to @0, the thread"
+                                                            " is scheduled normally (default). Above @0, the thread uses"
+                                                            " real-time scheduling with this priority on Linux, which"
+                                                            " requires the corresponding permissions, and the"
+                                                            " user-interactive quality of service on macOS.";
+    static const inline description STATS_DESCRIPTION = "Message to retrieve latency statistics of each stage of"
+                                                            " classification. Outputs one 'stats' message per stage via the"
+                                                            " dumpout outlet: the stage name (fifo, resampling, gating,"
+                                                            " window, features, forward, softmax, integrator, delivery),"
+                                                            " the number of measurements, and the median, 95th and 99th"
+                                                            " percentile and maximum duration in milliseconds. Use @stats"
+                                                            " @reset to clear the statistics, e.g. after changing settings.";
+    static const inline description LOAD_DESCRIPTION = "Message to replace the model while running."
+                                                            " Takes the filepath of the new model as argument. The model is"
+                                                            " loaded in the background while the current model keeps"
+                                                            " classifying, and replaces it without interrupting the output."
+                                                            " Outputs 'loaded' followed by the filepath via the dumpout"
+                                                            " outlet once the new model is in use.";
     static const inline description CONFIDENCE_DESCRIPTION = "Set the minimum confidence threshold for classification output."
                                                             " Use a @float between @0. and @1. When the highest probability"
                                                             " is below this threshold, outputs 'no_confidence' instead of"
                                                             " the predicted class name.";
+    static const inline description CHANGES_DESCRIPTION = "Enable or disable output on changes only."
+                                                            " When set to @changes @1, a result is only output when the"
+                                                            " recognized class differs from the last output, or when its"
+                                                            " confidence differs from the last output by more than @delta."
+                                                            " This greatly reduces the number of messages sent to the patch"
+                                                            " while the playing technique doesn't change.";
+    static const inline description DELTA_DESCRIPTION = "Set the confidence change that triggers an output when @changes"
+                                                            " is enabled. Use a @float between @0. and @1. (default @0.05).";
+    static const inline description TOPK_DESCRIPTION = "Set the number of classes output as distribution."
+                                                            " Use an @int of @0 or greater. When set to @0, the probability"
+                                                            " of every class is output (default). When greater than @0, only"
+                                                            " the classes with the @topk highest probabilities are output,"
+                                                            " as a list of index and probability pairs sorted by decreasing"
+                                                            " probability.";
     static const inline description PERIOD_DESCRIPTION = "Set the output period in milliseconds."
                                                             " Use an @int of @0 or greater. When set to @0, each inference"
                                                             " result is output immediately (default). When set to a value"
@@ -55,24 +156,352 @@ struct Docs {
                                                             " within each period are accumulated by the leaky integrator"
                                                             " before a single smoothed output is sent. Longer periods"
                                                             " produce more smoothing.";
+    static const inline description AUDIO_CLOCK_DESCRIPTION = "Enable or disable timing of smoothing and output by audio."
+                                                            " When set to @audioclock @1, the leaky integrator and the"
+                                                            " @period measure time in samples of incoming audio rather than"
+                                                            " in system time. Results are then smoothed according to the"
+                                                            " position of their windows in the audio, independently of"
+                                                            " when they are computed, so that results computed in bursts"
+                                                            " are smoothed as if they had been spread out, and the output"
+                                                            " is identical to offline classification of the same audio with"
+                                                            " ipt_classify --tau. Periodic output is only sent while audio"
+                                                            " is running.";
+    static const inline description HOP_DESCRIPTION = "Set the hop size in milliseconds between two inferences."
+                                                            " Use an @int of @0 or greater. The model runs exactly once"
+                                                            " per hop of incoming audio, independently of thread"
+                                                            " scheduling, which bounds the CPU cost of each instance."
+                                                            " When set to @0, the model runs once per signal vector (default).";
+    static const inline description RESAMPLING_DESCRIPTION = "Set the quality of the resampling of the input to the"
+                                                            " model's sample rate. Use @high (default) for the best filter,"
+                                                            " @medium or @low for shorter minimum-phase filters with less"
+                                                            " CPU cost and delay, or @linear for linear interpolation without"
+                                                            " filtering, which adds almost no delay but may alias. The delay"
+                                                            " is added to the latency of every classification, and is output"
+                                                            " as 'resamplinglatency' in milliseconds via the dumpout outlet"
+                                                            " when audio is started. When the sample rate of Max matches the"
+                                                            " model's, the input is passed through and this has no effect.";
+    static const inline description STREAMING_DESCRIPTION = "Enable or disable streaming inference."
+                                                            " When the model exports a 'forward_stream' method and"
+                                                            " @streaming is @1 (default), each hop only feeds the new"
+                                                            " samples to the model, which carries its state from one hop to"
+                                                            " the next, instead of classifying the entire window again."
+                                                            " Models without this method always classify entire windows,"
+                                                            " as does @shared inference.";
+    static const inline description FEATURES_DESCRIPTION = "Enable or disable cached spectral features."
+                                                            " When the model exports 'forward_features' and"
+                                                            " 'get_feature_config' methods and @features is @1 (default),"
+                                                            " the mel spectrogram of each channel is computed"
+                                                            " incrementally, one frame per new hop of the front end, and"
+                                                            " the model only classifies the features instead of the raw"
+                                                            " window. Streaming models use @streaming instead, and"
+                                                            " @shared inference always classifies entire windows.";
+    static const inline description SHARED_DESCRIPTION = "Enable or disable shared inference."
+                                                            " When set to @shared @1, windows are classified by a"
+                                                            " process-wide inference service, together with those of all"
+                                                            " other shared ipt~ objects using the same model and device,"
+                                                            " in batched forward passes. This reduces the total CPU cost"
+                                                            " of many objects, at the price of up to @deadline"
+                                                            " milliseconds of additional latency. When enabled after"
+                                                            " the model has been loaded, it is first warmed up for the"
+                                                            " largest batch in the background, and the object keeps"
+                                                            " classifying on its own until this is done.";
+    static const inline description DEADLINE_DESCRIPTION = "Set the maximum batching delay of shared inference in milliseconds."
+                                                            " Use a @float of @0. or greater. When @shared is enabled, a batch"
+                                                            " containing a window of this object is started no later than"
+                                                            " @deadline milliseconds after the window is complete,"
+                                                            " even if the batch is not full.";
 
 };
 
 
+// position of a window in the input, in samples counted by the perform routine since dsp was started
+struct WindowPosition {
+    double end_sample = 0.0;    // the window's last sample
+    double drain_sample = 0.0;  // the input's position when the processing thread drained the window's last sample
+    std::uint64_t audio_epoch = 0;  // of the audio clock the samples are counted on, see ipt_tilde::dspsetup
+};
+
+
+// age of the audio behind an output, from the window's last sample entering the object to the output being sent
+struct EndToEndLatency {
+    double total_samples = 0.0;
+    double total_ms = 0.0;
+    double buffering_ms = 0.0;   // until the processing thread drained the window's last sample
+    double resampling_ms = 0.0;  // delay of the resampler, by which the window's content precedes its end
+    double queueing_ms = 0.0;    // from the drain to the output, other than the compute time
+    double compute_ms = 0.0;     // forward pass and softmax of the window's batch
+
+
+    /**
+     * The stages add up to the total: positions out of order are clamped, and the compute time (measured by the model
+     * on the steady clock) is capped to the time since the drain (interpolated on the audio clock)
+     * @param now_sample the input's position when the output is sent
+     */
+    static EndToEndLatency measure(const WindowPosition& position
+                                   , double now_sample
+                                   , double sample_rate
+                                   , double resampling_ms
+                                   , double compute_ms) {
+        auto samples_to_ms = 1000.0 / sample_rate;
+        auto end_sample = position.end_sample;
+        auto output_sample = std::max(end_sample, now_sample);
+        auto drain_sample = std::clamp(position.drain_sample, end_sample, output_sample);
+
+        EndToEndLatency latency;
+        latency.buffering_ms = (drain_sample - end_sample) * samples_to_ms;
+        latency.resampling_ms = resampling_ms;
+        auto processing_ms = (output_sample - drain_sample) * samples_to_ms;
+        latency.compute_ms = std::clamp(compute_ms, 0.0, processing_ms);
+        latency.queueing_ms = processing_ms - latency.compute_ms;
+        latency.total_samples = output_sample - end_sample + resampling_ms / samples_to_ms;
+        latency.total_ms = latency.buffering_ms + latency.resampling_ms + processing_ms;
+        return latency;
+    }
+};
+
+
+// classification result stamped with its production time, so that batched
+// results drained at once keep their real temporal spacing for smoothing
+struct TimedResult {
+    std::size_t channel;
+    ClassificationResult result;
+    std::chrono::time_point<std::chrono::steady_clock> time;
+    WindowPosition position;
+};
+
+
+/**
+ * Fifo of results from the processing thread (and the shared inference service) to the scheduler thread. The
+ * distribution buffers of the results circulate through a pool of spares: producers copy each result into a spare
+ * buffer and the consumer returns it once delivered, so that results are passed on without allocating.
+ */
+class ResultFifo {
+public:
+    explicit ResultFifo(std::size_t capacity)
+            : m_capacity(capacity)
+              , m_results(capacity)
+              , m_spares(num_spares()) {}
+
+
+    /**
+     * One buffer per slot of the fifo, and one held by the consumer while delivering: as no buffer is lost, not
+     * even those of dropped results, the pool can't run dry while the fifo has room
+     */
+    std::size_t num_spares() const {
+        return m_capacity + 1;
+    }
+
+
+    /**
+     * Fills the pool of spare buffers, so that even the first results don't allocate
+     * @note Call once, before any result is pushed
+     */
+    void prepare(std::size_t num_classes) {
+        m_num_classes = num_classes;
+        for (std::size_t i = 0; i < num_spares(); ++i) {
+            std::vector<float> distribution;
+            distribution.reserve(num_classes);
+            m_spares.try_enqueue(std::move(distribution));
+        }
+    }
+
+
+    /**
+     * Replaces the spare buffers by buffers sized for `num_classes`, allocated here, so that the results of a newly
+     * loaded model don't allocate on the producer side. Buffers in flight are resized by `recycle()` instead.
+     * @note May be called from any thread. The spare fifo is only consumed here, its producer remains the consumer of
+     *       the results
+     */
+    void resize(std::size_t num_classes) {
+        m_num_classes = num_classes;
+
+        std::vector<std::vector<float>> resized(num_spares());
+        for (auto& distribution: resized) {
+            distribution.reserve(num_classes);
+        }
+
+        // buffers are only swapped under the lock: allocated before it, and the replaced ones freed after it
+        std::vector<std::vector<float>> replaced;
+        replaced.reserve(2 * resized.size());
+        {
+            std::lock_guard lock{m_producer_mutex};
+
+            std::vector<float> distribution;
+            while (m_spares.try_dequeue(distribution)) {
+                replaced.push_back(std::move(distribution));
+            }
+            std::move(m_resized.begin(), m_resized.end(), std::back_inserter(replaced));
+
+            // as many buffers as were taken, so that their number in circulation doesn't change
+            auto has_dropped = m_dropped.capacity() > 0;
+            auto num_taken = std::min(replaced.size(), resized.size() - (has_dropped ? 1 : 0));
+            if (has_dropped) {
+                std::swap(m_dropped, resized[num_taken]);
+            }
+            std::move(resized.begin() + static_cast<std::ptrdiff_t>(num_taken), resized.end()
+                      , std::back_inserter(replaced));
+            resized.resize(num_taken);
+            std::swap(m_resized, resized);
+        }
+    }
+
+
+    /**
+     * Copies `result` into a spare buffer, if any, and enqueues it.
+     * @note Producer side, may be called from several threads
+     * @returns false if the result was dropped, as the consumer has fallen behind
+     */
+    bool push(std::size_t channel, const ClassificationResult& result, const WindowPosition& position) {
+        std::lock_guard lock{m_producer_mutex};
+
+        std::vector<float> distribution;
+        if (m_dropped.capacity() > 0) {
+            distribution.swap(m_dropped);
+        } else if (!m_resized.empty()) {
+            distribution = std::move(m_resized.back());
+            m_resized.pop_back();
+        } else {
+            m_spares.try_dequeue(distribution);
+        }
+        distribution.assign(result.distribution.begin(), result.distribution.end());
+
+        TimedResult timed{channel
+                          , ClassificationResult{std::move(distribution)
+                                                 , result.inference_latency_ms
+                                                 , result.compute_ms}
+                          , std::chrono::steady_clock::now()
+                          , position};
+
+        // keep the buffer of a dropped result for the next one
+        if (!m_results.try_enqueue(std::move(timed))) {
+            m_dropped = std::move(timed.result.distribution);
+            return false;
+        }
+        return true;
+    }
+
+
+    /** @note Consumer side only. Return the result's distribution buffer with `recycle()` once delivered */
+    bool pop(TimedResult& timed) {
+        return m_results.try_dequeue(timed);
+    }
+
+
+    /** Returns a delivered buffer to the pool, sized for the latest call to `resize()` */
+    void recycle(std::vector<float>&& distribution) {
+        distribution.reserve(m_num_classes.load());
+        m_spares.try_enqueue(std::move(distribution));
+    }
+
+
+private:
+    std::size_t m_capacity;
+    c74::min::fifo<TimedResult> m_results;
+    c74::min::fifo<std::vector<float>> m_spares;  // produced by the consumer, consumed under `m_producer_mutex`
+    std::atomic<std::size_t> m_num_classes{0};
+
+    std::mutex m_producer_mutex;                  // serializes the producers: processing thread and shared inference
+    std::vector<float> m_dropped;                 // buffer of the latest dropped result, under the mutex
+    std::vector<std::vector<float>> m_resized;    // spares sized by `resize()`, used before the others, under the mutex
+};
+
+
+struct ipt_tilde_test_access;  // defined by the unit tests, to drive the output path without a model
+
+
 class ipt_tilde : public object<ipt_tilde>, public vector_operator<> {
 private:
-    // classification result stamped with its production time, so that batched
-    // results drained at once keep their real temporal spacing for smoothing
-    struct TimedResult {
-        ClassificationResult result;
-        std::chrono::time_point<std::chrono::steady_clock> time;
+    friend struct ipt_tilde_test_access;
+
+    // output state of one input channel, only accessed from the scheduler thread
+    struct ChannelOutput {
+        LeakyIntegrator integrator;
+        std::vector<float> distribution;
+        bool has_result = false;
+        long sent_index = NO_OUTPUT_INDEX;     // class index of the latest output, -1 for 'no_confidence'
+        float sent_confidence = 0.0f;          // highest probability of the latest output
+        std::chrono::time_point<std::chrono::steady_clock> result_time; // when the latest result was enqueued
+        WindowPosition position;                                         // of the latest result
+        double compute_ms = 0.0;                                         // of the latest result
+    };
+
+    // settings of the processing thread, see `threads`, `affinity` and `priority`
+    struct ThreadSettings {
+        int num_threads = 0;
+        std::vector<int> cores;
+        int priority = 0;
+    };
+
+    // Receives results from the shared inference service on its worker thread. Outlives the object when windows are
+    // still in flight on destruction, in which case `owner` is reset and their results are discarded
+    struct ResultSink {
+        std::mutex mutex;
+        ipt_tilde* owner;
     };
 
     std::unique_ptr<IptClassifier> m_classifier;
 
+    // channel and position of a window in flight in the shared batcher, indexed by its slot in the window pool
+    struct SharedWindow {
+        std::size_t channel = 0;
+        WindowPosition position;
+    };
+
+    std::shared_ptr<ResultSink> m_result_sink;
+    std::shared_ptr<InferenceBatcher> m_batcher;  // only accessed from the processing thread, set when `shared` is on
+
+    // windows submitted to `m_batcher`, replaced along with it. Only accessed from the processing thread
+    std::shared_ptr<WindowPool> m_window_pool;
+    std::shared_ptr<std::vector<SharedWindow>> m_shared_windows;
+    std::vector<std::size_t> m_submitted_slots;
+
+    // the batcher is only acquired once the loader thread has served every warm-up request of `shared`
+    std::atomic<std::size_t> m_shared_warm_up_requests{0};
+    std::atomic<std::size_t> m_shared_warm_up_done{0};
+
+    static const std::size_t AUDIO_RING_CAPACITY = 16384;
+    static const std::size_t EVENT_FIFO_CAPACITY = 100;
+    static const std::size_t MAX_CHANNELS = 64;
+    static const std::size_t SHARED_WINDOWS_PER_CHANNEL = 16;  // in flight in the shared batcher at once
+    static const inline symbol NO_CONFIDENCE_SYMBOL{"no_confidence"};
+    static const long NO_OUTPUT_INDEX = -2;
+
+    // 'endtoend' followed by the total in samples and ms, then buffering, resampling, queueing and compute in ms
+    static const inline symbol END_TO_END_SYMBOL{"endtoend"};
+    static const std::size_t END_TO_END_SIZE = 7;
+
+    std::size_t m_num_channels = 1;
+    std::vector<std::unique_ptr<inlet<>>> m_channel_inlets; // signal inlets of all channels but the first
+
     std::thread m_processing_thread;
-    c74::min::fifo<double> m_audio_fifo{16384};
-    c74::min::fifo<TimedResult> m_event_fifo{100};
+    std::thread m_loader_thread;                 // background loading of `load` and warm-up of `shared`
+    std::atomic<bool> m_loading = false;
+    std::atomic<bool> m_thread_settings_changed = true; // applied by the processing thread to itself
+    std::mutex m_thread_settings_mutex;
+    ThreadSettings m_thread_settings;            // written by the setters, read by the processing thread
+    std::mutex m_reports_mutex;
+    std::vector<atoms> m_reports;                // dumpout messages from background threads, sent by `reporter`
+    bool m_report_first_latency = true;          // only accessed from the scheduler thread
+    bool m_integrators_on_audio_clock = false;   // only accessed from the scheduler thread
+    std::atomic<bool> m_audio_clock_restarted = false;  // set on dspsetup, the integrators are reset by the deliverer
+    std::atomic<std::uint64_t> m_audio_epoch{0};        // odd while dspsetup restarts the audio clock, see there
+    std::uint64_t m_drained_epoch = 0;                  // only accessed from the processing thread
+    std::unique_ptr<SpscRingBuffer<double>> m_audio_ring;  // one plane per channel, created in ctor
+    std::vector<const double*> m_channel_regions;           // only accessed from the processing thread
+    BinarySemaphore m_wakeup;                        // signalled by the perform routine when new audio is available
+    std::atomic<std::size_t> m_wakeup_threshold{1};  // number of new samples required before signalling the worker
+    std::size_t m_samples_since_wakeup = 0;          // only accessed from the audio thread
+    std::atomic<std::int64_t> m_signal_time_ns{0};   // steady clock time of the first undrained wakeup signal, or 0
+
+    // audio clock: samples received by the perform routine since dsp was started, and the time of the latest vector
+    std::atomic<std::int64_t> m_input_samples{0};
+    std::atomic<std::int64_t> m_input_time_ns{0};
+    std::int64_t m_dropped_samples = 0;              // lost to ring overflows, only accessed from the processing thread
+    std::atomic<double> m_resampling_latency_ms{0.0};
+    std::atomic<int> m_vector_size{0};               // set on dspsetup
+    std::atomic<int> m_sample_rate{0};               // set on dspsetup
+    std::unique_ptr<ResultFifo> m_event_fifo;        // from the processing thread and shared inference to `deliverer`
+    std::atomic<bool> m_has_pending_output = false;  // results enqueued but not yet delivered, when `period` > 0
 
 
     std::atomic<bool> m_running = false; // lifetime control of internal classification thread
@@ -81,9 +510,21 @@ private:
     // flag indicating whether m_classifier's `initialize_model()` has been called (independently of success)
     std::atomic<bool> m_model_initialized = false;
 
-    LeakyIntegrator m_integrator;
+    std::vector<ChannelOutput> m_outputs;
 
+    // only accessed from the scheduler thread, see update_class_names()
     std::optional<std::vector<std::string>> m_class_names;
+    std::atomic<std::size_t> m_model_generation = 0;  // incremented on every model swap by `load`
+    std::size_t m_class_names_generation = 0;
+
+    // output messages, only accessed from the scheduler thread and reused for every output to avoid allocating
+    std::vector<symbol> m_class_symbols;
+    std::vector<std::size_t> m_top_indices;
+    atoms m_index_atoms;
+    atoms m_classname_atoms;
+    atoms m_distribution_atoms;
+    atoms m_latency_atoms{"latency", 0.0};
+    atoms m_end_to_end_atoms;
 
 public:
     MIN_DESCRIPTION{"Real-time Instrumental Playing Technique (IPT) recognition using a pre-trained classification model."};
@@ -96,16 +537,40 @@ public:
     outlet<> outlet_main{this, "(int) recognized class index", "Outputs the index of the class with higher detection probability."};
     outlet<> outlet_classname{this, "(symbol) recognized class name", "Outputs the name of selected class with higher detection probability."};
     outlet<> outlet_distribution{this, "(list) class probability distribution", "Outputs the class probability distribution as a list."};
-    outlet<> dumpout{this, "(any) dumpout", "Outputs miscellaneous data like latency and class names."};
+    outlet<> dumpout{this, "(any) dumpout", "Outputs miscellaneous data like latency and class names. With every output,"
+                                            " 'endtoend' reports the age of the audio behind it: the total in samples and"
+                                            " milliseconds from the window's last input sample to the output, followed by"
+                                            " its buffering, resampling, queueing and compute parts in milliseconds."};
 
     argument<symbol> model_path_arg {this, "model", "Filepath to the TorchScript model to load. This argument is required. Use absolute path for your model or add your model to the Max file preferences list." };
     argument<symbol> device_arg {this, "device", "Device to use for inference: 'CPU', 'CUDA', or 'MPS'. Optional, defaults to 'CPU'." };
+    argument<int> channels_arg {this, "channels", "Number of input channels, each classified independently, with one signal inlet per channel. Optional, defaults to 1. When greater than 1, all outputs are prefixed with the index of their channel." };
 
     explicit ipt_tilde(const atoms& args = {}) { 
+        m_num_channels = parse_num_channels(args);
+
+        for (std::size_t c = 1; c < m_num_channels; ++c) {
+            m_channel_inlets.push_back(std::make_unique<inlet<>>(this, "(signal) audio input, channel " + std::to_string(c)));
+        }
+
+        m_audio_ring = std::make_unique<SpscRingBuffer<double>>(AUDIO_RING_CAPACITY, m_num_channels);
+        m_channel_regions.resize(m_num_channels);
+        m_event_fifo = std::make_unique<ResultFifo>(EVENT_FIFO_CAPACITY * m_num_channels);
+
+        m_result_sink = std::make_shared<ResultSink>();
+        m_result_sink->owner = this;
+
+        m_outputs.resize(m_num_channels);
+        set_integration_time((1.0 - sensitivity.get()) * static_cast<double>(sensitivityrange.get()));
+
         try {
             auto model_path = parse_model_path(args);
             auto device_type = parse_device_type(args);
-            m_classifier = std::make_unique<IptClassifier>(model_path, device_type);
+            m_classifier = std::make_unique<IptClassifier>(model_path
+                                                           , device_type
+                                                           , EnergyThreshold::MINIMUM_THRESHOLD
+                                                           , IptClassifier::DEFAULT_THRESHOLD_WINDOW_MS
+                                                           , m_num_channels);
         } catch (std::runtime_error& e) {
             error(e.what());
         }
@@ -115,10 +580,23 @@ public:
 
 
     ~ipt_tilde() override {
+        if (m_loader_thread.joinable()) {
+            m_loader_thread.join();
+        }
+
+        {
+            std::lock_guard lock{m_result_sink->mutex};
+            m_result_sink->owner = nullptr;
+        }
+
         if (m_processing_thread.joinable()) {
             m_running = false;
+            m_wakeup.signal();
             m_processing_thread.join();
         }
+
+        // Note: if this was the last user of the shared batcher, its pending windows are classified here
+        m_batcher.reset();
     }
     
     // BOOT STAMP
@@ -139,45 +617,77 @@ public:
                 assert(m_model_initialized);
                 assert(m_classifier);
 
-                if (!m_class_names) {
-                    m_class_names = *m_classifier->get_class_names();
-                }
+                const auto& class_names = update_class_names();
 
                 TimedResult timed;
-                std::vector<float> distribution;
-                bool has_result = false;
+                std::optional<double> latency_ms;
+
+                // integrating on one clock what was integrated on the other would lead to arbitrary time steps
+                // likewise after a dsp restart, as the audio clock then starts over from zero
+                auto on_audio_clock = audioclock.get();
+                auto restarted = m_audio_clock_restarted.exchange(false) && on_audio_clock;
+                if (on_audio_clock != m_integrators_on_audio_clock || restarted) {
+                    m_integrators_on_audio_clock = on_audio_clock;
+                    for (auto& output: m_outputs) {
+                        output.integrator.reset();
+                    }
+                }
+
+                auto audio_epoch = m_audio_epoch.load();
+                while (m_event_fifo->pop(timed)) {
+                    // results of the previous model still in the fifo after a swap, or of audio from before a dsp
+                    // restart, whose positions are on the previous audio clock
+                    if (timed.result.distribution.size() != class_names.size()
+                        || timed.position.audio_epoch != audio_epoch) {
+                        m_event_fifo->recycle(std::move(timed.result.distribution));
+                        continue;
+                    }
+
+                    if (m_report_first_latency) {
+                        m_report_first_latency = false;
+                        dumpout.send("firstlatency", timed.result.inference_latency_ms);
+                    }
 
-                while (m_event_fifo.try_dequeue(timed)) {
-                    distribution = m_integrator.process(timed.result.distribution, timed.time);
-                    has_result = true;
+                    auto& output = m_outputs[timed.channel];
+                    auto t1 = std::chrono::steady_clock::now();
+                    output.distribution = m_integrators_on_audio_clock
+                            ? output.integrator.process(timed.result.distribution
+                                                        , LeakyIntegrator::audio_time_ms(timed.position.end_sample
+                                                                                         , m_sample_rate.load()))
+                            : output.integrator.process(timed.result.distribution, timed.time);
+                    m_classifier->get_stats()[Stage::integrator].record(t1, std::chrono::steady_clock::now());
+                    output.has_result = true;
+                    output.result_time = timed.time;
+                    output.position = timed.position;
+                    output.compute_ms = timed.result.compute_ms;
+                    latency_ms = timed.result.inference_latency_ms;
+
+                    m_event_fifo->recycle(std::move(timed.result.distribution));
                 }
 
-                if (!has_result) {
+                if (!latency_ms) {
                     return {};
                 }
 
-                atoms distribution_atms;
-                for (const auto& v: distribution) {
-                    distribution_atms.emplace_back(v);
+                bool sent = false;
+                for (std::size_t c = 0; c < m_outputs.size(); ++c) {
+                    if (m_outputs[c].has_result) {
+                        m_outputs[c].has_result = false;
+                        if (!send_distribution(c, m_outputs[c])) {
+                            continue;
+                        }
+                        sent = true;
+                        m_classifier->get_stats()[Stage::delivery].record(m_outputs[c].result_time
+                                                                          , std::chrono::steady_clock::now());
+                        send_end_to_end(c, m_outputs[c]);
+                    }
                 }
 
-                auto index = static_cast<long>(util::argmax(distribution));
-                auto max_confidence = distribution[static_cast<std::size_t>(index)];
-
-                if (max_confidence >= confidence.get()) {
-                    outlet_main.send(index);
-                    outlet_classname.send(m_class_names->at(static_cast<std::size_t>(index)));
-                    outlet_distribution.send(distribution_atms);
-                } else {
-                    outlet_main.send(-1);
-                    outlet_classname.send("no_confidence");
-                    outlet_distribution.send(distribution_atms);
+                if (sent) {
+                    m_latency_atoms[1] = *latency_ms;
+                    dumpout.send(m_latency_atoms);
                 }
 
-                atoms latency{"latency"};
-                latency.emplace_back(timed.result.inference_latency_ms);
-                dumpout.send(latency);
-
                 return {};
             }
     };
@@ -185,8 +695,25 @@ public:
 
     void operator()(audio_bundle in, audio_bundle) override {
         if (in.channel_count() > 0 && m_running && m_enabled) {
-            for (auto i = 0; i < in.frame_count(); ++i) {
-                m_audio_fifo.try_enqueue(in.samples(0)[i]);
+            // Note: if the ring is full, the entire vector of all channels is dropped and reported by the processing thread
+            m_audio_ring->write(in.samples()
+                                , std::min(static_cast<std::size_t>(in.channel_count()), m_num_channels)
+                                , static_cast<std::size_t>(in.frame_count()));
+
+            auto now_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now().time_since_epoch()).count();
+            m_input_time_ns.store(now_ns, std::memory_order_relaxed);
+            // Note: read-modify-write, as dspsetup may reset the count while the previous dsp chain still runs
+            m_input_samples.fetch_add(in.frame_count(), std::memory_order_release);
+
+            m_samples_since_wakeup += static_cast<std::size_t>(in.frame_count());
+            if (m_samples_since_wakeup >= m_wakeup_threshold.load(std::memory_order_relaxed)) {
+                m_samples_since_wakeup = 0;
+
+                if (m_signal_time_ns.load(std::memory_order_relaxed) == 0) {
+                    m_signal_time_ns.store(now_ns, std::memory_order_relaxed);
+                }
+                m_wakeup.signal();
             }
         }
     }
@@ -199,6 +726,7 @@ public:
             MIN_FUNCTION {
                 if (args[0].type() == c74::min::message_type::int_argument) {
                     m_enabled = static_cast<bool>(args[0]);
+                    m_wakeup.signal();
                     return args;
                 }
 
@@ -213,7 +741,7 @@ public:
             MIN_FUNCTION {
                 if (args.size() == 1 && args[0].type() == c74::min::message_type::float_argument) {
                     auto tau = std::min(1.0, std::max(0.0, static_cast<double>(args[0])));
-                    m_integrator.set_tau((1.0 - tau) * static_cast<double>(sensitivityrange.get()));
+                    set_integration_time((1.0 - tau) * static_cast<double>(sensitivityrange.get()));
                     return {tau};
                 }
 
@@ -239,7 +767,7 @@ public:
                 // Update the tau value
                 double new_tau = (1.0 - current_sensitivity) * static_cast<double>(args[0]);
                 new_tau = std::max(new_tau, 1e-6);  // Avoid zero or negative tau
-                m_integrator.set_tau(new_tau);
+                set_integration_time(new_tau);
 
                 // Return the updated sensitivityrange value
                 return args;
@@ -304,11 +832,43 @@ public:
     };
 
 
+    attribute<bool> changes{this, "changes", false, Docs::CHANGES_TITLE, Docs::CHANGES_DESCRIPTION};
+
+
+    attribute<double> delta{this, "delta", 0.05, Docs::DELTA_TITLE, Docs::DELTA_DESCRIPTION, setter{
+            MIN_FUNCTION {
+                if (args.size() == 1 && (args[0].type() == c74::min::message_type::int_argument
+                                         || args[0].type() == c74::min::message_type::float_argument)) {
+                    return {std::clamp(static_cast<double>(args[0]), 0.0, 1.0)};
+                }
+
+                cerr << "bad argument for message \"delta\"" << endl;
+                return delta;
+            }
+    }
+    };
+
+
+    attribute<int> topk{this, "topk", 0, Docs::TOPK_TITLE, Docs::TOPK_DESCRIPTION, setter{
+            MIN_FUNCTION {
+                if (args.size() == 1 && (args[0].type() == c74::min::message_type::int_argument
+                                         || args[0].type() == c74::min::message_type::float_argument)) {
+                    return {std::max(0, static_cast<int>(args[0]))};
+                }
+
+                cerr << "bad argument for message \"topk\"" << endl;
+                return topk;
+            }
+    }
+    };
+
+
     attribute<int> period{this, "period", 0, Docs::PERIOD_TITLE, Docs::PERIOD_DESCRIPTION, setter{
             MIN_FUNCTION {
                 if (args.size() == 1 && (args[0].type() == c74::min::message_type::int_argument
                                           || args[0].type() == c74::min::message_type::float_argument)) {
                     auto ms = std::max(0, static_cast<int>(args[0]));
+                    m_wakeup.signal();
                     return {ms};
                 }
 
@@ -318,6 +878,282 @@ public:
     }
     };
 
+    attribute<bool> audioclock{this, "audioclock", false, Docs::AUDIO_CLOCK_TITLE, Docs::AUDIO_CLOCK_DESCRIPTION, setter{
+            MIN_FUNCTION {
+                m_wakeup.signal(); // the processing thread might be waiting for a timed periodic output
+                return args;
+            }
+    }
+    };
+
+
+    attribute<int> hop{this, "hop", IptClassifier::DEFAULT_HOP_MS, Docs::HOP_TITLE, Docs::HOP_DESCRIPTION, setter{
+            MIN_FUNCTION {
+                if (args.size() == 1 && (args[0].type() == c74::min::message_type::int_argument
+                                         || args[0].type() == c74::min::message_type::float_argument)) {
+                    auto ms = std::max(0, static_cast<int>(args[0]));
+
+                    // Note: ignored on first call, as m_classifier is not yet initialized.
+                    //       In this case, it will be passed through the `setup` message instead
+                    if (m_classifier) {
+                        m_classifier->set_hop(ms);
+                    }
+                    update_wakeup_threshold(ms);
+
+                    return {ms};
+                }
+
+                cerr << "bad argument for message \"hop\"" << endl;
+                return hop;
+            }
+    }
+    };
+
+    attribute<symbol> resampling{this, "resampling", "high", Docs::RESAMPLING_TITLE, Docs::RESAMPLING_DESCRIPTION, setter{
+            MIN_FUNCTION {
+                if (args.size() == 1 && args[0].type() == c74::min::message_type::symbol_argument) {
+                    try {
+                        auto quality = ResamplingBuffer::parse_quality(std::string(args[0]));
+
+                        // Note: ignored on first call, as m_classifier is not yet initialized.
+                        //       In this case, it will be passed through the `setup` message instead
+                        if (m_classifier) {
+                            m_classifier->set_resampling_quality(quality);
+                            update_resampling_latency();
+                        }
+                        return args;
+
+                    } catch (const std::invalid_argument& e) {
+                        cerr << e.what() << endl;
+                        return resampling;
+                    }
+                }
+
+                cerr << "bad argument for message \"resampling\"" << endl;
+                return resampling;
+            }
+    }
+    };
+
+    attribute<bool> shared{this, "shared", false, Docs::SHARED_TITLE, Docs::SHARED_DESCRIPTION, setter{
+            MIN_FUNCTION {
+                // Note: ignored on first call, as m_classifier is not yet initialized.
+                //       In this case, it will be passed through the `setup` message instead
+                if (m_classifier) {
+                    auto enabled = static_cast<bool>(args[0]);
+                    m_classifier->set_shared_batch_size(get_shared_batch_size(enabled));
+                    if (enabled) {
+                        // the current model may not be warmed up for the shared batch size yet, which would stall
+                        // the processing thread. Windows are classified locally until the loader thread is done
+                        m_shared_warm_up_requests += 1;
+                        if (!m_loading.exchange(true)) {
+                            start_loader({});
+                        }
+                    }
+                    m_wakeup.signal();
+                }
+                return args;
+            }
+    }
+    };
+
+
+    attribute<bool> streaming{this, "streaming", true, Docs::STREAMING_TITLE, Docs::STREAMING_DESCRIPTION, setter{
+            MIN_FUNCTION {
+                // Note: ignored on first call, as m_classifier is not yet initialized.
+                //       In this case, it will be passed through the `setup` message instead
+                if (m_classifier) {
+                    m_classifier->set_streaming(static_cast<bool>(args[0]));
+                }
+                return args;
+            }
+    }
+    };
+
+
+    attribute<bool> features{this, "features", true, Docs::FEATURES_TITLE, Docs::FEATURES_DESCRIPTION, setter{
+            MIN_FUNCTION {
+                // Note: ignored on first call, as m_classifier is not yet initialized.
+                //       In this case, it will be passed through the `setup` message instead
+                if (m_classifier) {
+                    m_classifier->set_features(static_cast<bool>(args[0]));
+                }
+                return args;
+            }
+    }
+    };
+
+
+    attribute<int> warmup{this, "warmup", IptClassifier::DEFAULT_WARM_UP_PASSES, Docs::WARMUP_TITLE, Docs::WARMUP_DESCRIPTION, setter{
+            MIN_FUNCTION {
+                if (args.size() == 1 && (args[0].type() == c74::min::message_type::int_argument
+                                         || args[0].type() == c74::min::message_type::float_argument)) {
+                    return {std::max(0, static_cast<int>(args[0]))};
+                }
+
+                cerr << "bad argument for message \"warmup\"" << endl;
+                return warmup;
+            }
+    }
+    };
+
+
+    attribute<bool> optimize{this, "optimize", false, Docs::OPTIMIZE_TITLE, Docs::OPTIMIZE_DESCRIPTION, setter{
+            MIN_FUNCTION {
+                if (args.size() == 1 && args[0].type() == c74::min::message_type::int_argument) {
+                    // Note: ignored on first call, as m_classifier is not yet initialized.
+                    //       In this case, it will be passed through the `setup` message instead
+                    if (m_classifier) {
+                        m_classifier->set_model_options(model_options(static_cast<bool>(args[0]), precision.get()));
+                    }
+                    return args;
+                }
+
+                cerr << "bad argument for message \"optimize\"" << endl;
+                return optimize;
+            }
+    }
+    };
+
+
+    attribute<symbol> precision{this, "precision", "fp32", Docs::PRECISION_TITLE, Docs::PRECISION_DESCRIPTION, setter{
+            MIN_FUNCTION {
+                if (args.size() == 1 && args[0].type() == c74::min::message_type::symbol_argument) {
+                    try {
+                        Model::parse_precision(std::string(args[0]));
+                    } catch (const std::invalid_argument& e) {
+                        cerr << e.what() << endl;
+                        return precision;
+                    }
+
+                    if (m_classifier) {
+                        m_classifier->set_model_options(model_options(optimize.get(), args[0]));
+                    }
+                    return args;
+                }
+
+                cerr << "bad argument for message \"precision\"" << endl;
+                return precision;
+            }
+    }
+    };
+
+
+    attribute<symbol> executor{this, "executor", "default", Docs::EXECUTOR_TITLE, Docs::EXECUTOR_DESCRIPTION, setter{
+            MIN_FUNCTION {
+                if (args.size() == 1 && args[0].type() == c74::min::message_type::symbol_argument) {
+                    auto mode = std::string(args[0]);
+                    if (mode == "profiling") {
+                        Model::set_executor_mode(Model::ExecutorMode::profiling);
+                    } else if (mode == "legacy") {
+                        Model::set_executor_mode(Model::ExecutorMode::legacy);
+                    } else if (mode == "simple") {
+                        Model::set_executor_mode(Model::ExecutorMode::simple);
+                    } else if (mode != "default") {
+                        cerr << "unknown executor \"" << mode << "\"" << endl;
+                        return executor;
+                    }
+                    return args;
+                }
+
+                cerr << "bad argument for message \"executor\"" << endl;
+                return executor;
+            }
+    }
+    };
+
+
+    attribute<int> threads{this, "threads", 0, Docs::THREADS_TITLE, Docs::THREADS_DESCRIPTION, setter{
+            MIN_FUNCTION {
+                if (args.size() == 1 && (args[0].type() == c74::min::message_type::int_argument
+                                         || args[0].type() == c74::min::message_type::float_argument)) {
+                    auto num_threads = std::max(0, static_cast<int>(args[0]));
+                    update_thread_settings([num_threads](ThreadSettings& settings) {
+                        settings.num_threads = num_threads;
+                    });
+                    return {num_threads};
+                }
+
+                cerr << "bad argument for message \"threads\"" << endl;
+                return threads;
+            }
+    }
+    };
+
+
+    attribute<int> interopthreads{this, "interopthreads", 0, Docs::INTEROP_THREADS_TITLE, Docs::INTEROP_THREADS_DESCRIPTION, setter{
+            MIN_FUNCTION {
+                if (args.size() == 1 && (args[0].type() == c74::min::message_type::int_argument
+                                         || args[0].type() == c74::min::message_type::float_argument)) {
+                    auto num_threads = std::max(0, static_cast<int>(args[0]));
+                    if (!Model::set_num_interop_threads(num_threads)) {
+                        cwarn << "inter-op threads can only be set before the first inference" << endl;
+                        return interopthreads;
+                    }
+                    return {num_threads};
+                }
+
+                cerr << "bad argument for message \"interopthreads\"" << endl;
+                return interopthreads;
+            }
+    }
+    };
+
+
+    attribute<numbers> affinity{this, "affinity", {}, Docs::AFFINITY_TITLE, Docs::AFFINITY_DESCRIPTION, setter{
+            MIN_FUNCTION {
+                for (const auto& arg: args) {
+                    if (arg.type() != c74::min::message_type::int_argument || static_cast<int>(arg) < 0) {
+                        cerr << "bad argument for message \"affinity\"" << endl;
+                        return affinity;
+                    }
+                }
+
+                std::vector<int> cores;
+                for (const auto& arg: args) {
+                    cores.push_back(static_cast<int>(arg));
+                }
+                update_thread_settings([&cores](ThreadSettings& settings) {
+                    settings.cores = std::move(cores);
+                });
+                return args;
+            }
+    }
+    };
+
+
+    attribute<int> priority{this, "priority", 0, Docs::PRIORITY_TITLE, Docs::PRIORITY_DESCRIPTION, setter{
+            MIN_FUNCTION {
+                if (args.size() == 1 && (args[0].type() == c74::min::message_type::int_argument
+                                         || args[0].type() == c74::min::message_type::float_argument)) {
+                    auto thread_priority = std::clamp(static_cast<int>(args[0]), 0, 99);
+                    update_thread_settings([thread_priority](ThreadSettings& settings) {
+                        settings.priority = thread_priority;
+                    });
+                    return {thread_priority};
+                }
+
+                cerr << "bad argument for message \"priority\"" << endl;
+                return priority;
+            }
+    }
+    };
+
+
+    attribute<double> deadline{this, "deadline", 5.0, Docs::DEADLINE_TITLE, Docs::DEADLINE_DESCRIPTION, setter{
+            MIN_FUNCTION {
+                if (args.size() == 1 && (args[0].type() == c74::min::message_type::float_argument
+                                         || args[0].type() == c74::min::message_type::int_argument)) {
+                    return {std::max(0.0, static_cast<double>(args[0]))};
+                }
+
+                cerr << "bad argument for message \"deadline\"" << endl;
+                return deadline;
+            }
+    }
+    };
+
+
     message<> classnames{this, "classnames", Docs::CLASS_NAMES_DESCRIPTION, setter{MIN_FUNCTION {
         if (inlet != 0) {
             cerr << "invalid message \"classnames\" for inlet " << inlet << endl;
@@ -333,13 +1169,10 @@ public:
             return {};
         }
 
-        // If model has been successfully initialize, we can be sure that the model has valid class names
-        if (!m_class_names) {
-            m_class_names = *m_classifier->get_class_names();
-        }
-
+        // If model has been successfully initialize, we can be sure that the model has valid class names.
+        // Note: a snapshot from the classifier, as the output state is only refreshed on the scheduler thread
         atoms names{"classnames"};
-        for (const auto& n: *m_class_names) {
+        for (const auto& n: m_classifier->get_class_names().value_or(std::vector<std::string>{})) {
             names.emplace_back(n);
         }
 
@@ -349,11 +1182,90 @@ public:
     }}};
 
 
+    message<> stats{this, "stats", Docs::STATS_DESCRIPTION, setter{MIN_FUNCTION {
+        if (!m_classifier) {
+            return {};
+        }
+
+        if (!args.empty() && args[0].type() == c74::min::message_type::symbol_argument
+            && std::string(args[0]) == "reset") {
+            m_classifier->get_stats().reset();
+            return {};
+        }
+
+        for (std::size_t i = 0; i < LatencyStats::NUM_STAGES; ++i) {
+            auto stage = static_cast<Stage>(i);
+            auto summary = m_classifier->get_stats()[stage].summary();
+            dumpout.send("stats"
+                         , symbol(LatencyStats::stage_name(stage))
+                         , static_cast<long>(summary.count)
+                         , summary.p50_ms
+                         , summary.p95_ms
+                         , summary.p99_ms
+                         , summary.max_ms);
+        }
+
+        return {};
+    }}};
+
+
+    message<> load{this, "load", Docs::LOAD_DESCRIPTION, setter{MIN_FUNCTION {
+        if (inlet != 0) {
+            cerr << "invalid message \"load\" for inlet " << inlet << endl;
+            return {};
+        }
+
+        if (!m_running) {
+            cerr << "cannot load model: the object has no valid model to replace" << endl;
+            return {};
+        }
+
+        std::string path;
+        try {
+            path = parse_model_path(args);
+        } catch (std::runtime_error& e) {
+            cerr << e.what() << endl;
+            return {};
+        }
+
+        if (m_loading.exchange(true)) {
+            cerr << "cannot load model: another model is currently loading or warming up" << endl;
+            return {};
+        }
+
+        start_loader(std::move(path));
+        return {};
+    }}};
+
+
+    timer<> reporter{
+            this, MIN_FUNCTION {
+                std::vector<atoms> reports;
+                {
+                    std::lock_guard lock{m_reports_mutex};
+                    std::swap(reports, m_reports);
+                }
+
+                for (const auto& report: reports) {
+                    dumpout.send(report);
+                }
+
+                return {};
+            }
+    };
+
+
     // Note: Special function called internally by the min-api after the constructor and all attributes
     // have been initialized. This function cannot be called directly by a user
     message<> setup{this, "setup", MIN_FUNCTION {
         m_classifier->set_energy_threshold(threshold.get());
         m_classifier->set_threshold_window(window.get());
+        m_classifier->set_hop(hop.get());
+        m_classifier->set_streaming(streaming.get());
+        m_classifier->set_features(features.get());
+        m_classifier->set_shared_batch_size(get_shared_batch_size(shared.get()));
+        m_classifier->set_resampling_quality(ResamplingBuffer::parse_quality(std::string(resampling.get())));
+        m_classifier->set_model_options(model_options(optimize.get(), precision.get()));
 
         // since m_classifier is initialized in ctor, we can be sure that it's fully initialized when thread is launched
         m_processing_thread = std::thread(&ipt_tilde::main_loop, this);
@@ -372,20 +1284,483 @@ public:
             std::this_thread::sleep_for(std::chrono::milliseconds(1));
         }
 
+        // The window streams count their samples from zero again after initialize_buffers, and so does the audio
+        // clock. The epoch is odd in the meantime, so that the processing thread doesn't drain positions from a mix of
+        // both clocks, and the results of windows drained before are recognized as such and discarded
+        m_audio_epoch += 1;
+
         // If model initialization was successful: initialize buffers
         if (m_running) {
             m_classifier->initialize_buffers(sample_rate, vector_length);
+            report({"resamplinglatency", update_resampling_latency()});
         }
 
+        m_input_samples = 0;
+        m_input_time_ns = 0;
+        m_vector_size = vector_length;
+        m_sample_rate = sample_rate;
+        m_audio_clock_restarted = true;
+        update_wakeup_threshold(hop.get());
+
+        m_audio_epoch += 1;
+        m_wakeup.signal(); // drains whatever was skipped during the restart
+
         return {};
     }};
 
 
 private:
+    /**
+     * @param channel prepended to every output when the object has more than one channel
+     * @returns false if nothing was sent, as the output hasn't changed enough since the last one (see `changes`)
+     */
+    bool send_distribution(std::size_t channel, ChannelOutput& output) {
+        const auto& distribution = output.distribution;
+        auto max_index = util::argmax(distribution);
+        auto max_confidence = distribution[max_index];
+        auto index = max_confidence >= confidence.get() ? static_cast<long>(max_index) : -1;
+
+        if (changes.get() && index == output.sent_index
+            && std::abs(max_confidence - output.sent_confidence) <= delta.get()) {
+            return false;
+        }
+        output.sent_index = index;
+        output.sent_confidence = max_confidence;
+
+        m_index_atoms.clear();
+        m_classname_atoms.clear();
+        m_distribution_atoms.clear();
+
+        if (m_num_channels > 1) {
+            m_index_atoms.emplace_back(static_cast<long>(channel));
+            m_classname_atoms.emplace_back(static_cast<long>(channel));
+            m_distribution_atoms.emplace_back(static_cast<long>(channel));
+        }
+
+        if (auto k = std::min(static_cast<std::size_t>(std::max(0, topk.get())), distribution.size()); k > 0) {
+            // m_top_indices holds all class indices, only the first k are sorted
+            std::iota(m_top_indices.begin(), m_top_indices.end(), 0);
+            std::partial_sort(m_top_indices.begin(), m_top_indices.begin() + static_cast<std::ptrdiff_t>(k)
+                              , m_top_indices.end(), [&distribution](std::size_t a, std::size_t b) {
+                        return distribution[a] > distribution[b] || (distribution[a] == distribution[b] && a < b);
+                    });
+
+            for (std::size_t i = 0; i < k; ++i) {
+                m_distribution_atoms.emplace_back(static_cast<long>(m_top_indices[i]));
+                m_distribution_atoms.emplace_back(distribution[m_top_indices[i]]);
+            }
+        } else {
+            for (const auto& v: distribution) {
+                m_distribution_atoms.emplace_back(v);
+            }
+        }
+
+        m_index_atoms.emplace_back(index);
+        if (index >= 0) {
+            m_classname_atoms.emplace_back(m_class_symbols.at(static_cast<std::size_t>(index)));
+        } else {
+            m_classname_atoms.emplace_back(NO_CONFIDENCE_SYMBOL);
+        }
+
+        outlet_main.send(m_index_atoms);
+        outlet_classname.send(m_classname_atoms);
+        outlet_distribution.send(m_distribution_atoms);
+        return true;
+    }
+
+
+    void set_integration_time(double tau) {
+        for (auto& output: m_outputs) {
+            output.integrator.set_tau(tau);
+        }
+    }
+
+
+    /**
+     * Loads `path` (if not empty) and then serves the pending warm-ups of `shared` on the loader thread, which the
+     * caller has claimed by setting `m_loading`
+     * @note Only called from the main thread
+     */
+    void start_loader(std::string path) {
+        if (m_loader_thread.joinable()) {
+            m_loader_thread.join();
+        }
+        m_loader_thread = std::thread(&ipt_tilde::run_loader, this, std::move(path));
+    }
+
+
+    void run_loader(std::string path) {
+        if (!path.empty()) {
+            load_model(path);
+        }
+
+        do {
+            warm_up_shared();
+            m_loading = false;
+
+            // a request may have been made after warm_up_shared() returned but before m_loading was released
+        } while (m_shared_warm_up_requests != m_shared_warm_up_done && !m_loading.exchange(true));
+    }
+
+
+    /** Runs on the loader thread. The processing thread keeps classifying with the current model until the swap */
+    void load_model(const std::string& path) {
+        try {
+            Model::set_num_threads(threads.get());
+
+            double warm_up_ms = 0.0;
+            auto model = m_classifier->load_model(path, warmup.get(), &warm_up_ms);
+            m_event_fifo->resize(model->get_class_names().size());
+            m_classifier->set_model(std::move(model));
+            update_resampling_latency(); // the new model may run at another sample rate
+            m_model_generation += 1;
+            m_wakeup.signal(); // picks up the shared batcher of the new model, if any
+
+            report({"loaded", path});
+            report({"warmup", warm_up_ms});
+
+        } catch (const std::exception& e) {
+            if (verbose.get()) {
+                cerr << e.what() << endl;
+            } else {
+                cerr << "error during loading of " << path << endl;
+            }
+        } catch (...) {
+            cerr << "unknown error during loading of " << path << endl;
+        }
+    }
+
+
+    /**
+     * Runs on the loader thread: warms the current model up for the shared batch size, if it hasn't been yet. The
+     * processing thread keeps classifying locally, and only acquires the batcher once all requests are served
+     */
+    void warm_up_shared() {
+        for (auto requests = m_shared_warm_up_requests.load(); requests != m_shared_warm_up_done
+             ; requests = m_shared_warm_up_requests.load()) {
+            try {
+                if (auto warm_up_ms = m_classifier->warm_up_shared(warmup.get()); warm_up_ms > 0.0) {
+                    report({"warmup", warm_up_ms});
+                }
+            } catch (const std::exception& e) {
+                if (verbose.get()) {
+                    cerr << e.what() << endl;
+                } else {
+                    cerr << "error during warm-up for shared inference" << endl;
+                }
+            } catch (...) {
+                cerr << "unknown error during warm-up" << endl;
+            }
+
+            m_shared_warm_up_done = requests;
+            m_wakeup.signal(); // acquires the batcher
+        }
+    }
+
+
+    /**
+     * Stores the new settings with `update(ThreadSettings&)`, to be applied by the processing thread itself on its
+     * next wakeup. Called from the setters, i.e. before the attribute itself holds the new value
+     */
+    template<typename Update>
+    void update_thread_settings(Update&& update) {
+        {
+            std::lock_guard lock{m_thread_settings_mutex};
+            update(m_thread_settings);
+        }
+        m_thread_settings_changed = true;
+        m_wakeup.signal();
+    }
+
+
+    /** @note Called from the processing thread */
+    void apply_thread_settings() {
+        ThreadSettings settings;
+        {
+            std::lock_guard lock{m_thread_settings_mutex};
+            settings = m_thread_settings;
+        }
+
+        Model::set_num_threads(settings.num_threads);
+
+        if (!util::thread_control::set_affinity(settings.cores)) {
+            cwarn << "could not set the affinity of the inference thread" << endl;
+        }
+
+        if (!util::thread_control::set_priority(settings.priority)) {
+            cwarn << "could not set the priority of the inference thread: insufficient permissions" << endl;
+        }
+    }
+
+
+    static Model::Options model_options(bool optimize, const symbol& precision_name) {
+        Model::Options options;
+        options.optimize = optimize;
+        options.precision = Model::parse_precision(std::string(precision_name));
+        return options;
+    }
+
+
+    /** Sends `message` via dumpout from the scheduler thread. May be called from any thread */
+    void report(atoms&& message) {
+        {
+            std::lock_guard lock{m_reports_mutex};
+            m_reports.push_back(std::move(message));
+        }
+        reporter.delay(0.0);
+    }
+
+
+    /**
+     * Class names of the current model, refreshed after a swap. Also resets smoothing, as the classes may differ,
+     * and sizes the output messages for the new classes
+     * @note Only called from the scheduler thread (`deliverer`), which owns the output state
+     */
+    const std::vector<std::string>& update_class_names() {
+        auto generation = m_model_generation.load();
+        if (!m_class_names || generation != m_class_names_generation) {
+            m_class_names = *m_classifier->get_class_names();
+            m_class_names_generation = generation;
+            m_report_first_latency = true;
+            m_class_symbols.clear();
+
+            for (auto& output: m_outputs) {
+                output.integrator.reset();
+                output.sent_index = NO_OUTPUT_INDEX;
+            }
+        }
+
+        if (m_class_symbols.size() != m_class_names->size()) {
+            m_class_symbols.assign(m_class_names->begin(), m_class_names->end());
+            m_top_indices.resize(m_class_names->size());
+
+            // with the channel prefix, and index / probability pairs for `topk`
+            m_index_atoms.reserve(2);
+            m_classname_atoms.reserve(2);
+            m_distribution_atoms.reserve(2 * m_class_names->size() + 1);
+            m_end_to_end_atoms.reserve(END_TO_END_SIZE + 1);
+        }
+        return *m_class_names;
+    }
+
+
+    /**
+     * Enqueues `result` for delivery, without allocating, see ResultFifo
+     * @note Called from the processing thread, or from the shared inference service's worker thread
+     */
+    void receive_result(std::size_t channel, const ClassificationResult& result, const WindowPosition& position) {
+        m_event_fifo->push(channel, result, position);
+
+        if (period.get() == 0) {
+            deliverer.delay(0.0);
+        } else {
+            m_has_pending_output = true;
+            m_wakeup.signal(); // the processing thread might be asleep without any timed wakeup
+        }
+    }
+
+
+    /** Acquires or releases the shared inference service according to the `shared` attribute */
+    void update_batcher() {
+        if (!shared.get()) {
+            m_batcher.reset();
+            return;
+        }
+
+        // shared was enabled after the warm-up: classify locally until the loader thread has warmed up the model
+        if (m_shared_warm_up_requests != m_shared_warm_up_done) {
+            m_batcher.reset();
+            return;
+        }
+
+        // Note: also switches batcher when the model has been swapped by `load`
+        auto model = m_classifier->get_model();
+        if (!m_batcher || &m_batcher->get_model() != model.get()) {
+            m_batcher = InferenceService::instance().acquire(model);
+            create_window_pool(static_cast<std::size_t>(model->get_segment_length()));
+        }
+    }
+
+
+    /**
+     * Windows still in flight keep the previous pool alive, along with the channel and position they are routed by.
+     * Called from the processing thread, once per model
+     */
+    void create_window_pool(std::size_t window_length) {
+        auto num_windows = m_num_channels * SHARED_WINDOWS_PER_CHANNEL;
+        auto windows = std::make_shared<std::vector<SharedWindow>>(num_windows);
+
+        m_window_pool = std::make_shared<WindowPool>(
+                num_windows
+                , window_length
+                , [sink = m_result_sink, windows](std::size_t slot, const ClassificationResult& result) {
+                    std::lock_guard lock{sink->mutex};
+                    if (sink->owner) {
+                        const auto& window = (*windows)[slot];
+                        sink->owner->receive_result(window.channel, result, window.position);
+                    }
+                }
+                , [sink = m_result_sink](std::size_t, std::exception_ptr) {
+                    std::lock_guard lock{sink->mutex};
+                    if (sink->owner) {
+                        sink->owner->cerr << "model architecture is not compatible" << endl;
+                    }
+                });
+
+        m_shared_windows = std::move(windows);
+        m_submitted_slots.reserve(num_windows);
+    }
+
+
+    static std::size_t get_shared_batch_size(bool shared_enabled) {
+        return shared_enabled ? InferenceService::DEFAULT_MAX_BATCH_SIZE : 0;
+    }
+
+
+    /**
+     * Copies the windows due in the next `num_samples` samples of the ring to the window pool and submits them to the
+     * shared batcher, without allocating. Windows are dropped while all of the pool's are in flight, i.e. when the
+     * batcher falls behind, rather than blocking the processing thread
+     */
+    void submit_windows(std::size_t num_samples) {
+        auto drain_sample = current_input_sample();
+        auto window_deadline = std::chrono::steady_clock::now()
+                               + std::chrono::microseconds(static_cast<long long>(deadline.get() * 1000.0));
+
+        std::size_t num_dropped = 0;
+        m_submitted_slots.clear();
+        m_classifier->acquire_windows(m_channel_regions.data(), m_num_channels, num_samples
+                                      , [this, drain_sample, &num_dropped](std::size_t channel
+                                                                           , const float* window
+                                                                           , std::size_t length
+                                                                           , std::size_t end_sample) {
+            // Note: the model may have been swapped by `load` since update_batcher(), whose next call replaces the pool
+            if (length != m_window_pool->get_window_length()) {
+                return;
+            }
+
+            auto slot = m_window_pool->acquire();
+            if (!slot) {
+                ++num_dropped;
+                return;
+            }
+
+            std::copy_n(window, length, m_window_pool->window(*slot));
+            (*m_shared_windows)[*slot] = SharedWindow{channel, window_position(end_sample, drain_sample)};
+            m_submitted_slots.push_back(*slot);
+        });
+
+        // submitted once the classifier's lock is released, as the batcher may block when it is saturated
+        for (auto slot: m_submitted_slots) {
+            m_batcher->submit(m_window_pool, slot, window_deadline);
+        }
+
+        if (num_dropped > 0) {
+            cwarn << "shared inference overflow: " << num_dropped << " windows dropped" << endl;
+        }
+    }
+
+
+    /**
+     * Current position of the audio input in samples since dsp was started. The perform routine only counts whole
+     * vectors, so the position within the current vector is interpolated from the time elapsed since its call
+     */
+    double current_input_sample() const {
+        auto samples = static_cast<double>(m_input_samples.load(std::memory_order_acquire));
+        auto time_ns = m_input_time_ns.load(std::memory_order_relaxed);
+        auto sample_rate = m_sample_rate.load(std::memory_order_relaxed);
+        if (time_ns == 0 || sample_rate <= 0) {
+            return samples;
+        }
+
+        auto now_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+        auto elapsed = static_cast<double>(now_ns - time_ns) * 1e-9 * static_cast<double>(sample_rate);
+        return samples + std::clamp(elapsed, 0.0, static_cast<double>(m_vector_size.load(std::memory_order_relaxed)));
+    }
+
+
+    /**
+     * @param end_sample window end as counted by the classifier, which never sees the samples lost to overflows.
+     *                   Overflows not yet taken from the ring are only accounted for from the next drain on
+     */
+    WindowPosition window_position(std::size_t end_sample, double drain_sample) const {
+        return {static_cast<double>(end_sample) + static_cast<double>(m_dropped_samples)
+                , drain_sample
+                , m_drained_epoch};
+    }
+
+
+    /** Cached for the scheduler thread, which may not wait for the classifier's lock */
+    double update_resampling_latency() {
+        auto latency_ms = m_classifier->get_resampling_latency_ms();
+        m_resampling_latency_ms = latency_ms;
+        return latency_ms;
+    }
+
+
+    /**
+     * Decomposes the time from the last sample of the delivered window entering the object to now, when the
+     * corresponding output was sent. The resampler's delay is added on top, as it delays the window's content by as
+     * much before the window ends
+     */
+    void send_end_to_end(std::size_t channel, const ChannelOutput& output) {
+        auto sample_rate = m_sample_rate.load();
+        if (sample_rate <= 0) {
+            return;
+        }
+
+        auto latency = EndToEndLatency::measure(output.position
+                                                , current_input_sample()
+                                                , static_cast<double>(sample_rate)
+                                                , m_resampling_latency_ms.load(std::memory_order_relaxed)
+                                                , output.compute_ms);
+
+        m_end_to_end_atoms.clear();
+        if (m_num_channels > 1) {
+            m_end_to_end_atoms.emplace_back(static_cast<long>(channel));
+        }
+        m_end_to_end_atoms.emplace_back(END_TO_END_SYMBOL);
+        m_end_to_end_atoms.emplace_back(latency.total_samples);
+        m_end_to_end_atoms.emplace_back(latency.total_ms);
+        m_end_to_end_atoms.emplace_back(latency.buffering_ms);
+        m_end_to_end_atoms.emplace_back(latency.resampling_ms);
+        m_end_to_end_atoms.emplace_back(latency.queueing_ms);
+        m_end_to_end_atoms.emplace_back(latency.compute_ms);
+        dumpout.send(m_end_to_end_atoms);
+    }
+
+
+    /** Time from the perform routine signalling new audio to now, when the processing thread drains it */
+    void record_fifo_wait() {
+        auto signal_time_ns = m_signal_time_ns.exchange(0, std::memory_order_relaxed);
+        if (signal_time_ns != 0) {
+            auto now = std::chrono::steady_clock::now().time_since_epoch();
+            m_classifier->get_stats()[Stage::fifo_wait].record(std::chrono::duration_cast<std::chrono::nanoseconds>(now)
+                                                               - std::chrono::nanoseconds(signal_time_ns));
+        }
+    }
+
+
+    /** Only wake the processing thread once a full hop of new audio is available */
+    void update_wakeup_threshold(int hop_ms) {
+        std::size_t threshold = 1;
+        if (auto sample_rate = m_sample_rate.load(); hop_ms > 0 && sample_rate > 0) {
+            threshold = std::max<std::size_t>(1, util::mstosamples(hop_ms, sample_rate));
+        }
+        m_wakeup_threshold = threshold;
+    }
+
+
     void main_loop() {
+        // before loading, so that the warm-up runs with the same settings as the inferences
+        m_thread_settings_changed = false;
+        apply_thread_settings();
+
         try {
             m_classifier->initialize_model();
-            m_class_names = m_classifier->get_class_names();
+            report({"warmup", m_classifier->warm_up(warmup.get())});
+            m_event_fifo->prepare(m_classifier->get_class_names().value_or(std::vector<std::string>{}).size());
             m_running = true;
         } catch (const std::exception& e) {
             if (verbose.get()) {
@@ -402,36 +1777,79 @@ private:
         try {
             auto last_output = std::chrono::steady_clock::now();
 
+            // audio time as seen by this thread, for periodic output on the audio clock
+            std::size_t drained_samples = 0;
+            std::size_t last_output_sample = 0;
+
             while (m_running) {
-                if (m_enabled) {
-                    std::vector<double> buffered_audio;
-                    double sample;
-                    while (m_audio_fifo.try_dequeue(sample)) {
-                        buffered_audio.push_back(sample);
-                    }
+                update_batcher();
 
-                    if (!buffered_audio.empty()) {
-                        auto result = m_classifier->process(std::move(buffered_audio));
-                        if (result) {
-                            m_event_fifo.try_enqueue({*result, std::chrono::steady_clock::now()});
+                if (m_thread_settings_changed.exchange(false)) {
+                    apply_thread_settings();
+                }
 
-                            if (period.get() == 0) {
-                                deliverer.delay(0.0);
-                            }
+                // odd while dspsetup restarts the audio clock, which signals again once done
+                auto audio_epoch = m_audio_epoch.load();
+                if (audio_epoch != m_drained_epoch && audio_epoch % 2 == 0) {
+                    m_drained_epoch = audio_epoch;
+                    m_dropped_samples = 0; // the window streams count from zero again as well
+                }
+
+                if (m_enabled && audio_epoch % 2 == 0) {
+                    record_fifo_wait();
+
+                    // pending audio is read in place: at most two regions per channel if it wraps around the end
+                    // of the ring. All channels' due windows are classified together in one forward pass
+                    for (auto size = m_audio_ring->readable_regions(m_channel_regions.data()); size > 0
+                         ; size = m_audio_ring->readable_regions(m_channel_regions.data())) {
+                        if (m_batcher) {
+                            submit_windows(size);
+                            m_audio_ring->consume(size);
+                            drained_samples += size;
+                            continue;
                         }
+
+                        auto drain_sample = current_input_sample();
+                        m_classifier->process(m_channel_regions.data(), m_num_channels, size
+                                              , [this, drain_sample](std::size_t channel
+                                                                     , std::size_t end_sample
+                                                                     , const ClassificationResult& result) {
+                            receive_result(channel, result, window_position(end_sample, drain_sample));
+                        });
+                        m_audio_ring->consume(size);
+                        drained_samples += size;
+                    }
+
+                    if (auto dropped = m_audio_ring->take_dropped(); dropped > 0) {
+                        m_dropped_samples += static_cast<std::int64_t>(dropped);
+                        cwarn << "audio input overflow: " << dropped << " samples dropped" << endl;
                     }
                 }
 
-                if (period.get() > 0) {
+                auto output_period = std::chrono::milliseconds(period.get());
+                auto on_audio_clock = audioclock.get();
+
+                if (output_period.count() > 0 && m_has_pending_output) {
                     auto now = std::chrono::steady_clock::now();
-                    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(now - last_output).count();
-                    if (elapsed >= period.get()) {
+                    auto period_samples = util::mstosamples(period.get(), m_sample_rate.load());
+
+                    if (on_audio_clock ? drained_samples - last_output_sample >= period_samples
+                                       : now - last_output >= output_period) {
                         deliverer.delay(0.0);
                         last_output = now;
+                        last_output_sample = drained_samples;
+                        m_has_pending_output = false;
                     }
                 }
 
-                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                // Sleep until the perform routine signals new audio. When disabled, or when dsp is off, no signal
+                // is sent and the thread stays asleep. Only pending periodic output on the system clock requires a
+                // timed wakeup: on the audio clock, the period can only elapse with new audio
+                if (output_period.count() > 0 && m_has_pending_output && !on_audio_clock) {
+                    m_wakeup.wait_for(last_output + output_period - std::chrono::steady_clock::now());
+                } else {
+                    m_wakeup.wait();
+                }
             }
 
         } catch (const std::exception& e) {
@@ -469,6 +1887,26 @@ private:
     }
 
 
+    std::size_t parse_num_channels(const atoms& args) {
+        if (args.size() < 3) {
+            return 1;
+        }
+
+        if (args[2].type() != c74::min::message_type::int_argument || static_cast<int>(args[2]) < 1) {
+            cwarn << "bad argument for number of channels, defaulting to 1" << endl;
+            return 1;
+        }
+
+        auto num_channels = static_cast<std::size_t>(static_cast<int>(args[2]));
+        if (num_channels > MAX_CHANNELS) {
+            cwarn << "number of channels limited to " << MAX_CHANNELS << endl;
+            return MAX_CHANNELS;
+        }
+
+        return num_channels;
+    }
+
+
     torch::DeviceType parse_device_type(const atoms& args) {
         if (args.size() < 2) {
             return torch::kCPU;
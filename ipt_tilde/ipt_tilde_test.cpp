@@ -1,6 +1,80 @@
 #include "c74_min_unittest.h"
 #include "ipt_tilde.cpp"
 
+#include <condition_variable>
+#include <cstdlib>
+#include <iterator>
+#include <mutex>
+#include <new>
+#include <random>
+#include <thread>
+#include "fixture_model.h"
+
+
+// Counts the allocations of the calling thread, see util::allocation_counter
+void* operator new(std::size_t size) {
+    util::allocation_counter::on_allocation();
+    if (void* p = std::malloc(size == 0 ? 1 : size)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size) {
+    return ::operator new(size);
+}
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void* p, std::size_t) noexcept {
+    std::free(p);
+}
+
+
+// Classifier of a fixture model, ready to process vectors of `vector_size` samples with a hop of `hop_ms`
+static std::unique_ptr<IptClassifier> make_classifier(const std::string& path
+                                                      , int hop_ms
+                                                      , std::size_t vector_size
+                                                      , bool streaming = true
+                                                      , bool features = true) {
+    auto classifier = std::make_unique<IptClassifier>(path, torch::kCPU);
+    classifier->set_hop(hop_ms);
+    classifier->set_streaming(streaming);
+    classifier->set_features(features);
+    classifier->initialize_model();
+    classifier->initialize_buffers(FixtureModel::SAMPLE_RATE, static_cast<int>(vector_size));
+    return classifier;
+}
+
+
+// Access to the output path of ipt~, which is otherwise only reached once a model has classified a window
+struct ipt_tilde_test_access {
+    static void set_num_classes(ipt_tilde& object, std::size_t num_classes) {
+        object.m_class_symbols.clear();
+        for (std::size_t i = 0; i < num_classes; ++i) {
+            object.m_class_symbols.emplace_back("class" + std::to_string(i));
+        }
+        object.m_top_indices.resize(num_classes);
+    }
+
+
+    static bool send_distribution(ipt_tilde& object, std::vector<float> distribution) {
+        auto& output = object.m_outputs.at(0);
+        output.distribution = std::move(distribution);
+        return object.send_distribution(0, output);
+    }
+};
+
 
 TEST_CASE("object is constructible") {
     ext_main(nullptr);
@@ -9,3 +83,1032 @@ TEST_CASE("object is constructible") {
     ipt_tilde& obj = an_instance;
 
 }
+
+
+TEST_CASE("change-only, delta and top-k outputs") {
+    ext_main(nullptr);
+
+    test_wrapper<ipt_tilde> an_instance;
+    ipt_tilde& obj = an_instance;
+    ipt_tilde_test_access::set_num_classes(obj, 4);
+
+    auto& index_output = *c74::max::object_getoutput(obj, 0);
+    auto& distribution_output = *c74::max::object_getoutput(obj, 2);
+
+    SECTION("an unchanged winner within delta sends nothing") {
+        obj.changes = true;
+        obj.delta = 0.1;
+
+        REQUIRE(ipt_tilde_test_access::send_distribution(obj, {0.1f, 0.6f, 0.2f, 0.1f}));
+        REQUIRE(index_output.size() == 1);
+        REQUIRE(distribution_output.size() == 1);
+
+        // same winner, confidence within delta of the last sent one
+        REQUIRE_FALSE(ipt_tilde_test_access::send_distribution(obj, {0.1f, 0.65f, 0.15f, 0.1f}));
+        REQUIRE_FALSE(ipt_tilde_test_access::send_distribution(obj, {0.15f, 0.55f, 0.2f, 0.1f}));
+        REQUIRE(index_output.size() == 1);
+        REQUIRE(distribution_output.size() == 1);
+
+        // same winner, confidence beyond delta
+        REQUIRE(ipt_tilde_test_access::send_distribution(obj, {0.05f, 0.8f, 0.1f, 0.05f}));
+        REQUIRE(index_output.size() == 2);
+
+        // new winner, however close its confidence
+        REQUIRE(ipt_tilde_test_access::send_distribution(obj, {0.1f, 0.05f, 0.8f, 0.05f}));
+        REQUIRE(index_output.size() == 3);
+        REQUIRE(index_output.back().size() == 1);
+        REQUIRE(static_cast<long>(atom(index_output.back()[0])) == 2);
+
+        // without `changes`, every result is sent
+        obj.changes = false;
+        REQUIRE(ipt_tilde_test_access::send_distribution(obj, {0.1f, 0.05f, 0.8f, 0.05f}));
+        REQUIRE(index_output.size() == 4);
+    }
+
+    SECTION("topk sends exactly k index/probability pairs in descending order") {
+        std::vector<float> distribution{0.1f, 0.2f, 0.4f, 0.3f};
+
+        for (int k = 1; k <= 4; ++k) {
+            obj.topk = k;
+            REQUIRE(ipt_tilde_test_access::send_distribution(obj, distribution));
+
+            const auto& pairs = distribution_output.back();
+            REQUIRE(pairs.size() == 2 * static_cast<std::size_t>(k));
+
+            double previous = 1.0;
+            for (std::size_t i = 0; i < pairs.size(); i += 2) {
+                auto index = static_cast<std::size_t>(static_cast<long>(atom(pairs[i])));
+                auto probability = static_cast<double>(atom(pairs[i + 1]));
+                REQUIRE(index < distribution.size());
+                REQUIRE(probability == Approx(distribution[index]));
+                REQUIRE(probability <= previous);
+                previous = probability;
+            }
+            REQUIRE(static_cast<long>(atom(pairs[0])) == 2);
+        }
+
+        // 0 sends the full distribution
+        obj.topk = 0;
+        REQUIRE(ipt_tilde_test_access::send_distribution(obj, distribution));
+        REQUIRE(distribution_output.back().size() == distribution.size());
+    }
+}
+
+
+TEST_CASE("binary semaphore coalesces signals and times out") {
+    using namespace std::chrono_literals;
+
+    BinarySemaphore semaphore;
+
+    // any number of signals is consumed by a single wait
+    for (int i = 0; i < 5; ++i) {
+        semaphore.signal();
+    }
+    REQUIRE(semaphore.wait_for(0ms));
+    REQUIRE_FALSE(semaphore.wait_for(0ms));
+
+    auto start = std::chrono::steady_clock::now();
+    REQUIRE_FALSE(semaphore.wait_for(20ms));
+    REQUIRE(std::chrono::steady_clock::now() - start >= 20ms);
+
+    // a signal from another thread wakes the waiter before its timeout
+    std::thread signaller([&semaphore] {
+        std::this_thread::sleep_for(10ms);
+        semaphore.signal();
+    });
+    start = std::chrono::steady_clock::now();
+    REQUIRE(semaphore.wait_for(10s));
+    REQUIRE(std::chrono::steady_clock::now() - start < 5s);
+    signaller.join();
+
+    semaphore.signal();
+    semaphore.wait();
+    REQUIRE_FALSE(semaphore.wait_for(0ms));
+}
+
+
+TEST_CASE("simd kernels match the scalar reference") {
+    using namespace util::simd;
+
+    std::mt19937 rng(1234);
+    std::uniform_real_distribution<double> dist(-1.0, 1.0);
+
+    const auto& reference = scalar::kernels();
+
+    for (auto isa: {Isa::sse2, Isa::avx2, Isa::avx512, Isa::neon}) {
+        if (!is_supported(isa)) {
+            continue;
+        }
+
+        const auto& k = kernels(isa);
+        INFO("isa: " << k.name);
+
+        // sizes covering empty input, tails only, and full vectors plus tails for every vector width
+        for (std::size_t n: {0, 1, 3, 4, 7, 8, 15, 16, 17, 64, 1027}) {
+            INFO("n: " << n);
+
+            std::vector<double> input(n);
+            for (auto& x: input) {
+                x = dist(rng);
+            }
+
+            std::vector<float> expected(n), actual(n);
+            reference.to_floats(input.data(), expected.data(), n);
+            k.to_floats(input.data(), actual.data(), n);
+            REQUIRE(actual == expected);
+
+            if (n > 0) {
+                REQUIRE(k.max_value(expected.data(), n) == reference.max_value(expected.data(), n));
+            }
+
+            auto tolerance = 1e-12 * (1.0 + static_cast<double>(n));
+            REQUIRE(std::abs(k.sum_of_squares_d(input.data(), n) - reference.sum_of_squares_d(input.data(), n))
+                    <= tolerance);
+            REQUIRE(std::abs(k.sum_of_squares_f(expected.data(), n) - reference.sum_of_squares_f(expected.data(), n))
+                    <= tolerance);
+
+            std::vector<float> current(expected.rbegin(), expected.rend());
+            std::vector<float> mixed_expected(n), mixed_actual(n);
+            reference.leaky_mix(expected.data(), current.data(), mixed_expected.data(), n, 0.3);
+            k.leaky_mix(expected.data(), current.data(), mixed_actual.data(), n, 0.3);
+            for (std::size_t i = 0; i < n; ++i) {
+                REQUIRE(std::abs(mixed_actual[i] - mixed_expected[i]) <= 1e-6f);
+            }
+        }
+    }
+}
+
+
+TEST_CASE("argmax returns the first maximum") {
+    REQUIRE(util::argmax({0.1f, 0.5f, 0.5f, 0.2f}) == 1);
+
+    std::vector<float> v(37, 0.0f);
+    v[33] = 1.0f;
+    REQUIRE(util::argmax(v) == 33);
+}
+
+
+TEST_CASE("ring buffer keeps channels in lockstep") {
+    SpscRingBuffer<double> ring{8, 3};
+    REQUIRE(ring.capacity() == 8);
+
+    std::vector<double> a{1, 2, 3, 4, 5};
+    std::vector<double> b{10, 20, 30, 40, 50};
+    const double* block[] = {a.data(), b.data()};
+
+    // the third channel is not provided: it is zero-filled
+    REQUIRE(ring.write(block, 2, 5));
+    REQUIRE(!ring.write(block, 2, 5));
+    REQUIRE(ring.take_dropped() == 5);
+
+    const double* regions[3];
+    REQUIRE(ring.readable_regions(regions) == 5);
+    ring.consume(4);
+
+    // wraps around the end of the storage, for all channels at once
+    REQUIRE(ring.write(block, 2, 5));
+
+    std::vector<std::vector<double>> read(3);
+    for (auto size = ring.readable_regions(regions); size > 0; size = ring.readable_regions(regions)) {
+        for (std::size_t c = 0; c < 3; ++c) {
+            read[c].insert(read[c].end(), regions[c], regions[c] + size);
+        }
+        ring.consume(size);
+    }
+
+    REQUIRE(read[0] == std::vector<double>{5, 1, 2, 3, 4, 5});
+    REQUIRE(read[1] == std::vector<double>{50, 10, 20, 30, 40, 50});
+    REQUIRE(read[2] == std::vector<double>(6, 0.0));
+}
+
+
+TEST_CASE("resampling buffer bypasses and interpolates") {
+    std::vector<double> ramp(64);
+    for (std::size_t i = 0; i < ramp.size(); ++i) {
+        ramp[i] = static_cast<double>(i) / 64.0;
+    }
+
+    // same rate: the input is written as is, without delay
+    ResamplingBuffer passthrough{16, 32, 44100, 44100};
+    REQUIRE(passthrough.is_passthrough());
+    REQUIRE(passthrough.latency() == 0.0);
+    REQUIRE(passthrough.add_samples(ramp) == 64);
+    REQUIRE(passthrough.data()[15] == static_cast<float>(ramp[63]));
+
+    // halving the rate by linear interpolation keeps every other sample, delayed by one input sample
+    ResamplingBuffer linear{16, 32, 88200, 44100, ResamplingQuality::linear};
+    REQUIRE(!linear.is_passthrough());
+    REQUIRE(linear.latency() == 1.0);
+    REQUIRE(linear.add_samples(ramp) == 32);
+    for (std::size_t i = 0; i < 16; ++i) {
+        REQUIRE(linear.data()[i] == Approx(ramp[2 * (16 + i) - 1]));
+    }
+
+    REQUIRE(ResamplingBuffer::parse_quality("medium") == ResamplingQuality::medium);
+    REQUIRE_THROWS_AS(ResamplingBuffer::parse_quality("best"), std::invalid_argument);
+}
+
+
+TEST_CASE("model registry shares one instance per path, device and options") {
+    auto& registry = ModelRegistry::instance();
+    auto num_loaded = registry.size();
+
+    auto path = FixtureModel::generate();
+    auto first = make_classifier(path, 0, 64);
+    auto second = make_classifier(path, 0, 64);
+    REQUIRE(first->get_model() == second->get_model());
+    REQUIRE(registry.size() == num_loaded + 1);
+
+    // other spellings of the same file share the instance as well
+    auto other_spelling = (std::filesystem::path(path).parent_path() / "." / std::filesystem::path(path).filename());
+    REQUIRE(registry.acquire(other_spelling.string(), torch::kCPU) == first->get_model());
+
+    Model::Options optimized;
+    optimized.optimize = true;
+    optimized.cache = false;
+    auto optimized_model = registry.acquire(path, torch::kCPU, optimized);
+    REQUIRE(optimized_model != first->get_model());
+
+    // bf16 is only used where supported: elsewhere, it is the fp32 model
+    Model::Options bf16;
+    bf16.precision = Model::Precision::bf16;
+    auto bf16_model = registry.acquire(path, torch::kCPU, bf16);
+    if (Model::supported_precision(Model::Precision::bf16, torch::kCPU) == Model::Precision::bf16) {
+        REQUIRE(bf16_model != first->get_model());
+    } else {
+        REQUIRE(bf16_model == first->get_model());
+    }
+
+    if (torch::cuda::is_available()) {
+        REQUIRE(registry.acquire(path, torch::kCUDA) != first->get_model());
+    }
+
+    // a shared instance is classified on concurrently, each thread with its own workspace
+    auto model = first->get_model();
+    const auto length = static_cast<std::size_t>(model->get_segment_length());
+    std::mt19937 rng(7);
+    std::uniform_real_distribution<float> dist(-0.5f, 0.5f);
+    std::vector<std::vector<float>> windows(2, std::vector<float>(length));
+    for (auto& window: windows) {
+        for (auto& x: window) {
+            x = dist(rng);
+        }
+    }
+
+    std::vector<std::vector<float>> expected;
+    for (const auto& window: windows) {
+        expected.push_back(model->classify(window.data(), length).distribution);
+    }
+
+    std::vector<std::vector<std::vector<float>>> concurrent(windows.size());
+    std::vector<std::thread> threads;
+    for (std::size_t t = 0; t < windows.size(); ++t) {
+        threads.emplace_back([&, t] {
+            Model::Workspace workspace;
+            for (int i = 0; i < 20; ++i) {
+                model->classify(windows[t].data(), 1, length, workspace);
+                concurrent[t].push_back(workspace.results[0].distribution);
+            }
+        });
+    }
+    for (auto& thread: threads) {
+        thread.join();
+    }
+
+    for (std::size_t t = 0; t < windows.size(); ++t) {
+        REQUIRE(concurrent[t].size() == 20);
+        for (const auto& distribution: concurrent[t]) {
+            for (std::size_t c = 0; c < FixtureModel::NUM_CLASSES; ++c) {
+                REQUIRE(distribution[c] == Approx(expected[t][c]).margin(1e-6));
+            }
+        }
+    }
+
+    // the slot is released with the last reference
+    model.reset();
+    first.reset();
+    second.reset();
+    bf16_model.reset();
+    REQUIRE(registry.size() == num_loaded + 1); // the optimised model
+    optimized_model.reset();
+    REQUIRE(registry.size() == num_loaded);
+}
+
+
+TEST_CASE("shared warm-up only runs the shared batch size, once per model") {
+    auto path = FixtureModel::generate();
+    auto classifier = make_classifier(path, 0, 64);
+    auto model = classifier->get_model();
+    REQUIRE_FALSE(model->is_warmed_up(1));
+
+    classifier->warm_up(1);
+    REQUIRE(model->is_warmed_up(1));
+
+    // shared inference disabled: nothing to warm up
+    REQUIRE(classifier->warm_up_shared(1) == 0.0);
+
+    classifier->set_shared_batch_size(8);
+    REQUIRE_FALSE(model->is_warmed_up(8));
+    REQUIRE(classifier->warm_up_shared(1) > 0.0);
+    REQUIRE(model->is_warmed_up(8));
+    REQUIRE(classifier->warm_up_shared(1) == 0.0);
+
+    // also warmed up for other users of the same model
+    auto other = make_classifier(path, 0, 64);
+    REQUIRE(other->get_model() == model);
+    other->set_shared_batch_size(8);
+    REQUIRE(other->warm_up_shared(1) == 0.0);
+}
+
+
+TEST_CASE("inference batcher runs a batch when full, at the oldest deadline, or on flush") {
+    auto model = ModelRegistry::instance().acquire(FixtureModel::generate(), torch::kCPU);
+    auto length = static_cast<std::size_t>(model->get_segment_length());
+
+    std::mutex mutex;
+    std::condition_variable received;
+    std::size_t num_results = 0;
+
+    auto pool = std::make_shared<WindowPool>(8, length, [&](std::size_t, const ClassificationResult&) {
+        {
+            std::lock_guard lock{mutex};
+            ++num_results;
+        }
+        received.notify_all();
+    });
+
+    auto wait_for_results = [&](std::size_t n, std::chrono::milliseconds timeout) {
+        std::unique_lock lock{mutex};
+        return received.wait_for(lock, timeout, [&] { return num_results >= n; });
+    };
+
+    auto submit = [&](InferenceBatcher& batcher, std::chrono::steady_clock::time_point deadline) {
+        auto slot = pool->acquire();
+        REQUIRE(slot);
+        std::fill_n(pool->window(*slot), length, 0.0f);
+        batcher.submit(pool, *slot, deadline);
+    };
+
+    InferenceBatcher::Config config;
+    config.max_batch_size = 4;
+    config.max_delay = std::chrono::seconds(60);
+    auto never = std::chrono::steady_clock::now() + std::chrono::seconds(60);
+
+    SECTION("full batch") {
+        InferenceBatcher batcher{model, config};
+        for (int i = 0; i < 3; ++i) {
+            submit(batcher, never);
+        }
+        REQUIRE_FALSE(wait_for_results(1, std::chrono::milliseconds(200)));
+        REQUIRE(batcher.get_num_batches() == 0);
+
+        // submitting from the pool doesn't allocate
+        auto slot = pool->acquire();
+        REQUIRE(slot);
+        auto num_allocations = util::allocation_counter::count();
+        batcher.submit(pool, *slot, never);
+        REQUIRE(util::allocation_counter::count() == num_allocations);
+
+        REQUIRE(wait_for_results(4, std::chrono::seconds(10)));
+        REQUIRE(batcher.get_num_batches() == 1);
+        REQUIRE(batcher.get_num_windows() == 4);
+    }
+
+    SECTION("oldest deadline") {
+        InferenceBatcher batcher{model, config};
+        auto start = std::chrono::steady_clock::now();
+        submit(batcher, start + std::chrono::milliseconds(200));
+        submit(batcher, never);
+
+        REQUIRE(wait_for_results(2, std::chrono::seconds(10)));
+        REQUIRE(std::chrono::steady_clock::now() - start >= std::chrono::milliseconds(200));
+        REQUIRE(batcher.get_num_batches() == 1);
+        REQUIRE(batcher.get_num_windows() == 2);
+    }
+
+    SECTION("flush only drains the windows pending at the time of the call") {
+        InferenceBatcher batcher{model, config};
+        for (int i = 0; i < 3; ++i) {
+            submit(batcher, never);
+        }
+        batcher.flush();
+        REQUIRE(wait_for_results(3, std::chrono::seconds(10)));
+        REQUIRE(batcher.get_num_batches() == 1);
+
+        submit(batcher, never);
+        submit(batcher, never);
+        REQUIRE_FALSE(wait_for_results(4, std::chrono::milliseconds(200)));
+        REQUIRE(batcher.get_num_batches() == 1);
+
+        batcher.flush();
+        REQUIRE(wait_for_results(5, std::chrono::seconds(10)));
+        REQUIRE(batcher.get_num_batches() == 2);
+        REQUIRE(batcher.get_num_windows() == 5);
+    }
+
+    // all slots are released once the batcher has stopped
+    REQUIRE(pool->get_num_free() == pool->get_num_windows());
+}
+
+
+TEST_CASE("shared inference returns results to the owning instance and channel") {
+    auto model = ModelRegistry::instance().acquire(FixtureModel::generate(), torch::kCPU);
+    auto length = static_cast<std::size_t>(model->get_segment_length());
+    const std::size_t num_instances = 2;
+    const std::size_t num_channels = 2;
+
+    std::mt19937 rng(12);
+    std::uniform_real_distribution<float> dist(-0.5f, 0.5f);
+
+    // one window of noise per instance and channel, with its result classified on its own
+    std::vector<std::vector<float>> windows;
+    std::vector<std::vector<float>> expected;
+    for (std::size_t i = 0; i < num_instances * num_channels; ++i) {
+        auto& window = windows.emplace_back(length);
+        for (auto& x: window) {
+            x = dist(rng);
+        }
+        expected.push_back(model->classify(window.data(), length).distribution);
+    }
+
+    std::mutex mutex;
+    std::condition_variable received;
+    std::size_t num_results = 0;
+
+    // like ipt~, each instance routes the results of its pool by the channel it stored for the slot
+    struct Instance {
+        std::shared_ptr<InferenceBatcher> batcher;
+        std::shared_ptr<WindowPool> pool;
+        std::vector<std::size_t> channels;
+        std::vector<std::vector<float>> results;
+    };
+
+    std::vector<Instance> instances(num_instances);
+    for (auto& instance: instances) {
+        instance.batcher = InferenceService::instance().acquire(model);
+        instance.channels.resize(num_channels);
+        instance.results.resize(num_channels);
+        instance.pool = std::make_shared<WindowPool>(
+                num_channels, length, [&instance, &mutex, &received, &num_results](std::size_t slot
+                                                                                    , const ClassificationResult& r) {
+                    {
+                        std::lock_guard lock{mutex};
+                        instance.results[instance.channels[slot]] = r.distribution;
+                        ++num_results;
+                    }
+                    received.notify_all();
+                });
+    }
+
+    // one batcher per model, shared by all instances
+    REQUIRE(instances[0].batcher == instances[1].batcher);
+
+    // submitted in reverse channel order, so that slots and channels don't match
+    for (std::size_t i = 0; i < num_instances; ++i) {
+        auto& instance = instances[i];
+        for (std::size_t c = num_channels; c-- > 0;) {
+            auto slot = instance.pool->acquire();
+            REQUIRE(slot);
+            instance.channels[*slot] = c;
+            std::copy(windows[i * num_channels + c].begin(), windows[i * num_channels + c].end()
+                      , instance.pool->window(*slot));
+            instance.batcher->submit(instance.pool, *slot, std::chrono::steady_clock::now() + std::chrono::seconds(60));
+        }
+    }
+    instances[0].batcher->flush();
+
+    {
+        std::unique_lock lock{mutex};
+        REQUIRE(received.wait_for(lock, std::chrono::seconds(10), [&] {
+            return num_results == num_instances * num_channels;
+        }));
+    }
+    REQUIRE(instances[0].batcher->get_num_batches() == 1);
+
+    for (std::size_t i = 0; i < num_instances; ++i) {
+        for (std::size_t c = 0; c < num_channels; ++c) {
+            const auto& result = instances[i].results[c];
+            REQUIRE(result.size() == FixtureModel::NUM_CLASSES);
+            for (std::size_t k = 0; k < FixtureModel::NUM_CLASSES; ++k) {
+                REQUIRE(result[k] == Approx(expected[i * num_channels + c][k]).margin(1e-5));
+            }
+        }
+    }
+
+    // like models, batchers are only weakly referenced by the service
+    std::weak_ptr<InferenceBatcher> released = instances[0].batcher;
+    instances.clear();
+    REQUIRE(released.expired());
+}
+
+
+TEST_CASE("hot swap keeps classifying from the next due hop") {
+    const std::size_t vector_size = 64;
+    const int hop_ms = 20;
+    const auto hop_vectors = (util::mstosamples(hop_ms, FixtureModel::SAMPLE_RATE) + vector_size - 1) / vector_size;
+
+    auto path = FixtureModel::generate();
+    auto copy_directory = FixtureModel::directory() / "copy";
+    std::filesystem::create_directories(copy_directory);
+    auto same_format_path = FixtureModel::generate(copy_directory);
+    auto shorter_path = FixtureModel::generate(FixtureModel::directory()
+                                               , FixtureModel::Variant::plain
+                                               , FixtureModel::SEGMENT_LENGTH / 2);
+
+    auto swapped = make_classifier(path, hop_ms, vector_size);
+    auto reference = make_classifier(path, hop_ms, vector_size);
+
+    std::mt19937 rng(6);
+    std::uniform_real_distribution<double> dist(-0.5, 0.5);
+    std::vector<double> audio(vector_size);
+
+    // feeds the next vector to both classifiers
+    auto feed = [&]() {
+        for (auto& x: audio) {
+            x = dist(rng);
+        }
+        const double* inputs[] = {audio.data()};
+        return std::make_pair(swapped->process(inputs, 1, vector_size), reference->process(inputs, 1, vector_size));
+    };
+
+    std::size_t vectors_since_result = 0;
+    for (std::size_t i = 0; i < 2 * FixtureModel::SEGMENT_LENGTH / vector_size; ++i) {
+        vectors_since_result = feed().first.empty() ? vectors_since_result + 1 : 0;
+    }
+    REQUIRE(vectors_since_result < hop_vectors);
+
+    // same weights and format: classification goes on exactly as without the swap
+    auto previous_model = swapped->get_model();
+    swapped->set_model(swapped->load_model(same_format_path));
+    REQUIRE(swapped->get_model() != previous_model);
+
+    std::size_t num_results = 0;
+    for (std::size_t i = 0; i < 2 * hop_vectors; ++i) {
+        auto [results, expected] = feed();
+        REQUIRE(results.size() == expected.size());
+        for (std::size_t r = 0; r < results.size(); ++r) {
+            for (std::size_t c = 0; c < FixtureModel::NUM_CLASSES; ++c) {
+                REQUIRE(results[r].result.distribution[c] == Approx(expected[r].result.distribution[c]).margin(1e-6));
+            }
+        }
+        num_results += results.size();
+    }
+    REQUIRE(num_results >= 2);
+
+    // another segment length: the new buffer is prefilled with the latest window, so that the next due hop is
+    // classified rather than only once a full window of new audio has arrived
+    swapped->set_model(swapped->load_model(shorter_path));
+
+    std::vector<ChannelResult> results;
+    std::size_t vectors_to_result = 0;
+    while (results.empty() && vectors_to_result < hop_vectors + 1) {
+        results = feed().first;
+        ++vectors_to_result;
+    }
+    REQUIRE(results.size() == 1);
+    REQUIRE(results[0].result.distribution.size() == FixtureModel::NUM_CLASSES);
+
+    // at the stream level: a same-format swap keeps the buffer, any other rebuilds it
+    WindowStream stream;
+    stream.initialize(2 * FixtureModel::SAMPLE_RATE
+                      , static_cast<int>(vector_size)
+                      , FixtureModel::SAMPLE_RATE
+                      , FixtureModel::SEGMENT_LENGTH);
+
+    std::vector<double> input(4 * FixtureModel::SEGMENT_LENGTH);
+    for (auto& x: input) {
+        x = dist(rng);
+    }
+    std::size_t num_windows = 0;
+    stream.for_each_due_window(input.data(), input.size(), [&num_windows](const float*, std::size_t) {
+        ++num_windows;
+    });
+    REQUIRE(num_windows > 0);
+
+    stream.set_model_format(FixtureModel::SAMPLE_RATE, FixtureModel::SEGMENT_LENGTH);
+    REQUIRE(stream.samples_since_window() != WindowStream::NO_PREVIOUS_WINDOW);
+    stream.set_model_format(FixtureModel::SAMPLE_RATE, FixtureModel::SEGMENT_LENGTH / 2);
+    REQUIRE(stream.samples_since_window() == WindowStream::NO_PREVIOUS_WINDOW);
+
+    // prefilled with the end of a longer window, or a shorter window preceded by silence
+    std::vector<float> window(24);
+    for (std::size_t i = 0; i < window.size(); ++i) {
+        window[i] = static_cast<float>(i + 1);
+    }
+
+    ResamplingBuffer shorter{16, 32, 44100, 44100};
+    shorter.prefill(window.data(), window.size(), 44100);
+    REQUIRE(shorter.is_fully_allocated());
+    for (std::size_t i = 0; i < 16; ++i) {
+        REQUIRE(shorter.data()[i] == window[8 + i]);
+    }
+
+    ResamplingBuffer longer{32, 32, 44100, 44100};
+    longer.prefill(window.data(), window.size(), 44100);
+    REQUIRE(longer.is_fully_allocated());
+    for (std::size_t i = 0; i < 32; ++i) {
+        REQUIRE(longer.data()[i] == (i < 8 ? 0.0f : window[i - 8]));
+    }
+}
+
+
+TEST_CASE("steady-state classification does not allocate outside of libtorch") {
+    const std::size_t num_channels = 2;
+    const std::size_t vector_size = 64;
+
+    IptClassifier classifier{FixtureModel::generate()
+                             , torch::kCPU
+                             , EnergyThreshold::MINIMUM_THRESHOLD
+                             , IptClassifier::DEFAULT_THRESHOLD_WINDOW_MS
+                             , num_channels};
+    classifier.initialize_model();
+    classifier.initialize_buffers(FixtureModel::SAMPLE_RATE, static_cast<int>(vector_size));
+
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<double> dist(-0.5, 0.5);
+    std::vector<std::vector<double>> audio(num_channels, std::vector<double>(vector_size));
+    for (auto& channel: audio) {
+        for (auto& x: channel) {
+            x = dist(rng);
+        }
+    }
+    const double* inputs[] = {audio[0].data(), audio[1].data()};
+
+    std::size_t num_results = 0;
+    auto on_result = [&num_results](std::size_t, std::size_t, const ClassificationResult& result) {
+        num_results += result.distribution.size() == FixtureModel::NUM_CLASSES ? 1 : 0;
+    };
+
+    // fill the windows: nothing is classified before
+    for (std::size_t i = 0; i <= FixtureModel::SEGMENT_LENGTH / vector_size; ++i) {
+        classifier.process(inputs, num_channels, vector_size, on_result);
+    }
+
+    LeakyIntegrator integrator;
+    integrator.set_tau(100.0);
+    std::vector<float> distribution(FixtureModel::NUM_CLASSES, 0.5f);
+    auto time = std::chrono::steady_clock::now();
+    integrator.process(distribution, time);
+
+    // Note: the only allocations not counted are libtorch's own, each excluded around a single call in Model:
+    //       the forward pass, from_blob's metadata for the input tensor, and the softmax's output tensor
+    auto before = util::allocation_counter::count();
+    for (int i = 0; i < 20; ++i) {
+        classifier.process(inputs, num_channels, vector_size, on_result);
+        integrator.process(distribution, time + std::chrono::milliseconds(i));
+    }
+    auto after = util::allocation_counter::count();
+
+    REQUIRE(num_results >= 20 * num_channels);
+    REQUIRE(after == before);
+}
+
+
+TEST_CASE("result fifo passes results on without allocating, also after a model swap") {
+    const std::size_t num_classes = FixtureModel::NUM_CLASSES;
+    const std::size_t capacity = 8;
+
+    ResultFifo fifo{capacity};
+    fifo.prepare(num_classes);
+
+    auto make_result = [](std::size_t size) {
+        return ClassificationResult{std::vector<float>(size, 1.0f / static_cast<float>(size)), 0.0, 0.0};
+    };
+    const auto result = make_result(num_classes);
+    const auto larger_result = make_result(2 * num_classes);
+
+    // Note: no assertions within the measured sections, which may allocate themselves
+    std::size_t num_pushed = 0;
+    std::size_t num_delivered = 0;
+    TimedResult timed;
+
+    auto before = util::allocation_counter::count();
+    for (std::size_t i = 0; i < 3 * capacity; ++i) {
+        // a burst of two results per delivery, as when the deliverer falls behind
+        for (int j = 0; j < 2; ++j) {
+            num_pushed += fifo.push(0, result, WindowPosition{}) ? 1 : 0;
+        }
+        while (fifo.pop(timed)) {
+            num_delivered += timed.result.distribution.size() == num_classes ? 1 : 0;
+            fifo.recycle(std::move(timed.result.distribution));
+        }
+    }
+
+    // overflow: the buffers of dropped results are kept for the next ones
+    for (std::size_t i = 0; i < capacity + 2; ++i) {
+        num_pushed += fifo.push(0, result, WindowPosition{}) ? 1 : 0;
+    }
+    while (fifo.pop(timed)) {
+        fifo.recycle(std::move(timed.result.distribution));
+    }
+    auto after = util::allocation_counter::count();
+
+    REQUIRE(num_delivered == 6 * capacity);
+    REQUIRE(num_pushed == 6 * capacity + capacity);
+    REQUIRE(after == before);
+
+    // swap to a model with more classes while results of the previous one are still in flight
+    fifo.push(0, result, WindowPosition{});
+    fifo.push(0, result, WindowPosition{});
+    fifo.resize(2 * num_classes);
+
+    // the producer doesn't allocate, even once the in-flight buffers are back, which the consumer resizes instead
+    std::size_t producer_allocations = 0;
+    for (std::size_t i = 0; i < 3 * capacity; ++i) {
+        auto producer_before = util::allocation_counter::count();
+        fifo.push(0, larger_result, WindowPosition{});
+        producer_allocations += util::allocation_counter::count() - producer_before;
+
+        while (fifo.pop(timed)) {
+            fifo.recycle(std::move(timed.result.distribution));
+        }
+    }
+
+    REQUIRE(producer_allocations == 0);
+}
+
+
+TEST_CASE("latency histogram reports percentiles within bucket precision") {
+    for (std::uint64_t ns: {0ull, 15ull, 16ull, 1000ull, 123456789ull}) {
+        auto index = LatencyHistogram::bucket_index(ns);
+        REQUIRE(LatencyHistogram::bucket_upper_bound(index) >= ns);
+        REQUIRE((index == 0 || LatencyHistogram::bucket_upper_bound(index - 1) < ns));
+    }
+
+    LatencyHistogram histogram;
+    REQUIRE(histogram.summary().count == 0);
+
+    for (int i = 1; i <= 1000; ++i) {
+        histogram.record(std::chrono::microseconds(i));
+    }
+
+    auto summary = histogram.summary();
+    REQUIRE(summary.count == 1000);
+    REQUIRE(summary.max_ms == Approx(1.0));
+    REQUIRE(summary.p50_ms == Approx(0.5).epsilon(0.125));
+    REQUIRE(summary.p99_ms == Approx(0.99).epsilon(0.125));
+
+    histogram.reset();
+    REQUIRE(histogram.summary().count == 0);
+}
+
+
+TEST_CASE("end-to-end latency stages add up to the total") {
+    const double sample_rate = 48000.0;
+    const double samples_to_ms = 1000.0 / sample_rate;
+
+    auto require_sum = [&](const EndToEndLatency& latency) {
+        REQUIRE(latency.buffering_ms >= 0.0);
+        REQUIRE(latency.queueing_ms >= 0.0);
+        REQUIRE(latency.compute_ms >= 0.0);
+        REQUIRE(latency.buffering_ms + latency.resampling_ms + latency.queueing_ms + latency.compute_ms
+                == Approx(latency.total_ms).margin(1e-9));
+        REQUIRE(latency.total_samples * samples_to_ms == Approx(latency.total_ms).margin(1e-9));
+    };
+
+    // 10 ms buffered, 10 ms from the drain to the output of which 5 ms compute, 2 ms resampler delay
+    auto latency = EndToEndLatency::measure(WindowPosition{1000.0, 1480.0}, 1960.0, sample_rate, 2.0, 5.0);
+    require_sum(latency);
+    REQUIRE(latency.total_samples == Approx(1056.0));
+    REQUIRE(latency.total_ms == Approx(22.0));
+    REQUIRE(latency.buffering_ms == Approx(10.0));
+    REQUIRE(latency.resampling_ms == Approx(2.0));
+    REQUIRE(latency.queueing_ms == Approx(5.0));
+    REQUIRE(latency.compute_ms == Approx(5.0));
+
+    // compute measured on the steady clock exceeding the time since the drain on the audio clock
+    latency = EndToEndLatency::measure(WindowPosition{1000.0, 1480.0}, 1600.0, sample_rate, 2.0, 5.0);
+    require_sum(latency);
+    REQUIRE(latency.compute_ms == Approx(120.0 * samples_to_ms));
+    REQUIRE(latency.queueing_ms == Approx(0.0));
+
+    // positions out of order, e.g. interpolated within a vector
+    require_sum(EndToEndLatency::measure(WindowPosition{1000.0, 990.0}, 1960.0, sample_rate, 0.0, 1.0));
+    require_sum(EndToEndLatency::measure(WindowPosition{1000.0, 1480.0}, 1400.0, sample_rate, 0.0, 1.0));
+    require_sum(EndToEndLatency::measure(WindowPosition{1000.0, 1480.0}, 900.0, sample_rate, 1.5, 1.0));
+}
+
+
+TEST_CASE("leaky integrator on the audio clock smooths ipt~ and ipt_classify results identically") {
+    const std::size_t vector_size = 64;
+    const std::size_t decode_block_size = 8192;
+    const std::size_t num_samples = 8 * FixtureModel::SEGMENT_LENGTH;
+    const double tau_ms = 50.0;
+    const int hop_ms = 20;
+
+    auto path = FixtureModel::generate();
+    auto live = make_classifier(path, hop_ms, vector_size);
+    auto offline = make_classifier(path, hop_ms, vector_size);
+
+    std::mt19937 rng(4);
+    std::uniform_real_distribution<double> dist(-0.5, 0.5);
+    std::vector<double> audio(num_samples);
+    for (auto& x: audio) {
+        x = dist(rng);
+    }
+
+    // ipt~: one vector per perform call, smoothed by the deliverer at the end sample of each window
+    LeakyIntegrator live_integrator;
+    live_integrator.set_tau(tau_ms);
+    std::vector<std::vector<float>> live_outputs;
+    for (std::size_t start = 0; start < num_samples; start += vector_size) {
+        const double* inputs[] = {audio.data() + start};
+        live->process(inputs, 1, vector_size, [&](std::size_t, std::size_t end_sample, const ClassificationResult& r) {
+            auto time_ms = LeakyIntegrator::audio_time_ms(static_cast<double>(end_sample), FixtureModel::SAMPLE_RATE);
+            live_outputs.push_back(live_integrator.process(r.distribution, time_ms));
+        });
+    }
+
+    // ipt_classify --tau: decoded blocks, windows classified in a batch and smoothed in file order
+    std::vector<ClassificationWindow> windows;
+    for (std::size_t start = 0; start < num_samples; start += decode_block_size) {
+        auto block = offline->acquire_window(audio.data() + start, std::min(decode_block_size, num_samples - start));
+        std::move(block.begin(), block.end(), std::back_inserter(windows));
+    }
+
+    std::vector<std::vector<float>> samples;
+    for (const auto& window: windows) {
+        samples.push_back(window.samples);
+    }
+    auto results = offline->classify(samples);
+
+    LeakyIntegrator offline_integrator;
+    offline_integrator.set_tau(tau_ms);
+    REQUIRE(live_outputs.size() > 1);
+    REQUIRE(live_outputs.size() == results.size());
+    for (std::size_t i = 0; i < results.size(); ++i) {
+        auto time_ms = LeakyIntegrator::audio_time_ms(static_cast<double>(windows[i].end_sample)
+                                                      , FixtureModel::SAMPLE_RATE);
+        const auto& expected = offline_integrator.process(results[i].distribution, time_ms);
+        for (std::size_t c = 0; c < FixtureModel::NUM_CLASSES; ++c) {
+            REQUIRE(live_outputs[i][c] == Approx(expected[c]).margin(1e-5));
+        }
+    }
+
+    // 10 ms steps with tau = 100 ms: each input is mixed in by a tenth
+    LeakyIntegrator integrator;
+    integrator.set_tau(100.0);
+    integrator.process({1.0f, 0.0f}, LeakyIntegrator::audio_time_ms(0.0, 48000.0));
+    auto& value = integrator.process({0.0f, 1.0f}, LeakyIntegrator::audio_time_ms(480.0, 48000.0));
+    REQUIRE(value[0] == Approx(0.9f));
+    REQUIRE(value[1] == Approx(0.1f));
+}
+
+
+TEST_CASE("streaming models classify hops from their new samples only") {
+    const std::size_t vector_size = 64;
+    const int hop_ms = 20;
+
+    auto path = FixtureModel::generate(FixtureModel::directory(), FixtureModel::Variant::streaming);
+    auto streaming = make_classifier(path, hop_ms, vector_size, true);
+    auto full_window = make_classifier(path, hop_ms, vector_size, false);
+    auto without_method = make_classifier(FixtureModel::generate(), hop_ms, vector_size, true);
+
+    REQUIRE(streaming->is_streaming());
+    REQUIRE_FALSE(full_window->is_streaming());
+    REQUIRE_FALSE(without_method->is_streaming());
+
+    std::mt19937 rng(2);
+    std::uniform_real_distribution<double> dist(-0.5, 0.5);
+    std::vector<double> audio(vector_size);
+
+    std::vector<std::vector<float>> streamed;
+    std::vector<std::vector<float>> expected;
+    for (std::size_t i = 0; i < 4 * FixtureModel::SEGMENT_LENGTH / vector_size; ++i) {
+        for (auto& x: audio) {
+            x = dist(rng);
+        }
+        const double* inputs[] = {audio.data()};
+
+        streaming->process(inputs, 1, vector_size, [&](std::size_t, std::size_t, const ClassificationResult& result) {
+            streamed.push_back(result.distribution);
+        });
+        for (auto& result: full_window->process(inputs, 1, vector_size)) {
+            expected.push_back(result.result.distribution);
+        }
+        without_method->process(inputs, 1, vector_size);
+    }
+
+    // the fixture's streaming state is its input history: carried correctly, it rebuilds exactly the full window
+    REQUIRE(streamed.size() > 1);
+    REQUIRE(streamed.size() == expected.size());
+    for (std::size_t i = 0; i < streamed.size(); ++i) {
+        for (std::size_t c = 0; c < FixtureModel::NUM_CLASSES; ++c) {
+            REQUIRE(streamed[i][c] == Approx(expected[i][c]).margin(1e-5));
+        }
+    }
+}
+
+
+TEST_CASE("feature cache only computes new frames and matches frames computed from scratch") {
+    FeatureConfig config;
+    config.sample_rate = 16000;
+    config.n_fft = 512;
+    config.win_length = 400;
+    config.hop_length = 160;
+    config.n_mels = 40;
+
+    const std::size_t segment_length = 4000;
+    const std::size_t num_mels = static_cast<std::size_t>(config.n_mels);
+    const auto hop = static_cast<std::size_t>(config.hop_length);
+
+    std::mt19937 rng(3);
+    std::uniform_real_distribution<float> dist(-0.5f, 0.5f);
+    std::vector<float> audio(20 * segment_length);
+    for (auto& x: audio) {
+        x = dist(rng);
+    }
+
+    FeatureCache cache(config, segment_length);
+    SpectralFrontEnd front_end(config);
+    REQUIRE(cache.num_frames() == config.frames_per_window(segment_length));
+
+    std::size_t position = segment_length;
+    cache.update(audio.data(), segment_length);
+    REQUIRE(cache.num_computed() == cache.num_frames());
+
+    // hops that are shorter than, equal to and longer than a frame hop, and not aligned with it
+    std::vector<float> expected(num_mels);
+    for (std::size_t step: {160, 100, 320, 37, 500, 160, 1}) {
+        position += step;
+        cache.update(audio.data() + position - segment_length, step);
+
+        // frames lie on a grid from the start of the stream: the latest complete ones describe the window
+        auto num_complete = (position - static_cast<std::size_t>(config.n_fft)) / hop + 1;
+        REQUIRE(cache.num_computed() == num_complete);
+
+        auto first_frame = num_complete - cache.num_frames();
+        for (std::size_t f = 0; f < cache.num_frames(); ++f) {
+            front_end.compute_frame(audio.data() + (first_frame + f) * hop, expected.data());
+            for (std::size_t m = 0; m < num_mels; ++m) {
+                REQUIRE(cache.data()[f * num_mels + m] == expected[m]);
+            }
+        }
+    }
+
+    // after a reset or a gap of an entire window, the cache starts over from the current window
+    cache.reset();
+    cache.update(audio.data() + position - segment_length, 10);
+    REQUIRE(cache.num_computed() == cache.num_frames());
+
+    position += 2 * segment_length;
+    cache.update(audio.data() + position - segment_length, 2 * segment_length);
+    REQUIRE(cache.num_computed() == cache.num_frames());
+}
+
+
+TEST_CASE("models with a feature front end classify cached features like full windows") {
+    // hops of whole vectors and whole feature hops, so that the cached frames are exactly those of each window
+    const std::size_t vector_size = 32;
+    const int hop_ms = 20;
+
+    auto path = FixtureModel::generate(FixtureModel::directory(), FixtureModel::Variant::features);
+    auto cached = make_classifier(path, hop_ms, vector_size, true, true);
+    auto full_window = make_classifier(path, hop_ms, vector_size, true, false);
+    auto without_methods = make_classifier(FixtureModel::generate(), hop_ms, vector_size, true, true);
+
+    REQUIRE(cached->is_using_features());
+    REQUIRE_FALSE(full_window->is_using_features());
+    REQUIRE_FALSE(without_methods->is_using_features());
+
+    auto model = cached->get_model();
+    const auto& config = model->get_feature_config();
+    REQUIRE(config);
+    REQUIRE(config->n_fft == FixtureModel::N_FFT);
+    REQUIRE(config->win_length == FixtureModel::WIN_LENGTH);
+    REQUIRE(config->hop_length == FixtureModel::HOP_LENGTH);
+    REQUIRE(config->n_mels == FixtureModel::N_MELS);
+    REQUIRE(config->get_f_max() == Approx(FixtureModel::SAMPLE_RATE / 2.0));
+    REQUIRE(util::mstosamples(hop_ms, FixtureModel::SAMPLE_RATE) % FixtureModel::HOP_LENGTH == 0);
+
+    std::mt19937 rng(5);
+    std::uniform_real_distribution<double> dist(-0.5, 0.5);
+    std::vector<double> audio(vector_size);
+
+    std::vector<std::vector<float>> from_features;
+    std::vector<std::vector<float>> expected;
+    for (std::size_t i = 0; i < 3 * FixtureModel::SEGMENT_LENGTH / vector_size; ++i) {
+        for (auto& x: audio) {
+            x = dist(rng);
+        }
+        const double* inputs[] = {audio.data()};
+
+        for (auto& result: cached->process(inputs, 1, vector_size)) {
+            from_features.push_back(result.result.distribution);
+        }
+        for (auto& result: full_window->process(inputs, 1, vector_size)) {
+            expected.push_back(result.result.distribution);
+        }
+        without_methods->process(inputs, 1, vector_size);
+    }
+
+    // the fixture's forward computes the same front end with torch.stft, in float32
+    REQUIRE(from_features.size() > 1);
+    REQUIRE(from_features.size() == expected.size());
+    for (std::size_t i = 0; i < from_features.size(); ++i) {
+        for (std::size_t c = 0; c < FixtureModel::NUM_CLASSES; ++c) {
+            REQUIRE(from_features[i][c] == Approx(expected[i][c]).margin(1e-4));
+        }
+    }
+    REQUIRE(cached->get_stats()[Stage::features].summary().count == from_features.size());
+}
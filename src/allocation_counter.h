@@ -0,0 +1,47 @@
+#ifndef IPT_MAX_ALLOCATION_COUNTER_H
+#define IPT_MAX_ALLOCATION_COUNTER_H
+
+#include <cstddef>
+
+
+/**
+ * Test hook counting the heap allocations of the calling thread, to verify that the steady-state classification path
+ * doesn't allocate. Counting requires a replacement of the global `operator new` that calls `on_allocation()`, which
+ * is only defined by tests (see ipt_tilde_test.cpp): in any other build, this costs one thread-local increment per
+ * excluded section.
+ *
+ * Allocations made by libtorch itself are excluded with an `Exclude` guard, each around a single call (see Model): the
+ * forward pass, the tensor metadata `torch::from_blob` allocates for the input, and the softmax's output tensor.
+ */
+namespace util::allocation_counter {
+
+inline thread_local std::size_t num_allocations = 0;
+inline thread_local int num_exclusions = 0;
+
+
+inline void on_allocation() {
+    if (num_exclusions == 0) {
+        ++num_allocations;
+    }
+}
+
+
+inline std::size_t count() {
+    return num_allocations;
+}
+
+
+/** Allocations of the current thread are not counted for the lifetime of this object */
+class Exclude {
+public:
+    Exclude() { ++num_exclusions; }
+
+    ~Exclude() { --num_exclusions; }
+
+    Exclude(const Exclude&) = delete;
+    Exclude& operator=(const Exclude&) = delete;
+};
+
+} // namespace util::allocation_counter
+
+#endif //IPT_MAX_ALLOCATION_COUNTER_H
@@ -0,0 +1,188 @@
+#ifndef IPT_MAX_BINARY_SEMAPHORE_H
+#define IPT_MAX_BINARY_SEMAPHORE_H
+
+#include <atomic>
+#include <chrono>
+
+// On Linux, the POSIX semaphore is only used where sem_clockwait() can wait on CLOCK_MONOTONIC (glibc 2.30+), as
+// sem_timedwait() takes a CLOCK_REALTIME deadline, which wall-clock adjustments would stretch or cut short
+#if defined(__linux__) && defined(__GLIBC__) && defined(__GLIBC_PREREQ)
+#if __GLIBC_PREREQ(2, 30)
+#define IPT_HAS_SEM_CLOCKWAIT
+#endif
+#endif
+
+#if defined(__APPLE__)
+#include <mach/mach.h>
+#include <mach/semaphore.h>
+#elif defined(IPT_HAS_SEM_CLOCKWAIT)
+#include <cerrno>
+#include <ctime>
+#include <semaphore.h>
+#else
+#include <condition_variable>
+#include <mutex>
+#endif
+
+
+/**
+ * Binary semaphore for waking a worker thread from the audio thread.
+ *
+ * Signals are coalesced: signalling an already signalled semaphore is a no-op, so a single `wait()` consumes any
+ * number of signals sent since the previous one. `signal()` only touches the OS primitive when the waiting thread is
+ * actually asleep, and never blocks nor allocates.
+ */
+class BinarySemaphore {
+public:
+    BinarySemaphore() = default;
+
+    BinarySemaphore(const BinarySemaphore&) = delete;
+    BinarySemaphore& operator=(const BinarySemaphore&) = delete;
+
+
+    /** @note Safe to call from the audio thread */
+    void signal() {
+        // count: 1 = signalled, 0 = idle, -1 = waiter sleeping
+        auto count = m_count.load(std::memory_order_relaxed);
+        while (count < 1) {
+            if (m_count.compare_exchange_weak(count, count + 1
+                                              , std::memory_order_release
+                                              , std::memory_order_relaxed)) {
+                if (count < 0) {
+                    m_semaphore.signal();
+                }
+                return;
+            }
+        }
+    }
+
+
+    void wait() {
+        if (m_count.fetch_sub(1, std::memory_order_acquire) < 1) {
+            m_semaphore.wait();
+        }
+    }
+
+
+    /** @returns true if signalled, false on timeout */
+    template<typename Rep, typename Period>
+    bool wait_for(const std::chrono::duration<Rep, Period>& timeout) {
+        if (m_count.fetch_sub(1, std::memory_order_acquire) > 0) {
+            return true;
+        }
+
+        if (timeout.count() > 0 && m_semaphore.wait_for(std::chrono::duration_cast<std::chrono::nanoseconds>(timeout))) {
+            return true;
+        }
+
+        // Timed out: withdraw as waiter, unless a signal raced in, in which case it must be consumed from the OS semaphore
+        auto count = m_count.load(std::memory_order_relaxed);
+        while (count < 0) {
+            if (m_count.compare_exchange_weak(count, count + 1, std::memory_order_relaxed)) {
+                return false;
+            }
+        }
+
+        m_semaphore.wait();
+        return true;
+    }
+
+
+private:
+#if defined(__APPLE__)
+
+    class OsSemaphore {
+    public:
+        OsSemaphore() { semaphore_create(mach_task_self(), &m_semaphore, SYNC_POLICY_FIFO, 0); }
+
+        ~OsSemaphore() { semaphore_destroy(mach_task_self(), m_semaphore); }
+
+        void signal() { semaphore_signal(m_semaphore); }
+
+        void wait() {
+            while (semaphore_wait(m_semaphore) == KERN_ABORTED) {}
+        }
+
+        bool wait_for(std::chrono::nanoseconds timeout) {
+            auto ns = timeout.count();
+            mach_timespec_t ts{static_cast<unsigned int>(ns / 1000000000)
+                               , static_cast<clock_res_t>(ns % 1000000000)};
+            return semaphore_timedwait(m_semaphore, ts) == KERN_SUCCESS;
+        }
+
+    private:
+        semaphore_t m_semaphore;
+    };
+
+#elif defined(IPT_HAS_SEM_CLOCKWAIT)
+
+    class OsSemaphore {
+    public:
+        OsSemaphore() { sem_init(&m_semaphore, 0, 0); }
+
+        ~OsSemaphore() { sem_destroy(&m_semaphore); }
+
+        void signal() { sem_post(&m_semaphore); }
+
+        void wait() {
+            while (sem_wait(&m_semaphore) == -1 && errno == EINTR) {}
+        }
+
+        bool wait_for(std::chrono::nanoseconds timeout) {
+            timespec ts{};
+            clock_gettime(CLOCK_MONOTONIC, &ts);
+            auto ns = static_cast<long long>(ts.tv_nsec) + timeout.count();
+            ts.tv_sec += static_cast<time_t>(ns / 1000000000);
+            ts.tv_nsec = static_cast<long>(ns % 1000000000);
+
+            int rc;
+            while ((rc = sem_clockwait(&m_semaphore, CLOCK_MONOTONIC, &ts)) == -1 && errno == EINTR) {}
+            return rc == 0;
+        }
+
+    private:
+        sem_t m_semaphore{};
+    };
+
+#else
+
+    // Note: waits on steady_clock, so timeouts are unaffected by wall-clock adjustments as well
+    class OsSemaphore {
+    public:
+        void signal() {
+            {
+                std::lock_guard lock{m_mutex};
+                ++m_count;
+            }
+            m_cv.notify_one();
+        }
+
+        void wait() {
+            std::unique_lock lock{m_mutex};
+            m_cv.wait(lock, [this] { return m_count > 0; });
+            --m_count;
+        }
+
+        bool wait_for(std::chrono::nanoseconds timeout) {
+            std::unique_lock lock{m_mutex};
+            if (!m_cv.wait_for(lock, timeout, [this] { return m_count > 0; })) {
+                return false;
+            }
+            --m_count;
+            return true;
+        }
+
+    private:
+        std::mutex m_mutex;
+        std::condition_variable m_cv;
+        int m_count = 0;
+    };
+
+#endif
+
+    std::atomic<int> m_count{0};
+    OsSemaphore m_semaphore;
+};
+
+
+#endif //IPT_MAX_BINARY_SEMAPHORE_H
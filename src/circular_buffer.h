@@ -2,76 +2,114 @@
 #ifndef IPT_MAX_CIRCULAR_BUFFER_H
 #define IPT_MAX_CIRCULAR_BUFFER_H
 
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <numeric>
+#include <stdexcept>
+#include <string>
 #include <vector>
 #include <CDSPResampler.h>
 #include "utility.h"
 
 
+/**
+ * Mirrored circular buffer: every sample is stored twice, `size()` samples apart, so that the latest `size()`
+ * samples are always available as one contiguous range through `data()`, without any reordering or copying.
+ *
+ * The sum of squares of the buffer is maintained incrementally on write, so that `rms()` is O(1).
+ */
 template<typename T, typename = std::enable_if_t<std::is_floating_point_v<T>>>
 class CircularBuffer {
 public:
-    explicit CircularBuffer(std::size_t size) : m_buffer(size, 0.0f) {}
+    explicit CircularBuffer(std::size_t size) : m_buffer(2 * size, T(0.0)), m_size(size) {}
 
     CircularBuffer(int ms, int sr) : CircularBuffer(util::mstosamples(ms, sr)) {}
 
 
-    void add_samples(const std::vector<T>& new_samples) {
+    template<typename U>
+    void add_samples(const std::vector<U>& new_samples) {
         add_samples(new_samples.data(), new_samples.size());
     }
 
 
-    void add_samples(const T* samples, std::size_t num_samples) {
-        if (!m_fully_allocated && m_write_index + num_samples >= m_buffer.size()) {
+    /** @param samples converted to T on write, so that e.g. a float buffer can be filled directly from doubles */
+    template<typename U, typename = std::enable_if_t<std::is_arithmetic_v<U>>>
+    void add_samples(const U* samples, std::size_t num_samples) {
+        if (m_size == 0) {
+            return;
+        }
+
+        if (!m_fully_allocated && m_write_index + num_samples >= m_size) {
             m_fully_allocated = true;
         }
 
         for (std::size_t i = 0; i < num_samples; ++i) {
-            m_buffer[m_write_index] = samples[i];
-            m_write_index = (m_write_index + 1) % m_buffer.size();
-        }
-    }
+            auto sample = static_cast<T>(samples[i]);
+            auto previous = static_cast<double>(m_buffer[m_write_index]);
+            m_sum_of_squares += static_cast<double>(sample) * static_cast<double>(sample) - previous * previous;
 
+            m_buffer[m_write_index] = sample;
+            m_buffer[m_write_index + m_size] = sample;
 
-    std::vector<T> get_samples() const {
-        std::size_t num_samples = size();
-        std::vector<T> reordered_samples;
-        reordered_samples.reserve(num_samples);
+            if (++m_write_index == m_size) {
+                m_write_index = 0;
+
+                // Bound the drift of the running sum by recomputing it once per revolution, i.e. O(1) per sample
+                recompute_sum_of_squares();
+            }
+        }
+    }
 
-        size_t start_index = m_write_index;
 
-        for (size_t i = 0; i < num_samples; ++i) {
-            reordered_samples.push_back(m_buffer[(start_index + i) % num_samples]);
+    /** Root mean square of the entire buffer (including samples that haven't been written yet, which are zero) */
+    double rms() const {
+        if (m_size == 0) {
+            return 0.0;
         }
+        return std::sqrt(std::max(0.0, m_sum_of_squares) / static_cast<double>(m_size));
+    }
+
 
-        return reordered_samples;
+    /** Pointer to the latest `size()` samples, oldest first. Valid until the next call to a non-const function */
+    const T* data() const {
+        return m_buffer.data() + m_write_index;
     }
 
 
-    const std::vector<T>& samples_unordered() const {
-        return m_buffer;
+    std::vector<T> get_samples() const {
+        return std::vector<T>(data(), data() + m_size);
     }
 
 
+    /** Keeps the latest samples that fit in the new size */
     void resize(std::size_t new_size) {
-        if (new_size > m_buffer.size()) {
-            m_fully_allocated = false;
+        if (new_size == m_size) {
+            return;
         }
 
-        if (m_write_index >= new_size) {
-            m_write_index = 0;
-        }
+        auto num_kept = std::min(new_size, m_size);
+        std::vector<T> resized(2 * new_size, T(0.0));
+        std::copy(data() + m_size - num_kept, data() + m_size, resized.begin() + (new_size - num_kept));
+        std::copy(resized.begin(), resized.begin() + new_size, resized.begin() + new_size);
 
-        m_buffer.resize(new_size);
+        m_fully_allocated = m_fully_allocated && new_size <= m_size;
+        m_buffer = std::move(resized);
+        m_size = new_size;
+        m_write_index = 0;
+        recompute_sum_of_squares();
     }
 
 
     void resize(int ms, int sr) {
-        m_buffer.resize(util::mstosamples(ms, sr));
+        resize(util::mstosamples(ms, sr));
     }
 
 
     std::size_t size() const {
-        return m_buffer.size();
+        return m_size;
     }
 
 
@@ -82,51 +120,136 @@ public:
 
 
 private:
+    void recompute_sum_of_squares() {
+        m_sum_of_squares = util::simd::sum_of_squares(data(), m_size);
+    }
+
+
     std::vector<T> m_buffer;
+    std::size_t m_size;
     std::size_t m_write_index = 0;
     bool m_fully_allocated = false;
+
+    double m_sum_of_squares = 0.0;
 };
 
 
 // ==============================================================================================
 
+/**
+ * Trade-off between the resampler's filter quality and its CPU cost and group delay, which adds directly to the
+ * latency of classification. Irrelevant when the input is already at the model's sample rate, which is passed through.
+ */
+enum class ResamplingQuality {
+    high,   // r8brain's defaults: 2% transition band, 207 dB attenuation, linear phase
+    medium, // 8% transition band, 120 dB attenuation, minimum phase
+    low,    // 20% transition band, 70 dB attenuation, minimum phase
+    linear  // linear interpolation: one sample of delay and the lowest cost, but no anti-aliasing filter
+};
+
+
 class ResamplingBuffer {
 public:
-    ResamplingBuffer(std::size_t buffer_size, std::size_t input_vector_size, int input_sr, int output_sr)
-            : m_resampler(static_cast<double>(input_sr)
-                          , static_cast<double>(output_sr)
-                          , static_cast<int>(input_vector_size))
+    ResamplingBuffer(std::size_t buffer_size
+                     , std::size_t input_vector_size
+                     , int input_sr
+                     , int output_sr
+                     , ResamplingQuality quality = ResamplingQuality::high)
+            : m_resampler(create_resampler(input_sr, output_sr, input_vector_size, quality))
               , m_buffer(buffer_size)
-              , m_input_vector_size(input_vector_size) {}
+              , m_input_vector_size(input_vector_size)
+              , m_input_chunk(m_resampler ? input_vector_size : 0, 0.0)
+              , m_input_sr(input_sr)
+              , m_output_sr(output_sr)
+              , m_quality(quality) {
+        if (is_interpolating()) {
+            auto divisor = std::gcd(input_sr, output_sr);
+            m_step = input_sr / divisor;
+            m_phase_resolution = output_sr / divisor;
+            m_output_chunk.resize(input_vector_size * static_cast<std::size_t>(m_phase_resolution)
+                                  / static_cast<std::size_t>(m_step) + 1);
+        }
+    }
+
+
+    /** @returns the number of resampled samples written to the buffer */
+    std::size_t add_samples(const std::vector<double>& new_samples) {
+        return add_samples(new_samples.data(), new_samples.size());
+    }
+
 
+    /** @returns the number of resampled samples written to the buffer */
+    std::size_t add_samples(const double* samples, std::size_t num_samples) {
+        if (is_passthrough()) {
+            m_buffer.add_samples(samples, num_samples);
+            return num_samples;
+        }
 
-    void add_samples(std::vector<double>& new_samples) {
         // We typically expect the size of the input to be equal to or less than the audio input vector size,
-        // but since the vector is populated asynchronously, we will occasionally get much larger chunks,
+        // but since the input is drained asynchronously, we will occasionally get much larger chunks,
         // which needs to be handled since the resampler is fixed size
 
-        if (new_samples.size() <= m_input_vector_size) {
-            add_samples_fixed_size(new_samples);
+        std::size_t num_output = 0;
+        std::size_t start = 0;
+        while (start < num_samples) {
+            auto chunk_size = std::min(m_input_vector_size, num_samples - start);
+            num_output += add_samples_fixed_size(samples + start, chunk_size);
+            start += chunk_size;
+        }
+        return num_output;
+    }
+
+
+    /**
+     * Fills the buffer with a window recorded at another sample rate, typically the latest window of a buffer with a
+     * different configuration, so that classification can resume immediately rather than after a full window of new
+     * audio. If the resampled window is shorter than the buffer, it is preceded by silence.
+     */
+    void prefill(const float* samples, std::size_t num_samples, int sr) {
+        if (num_samples == 0 || sr <= 0) {
+            return;
+        }
+
+        std::vector<double> input(samples, samples + num_samples);
+        auto num_output = static_cast<std::size_t>(std::lround(static_cast<double>(num_samples)
+                                                               * static_cast<double>(m_output_sr)
+                                                               / static_cast<double>(sr)));
+        std::vector<double> output;
+
+        if (sr == m_output_sr) {
+            output = std::move(input);
         } else {
-            auto total_size = static_cast<long>(new_samples.size());
-            auto chunk_size = static_cast<long>(m_input_vector_size);
-            long start = 0;
-
-            while (start + chunk_size <= total_size) {
-                std::vector<double> chunk(new_samples.begin() + start, new_samples.begin() + start + chunk_size);
-                add_samples_fixed_size(chunk);
-                start += chunk_size;
-            }
+            output.resize(num_output);
+            r8b::CDSPResampler resampler(static_cast<double>(sr)
+                                         , static_cast<double>(m_output_sr)
+                                         , static_cast<int>(num_samples));
+            resampler.oneshot(input.data(), static_cast<int>(num_samples), output.data(), static_cast<int>(num_output));
+        }
 
-            if (start < total_size) {
-                std::vector<double> remainder(new_samples.begin() + start, new_samples.end());
-                add_samples_fixed_size(remainder);
-            }
+        if (output.size() < m_buffer.size()) {
+            m_buffer.add_samples(std::vector<double>(m_buffer.size() - output.size(), 0.0));
         }
+        m_buffer.add_samples(output);
+    }
+
+
+    /** The latest resampled window as `size()` contiguous floats, oldest first, e.g. for `torch::from_blob` */
+    const float* data() const {
+        return m_buffer.data();
+    }
+
+
+    std::size_t size() const {
+        return m_buffer.size();
+    }
+
+
+    double rms() const {
+        return m_buffer.rms();
     }
 
 
-    std::vector<double> get_samples() const {
+    std::vector<float> get_samples() const {
         return m_buffer.get_samples();
     }
 
@@ -136,21 +259,152 @@ public:
     }
 
 
+    ResamplingQuality get_quality() const {
+        return m_quality;
+    }
+
+
+    /** Group delay of the resampler in input samples, i.e. the latency it adds to every classification */
+    double latency() const {
+        if (m_resampler) {
+            return static_cast<double>(m_resampler->getInLenBeforeOutPos(0));
+        }
+        return is_interpolating() ? 1.0 : 0.0;
+    }
+
+
+    /** @returns true if the input is at the output rate, in which case it is written to the buffer as is */
+    bool is_passthrough() const {
+        return m_input_sr == m_output_sr;
+    }
+
+
+    static std::string quality_name(ResamplingQuality quality) {
+        switch (quality) {
+            case ResamplingQuality::medium:
+                return "medium";
+            case ResamplingQuality::low:
+                return "low";
+            case ResamplingQuality::linear:
+                return "linear";
+            default:
+                return "high";
+        }
+    }
+
+
+    /** @throws std::invalid_argument if `name` is not one of the names returned by `quality_name()` */
+    static ResamplingQuality parse_quality(const std::string& name) {
+        for (auto quality: {ResamplingQuality::high
+                            , ResamplingQuality::medium
+                            , ResamplingQuality::low
+                            , ResamplingQuality::linear}) {
+            if (name == quality_name(quality)) {
+                return quality;
+            }
+        }
+        throw std::invalid_argument("unknown resampling quality \"" + name + "\"");
+    }
+
+
 private:
-    void add_samples_fixed_size(std::vector<double>& new_samples) {
-        assert(new_samples.size() <= m_input_vector_size);
+    static std::unique_ptr<r8b::CDSPResampler> create_resampler(int input_sr
+                                                                , int output_sr
+                                                                , std::size_t input_vector_size
+                                                                , ResamplingQuality quality) {
+        if (input_sr == output_sr || quality == ResamplingQuality::linear) {
+            return nullptr;
+        }
+
+        double transition_band = 2.0;
+        double attenuation = 206.91;
+        auto phase = r8b::fprLinearPhase;
+
+        if (quality == ResamplingQuality::medium) {
+            transition_band = 8.0;
+            attenuation = 120.0;
+            phase = r8b::fprMinPhase;
+        } else if (quality == ResamplingQuality::low) {
+            transition_band = 20.0;
+            attenuation = 70.0;
+            phase = r8b::fprMinPhase;
+        }
+
+        return std::make_unique<r8b::CDSPResampler>(static_cast<double>(input_sr)
+                                                    , static_cast<double>(output_sr)
+                                                    , static_cast<int>(input_vector_size)
+                                                    , transition_band
+                                                    , attenuation
+                                                    , phase);
+    }
+
+
+    bool is_interpolating() const {
+        return !m_resampler && !is_passthrough();
+    }
+
+
+    std::size_t add_samples_fixed_size(const double* samples, std::size_t num_samples) {
+        assert(num_samples <= m_input_vector_size);
+
+        if (!m_resampler) {
+            return interpolate(samples, num_samples);
+        }
+
+        // r8brain takes a non-const input pointer, copy to owned scratch storage rather than casting away const
+        std::copy(samples, samples + num_samples, m_input_chunk.begin());
 
         double* output_ptr = nullptr;
-        int num_samples = m_resampler.process(new_samples.data(), static_cast<int>(new_samples.size()), output_ptr);
-        m_buffer.add_samples(output_ptr, static_cast<std::size_t>(num_samples));
+        int num_output = m_resampler->process(m_input_chunk.data(), static_cast<int>(num_samples), output_ptr);
+        m_buffer.add_samples(output_ptr, static_cast<std::size_t>(num_output));
+        return static_cast<std::size_t>(num_output);
     }
 
 
-    r8b::CDSPResampler m_resampler;
-    CircularBuffer<double> m_buffer;
-    std::size_t m_input_vector_size;
+    /**
+     * Linear interpolation between consecutive input samples, the last sample of the previous chunk included.
+     * Positions are kept as exact fractions of an input sample, so that the output doesn't depend on the chunk sizes
+     */
+    std::size_t interpolate(const double* samples, std::size_t num_samples) {
+        auto end = static_cast<std::int64_t>(num_samples) * m_phase_resolution;
+        auto resolution = static_cast<double>(m_phase_resolution);
+        std::size_t num_output = 0;
+
+        // m_position is relative to the previous chunk's last sample, i.e. position `m_phase_resolution` is samples[0]
+        while (m_position < end && num_output < m_output_chunk.size()) {
+            auto index = static_cast<std::size_t>(m_position / m_phase_resolution);
+            auto fraction = static_cast<double>(m_position % m_phase_resolution) / resolution;
+            auto a = index == 0 ? m_previous_sample : samples[index - 1];
+            auto b = samples[index];
+
+            m_output_chunk[num_output++] = a + fraction * (b - a);
+            m_position += m_step;
+        }
 
+        m_position -= end;
+        if (num_samples > 0) {
+            m_previous_sample = samples[num_samples - 1];
+        }
+
+        m_buffer.add_samples(m_output_chunk.data(), num_output);
+        return num_output;
+    }
 
+
+    std::unique_ptr<r8b::CDSPResampler> m_resampler; // nullptr when passing through or interpolating linearly
+    CircularBuffer<float> m_buffer;
+    std::size_t m_input_vector_size;
+    std::vector<double> m_input_chunk;
+    int m_input_sr;
+    int m_output_sr;
+    ResamplingQuality m_quality;
+
+    // linear interpolation state, in units of 1 / m_phase_resolution input samples
+    std::int64_t m_step = 1;
+    std::int64_t m_phase_resolution = 1;
+    std::int64_t m_position = 0;
+    double m_previous_sample = 0.0;
+    std::vector<double> m_output_chunk;
 };
 
 
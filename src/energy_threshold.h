@@ -22,6 +22,26 @@ public:
     }
 
 
+    /** Compare a precomputed rms amplitude, e.g. the running `CircularBuffer::rms()`, against the threshold */
+    bool is_above_threshold(double rms_amplitude) const {
+        if (m_threshold_db <= MINIMUM_THRESHOLD) {
+            return true;
+        }
+
+        return atodb(rms_amplitude) >= m_threshold_db;
+    }
+
+
+    template<typename T>
+    bool is_above_threshold(const T* samples, std::size_t num_samples) const {
+        if (m_threshold_db <= MINIMUM_THRESHOLD) {
+            return true;
+        }
+
+        return atodb(rms(samples, num_samples)) >= m_threshold_db;
+    }
+
+
     void set_threshold_db(double threshold_db) {
         m_threshold_db = threshold_db;
     }
@@ -39,9 +59,17 @@ public:
     }
 
     static double rms(const std::vector<double>& v) {
-        double sum = 0.0;
-        for (auto& x: v) sum += x * x;
-        return std::sqrt(sum / static_cast<double>(v.size()));
+        return rms(v.data(), v.size());
+    }
+
+
+    template<typename T>
+    static double rms(const T* samples, std::size_t num_samples) {
+        if (num_samples == 0) {
+            return 0.0;
+        }
+
+        return std::sqrt(util::simd::sum_of_squares(samples, num_samples) / static_cast<double>(num_samples));
     }
 
 
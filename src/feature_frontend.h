@@ -0,0 +1,368 @@
+#ifndef IPT_MAX_FEATURE_FRONTEND_H
+#define IPT_MAX_FEATURE_FRONTEND_H
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+
+/**
+ * Parameters of a model's spectral front end, as returned by its `get_feature_config` method. The features of a window
+ * are the (log) mel spectrogram of `torchaudio.transforms.MelSpectrogram(sample_rate, n_fft, win_length, hop_length,
+ * f_min, f_max, n_mels=n_mels, power=power, center=False)` with the default periodic Hann window and HTK mel scale
+ * without normalisation, stored as [frames, mels].
+ */
+struct FeatureConfig {
+    int sample_rate = 0;
+    int n_fft = 0;              // must be a power of two
+    int win_length = 0;         // 0 for n_fft. Shorter windows are zero-padded on both sides, like torch.stft
+    int hop_length = 0;
+    int n_mels = 0;
+    double f_min = 0.0;
+    double f_max = 0.0;         // 0 for sample_rate / 2
+    double power = 2.0;         // 1 for the magnitude, 2 for the power spectrum
+    double log_offset = 0.0;    // if > 0, features are log(mel + log_offset)
+
+
+    /** @throws std::invalid_argument if the parameters can't describe a front end */
+    void validate() const {
+        if (sample_rate <= 0 || n_fft < 2 || (n_fft & (n_fft - 1)) != 0) {
+            throw std::invalid_argument("feature config: n_fft must be a power of two");
+        }
+        if (win_length < 0 || win_length > n_fft || hop_length <= 0 || n_mels <= 0 || power <= 0.0) {
+            throw std::invalid_argument("feature config: invalid win_length, hop_length, n_mels or power");
+        }
+        if (f_min < 0.0 || get_f_max() <= f_min) {
+            throw std::invalid_argument("feature config: invalid frequency range");
+        }
+    }
+
+
+    /** Number of frames in a window of `segment_length` samples, 0 if the window is shorter than one frame */
+    std::size_t frames_per_window(std::size_t segment_length) const {
+        auto fft_size = static_cast<std::size_t>(n_fft);
+        if (segment_length < fft_size) {
+            return 0;
+        }
+        return 1 + (segment_length - fft_size) / static_cast<std::size_t>(hop_length);
+    }
+
+
+    double get_f_max() const {
+        return f_max > 0.0 ? f_max : sample_rate / 2.0;
+    }
+
+
+    int get_win_length() const {
+        return win_length > 0 ? win_length : n_fft;
+    }
+};
+
+
+// ==============================================================================================
+
+/**
+ * Computes the features of one frame: window, FFT, (power) magnitude, mel filterbank and log. All tables and scratch
+ * buffers are allocated on construction, so compute_frame() doesn't allocate. The FFT is an iterative radix-2 one on
+ * split real / imaginary arrays, whose butterflies vectorise well.
+ */
+class SpectralFrontEnd {
+public:
+    static constexpr double PI = 3.14159265358979323846;
+
+    /** @throws std::invalid_argument if `config` is invalid */
+    explicit SpectralFrontEnd(const FeatureConfig& config) : m_config(config) {
+        config.validate();
+
+        auto n = static_cast<std::size_t>(config.n_fft);
+        m_num_bins = n / 2 + 1;
+        m_num_mels = static_cast<std::size_t>(config.n_mels);
+
+        init_window();
+        init_fft(n);
+        init_mel_filterbank();
+
+        m_real.resize(n);
+        m_imag.resize(n);
+        m_spectrum.resize(m_num_bins);
+    }
+
+
+    /**
+     * @param samples `n_fft` samples at the model's sample rate
+     * @param features `n_mels` features of the frame
+     */
+    void compute_frame(const float* samples, float* features) {
+        auto n = m_real.size();
+        for (std::size_t i = 0; i < n; ++i) {
+            auto j = m_bit_reversed[i];
+            m_real[i] = static_cast<double>(samples[j]) * m_window[j];
+            m_imag[i] = 0.0;
+        }
+
+        fft();
+
+        for (std::size_t k = 0; k < m_num_bins; ++k) {
+            auto squared = m_real[k] * m_real[k] + m_imag[k] * m_imag[k];
+            m_spectrum[k] = m_config.power == 2.0 ? squared
+                                                  : m_config.power == 1.0 ? std::sqrt(squared)
+                                                                          : std::pow(squared, m_config.power / 2.0);
+        }
+
+        for (std::size_t m = 0; m < m_num_mels; ++m) {
+            const double* weights = &m_filterbank[m * m_num_bins];
+            double sum = 0.0;
+            for (std::size_t k = m_filter_start[m]; k < m_filter_end[m]; ++k) {
+                sum += weights[k] * m_spectrum[k];
+            }
+            features[m] = static_cast<float>(m_config.log_offset > 0.0 ? std::log(sum + m_config.log_offset) : sum);
+        }
+    }
+
+
+    const FeatureConfig& get_config() const {
+        return m_config;
+    }
+
+
+    static double hz_to_mel(double hz) {
+        return 2595.0 * std::log10(1.0 + hz / 700.0);
+    }
+
+
+    static double mel_to_hz(double mel) {
+        return 700.0 * (std::pow(10.0, mel / 2595.0) - 1.0);
+    }
+
+
+private:
+    /** Periodic Hann window of `win_length`, centered in `n_fft` */
+    void init_window() {
+        auto n = static_cast<std::size_t>(m_config.n_fft);
+        auto length = static_cast<std::size_t>(m_config.get_win_length());
+        auto offset = (n - length) / 2;
+
+        m_window.assign(n, 0.0);
+        for (std::size_t i = 0; i < length; ++i) {
+            auto phase = 2.0 * PI * static_cast<double>(i) / static_cast<double>(length);
+            m_window[offset + i] = 0.5 - 0.5 * std::cos(phase);
+        }
+    }
+
+
+    void init_fft(std::size_t n) {
+        std::size_t num_bits = 0;
+        while ((std::size_t{1} << num_bits) < n) {
+            ++num_bits;
+        }
+
+        m_bit_reversed.resize(n);
+        for (std::size_t i = 0; i < n; ++i) {
+            std::size_t reversed = 0;
+            for (std::size_t b = 0; b < num_bits; ++b) {
+                reversed |= ((i >> b) & 1) << (num_bits - 1 - b);
+            }
+            m_bit_reversed[i] = reversed;
+        }
+
+        m_cos.resize(n / 2);
+        m_sin.resize(n / 2);
+        for (std::size_t i = 0; i < n / 2; ++i) {
+            auto phase = 2.0 * PI * static_cast<double>(i) / static_cast<double>(n);
+            m_cos[i] = std::cos(phase);
+            m_sin[i] = std::sin(phase);
+        }
+    }
+
+
+    /** Triangular filters on the HTK mel scale, as torchaudio.functional.melscale_fbanks with norm=None */
+    void init_mel_filterbank() {
+        auto mel_min = hz_to_mel(m_config.f_min);
+        auto mel_max = hz_to_mel(m_config.get_f_max());
+
+        std::vector<double> corners(m_num_mels + 2);
+        for (std::size_t i = 0; i < corners.size(); ++i) {
+            auto mel = mel_min + (mel_max - mel_min) * static_cast<double>(i) / static_cast<double>(m_num_mels + 1);
+            corners[i] = mel_to_hz(mel);
+        }
+
+        m_filterbank.assign(m_num_mels * m_num_bins, 0.0);
+        m_filter_start.assign(m_num_mels, m_num_bins);
+        m_filter_end.assign(m_num_mels, 0);
+
+        for (std::size_t m = 0; m < m_num_mels; ++m) {
+            for (std::size_t k = 0; k < m_num_bins; ++k) {
+                auto hz = m_config.sample_rate / 2.0 * static_cast<double>(k) / static_cast<double>(m_num_bins - 1);
+                auto down = (hz - corners[m]) / (corners[m + 1] - corners[m]);
+                auto up = (corners[m + 2] - hz) / (corners[m + 2] - corners[m + 1]);
+                auto weight = std::max(0.0, std::min(down, up));
+
+                if (weight > 0.0) {
+                    m_filterbank[m * m_num_bins + k] = weight;
+                    m_filter_start[m] = std::min(m_filter_start[m], k);
+                    m_filter_end[m] = k + 1;
+                }
+            }
+        }
+    }
+
+
+    /** In place on bit-reversed input */
+    void fft() {
+        auto n = m_real.size();
+        for (std::size_t size = 2; size <= n; size *= 2) {
+            auto half = size / 2;
+            auto stride = n / size;
+
+            for (std::size_t start = 0; start < n; start += size) {
+                for (std::size_t k = 0; k < half; ++k) {
+                    auto wr = m_cos[k * stride];
+                    auto wi = -m_sin[k * stride];
+                    auto a = start + k;
+                    auto b = a + half;
+
+                    auto tr = wr * m_real[b] - wi * m_imag[b];
+                    auto ti = wr * m_imag[b] + wi * m_real[b];
+                    m_real[b] = m_real[a] - tr;
+                    m_imag[b] = m_imag[a] - ti;
+                    m_real[a] += tr;
+                    m_imag[a] += ti;
+                }
+            }
+        }
+    }
+
+
+    FeatureConfig m_config;
+    std::size_t m_num_bins = 0;
+    std::size_t m_num_mels = 0;
+
+    std::vector<double> m_window;
+    std::vector<std::size_t> m_bit_reversed;
+    std::vector<double> m_cos;
+    std::vector<double> m_sin;
+
+    // [mels, bins], with the range of non-zero weights of each filter
+    std::vector<double> m_filterbank;
+    std::vector<std::size_t> m_filter_start;
+    std::vector<std::size_t> m_filter_end;
+
+    // scratch
+    std::vector<double> m_real;
+    std::vector<double> m_imag;
+    std::vector<double> m_spectrum;
+};
+
+
+// ==============================================================================================
+
+/**
+ * Features of the latest window of one stream, updated incrementally: frames are computed on a fixed grid of
+ * `hop_length` samples from the start of the stream, so that a frame shared by consecutive windows is only computed
+ * once, and kept in a ring of the latest `frames_per_window()` frames.
+ *
+ * As windows end anywhere on this grid, the features describe the latest complete frames, which end up to
+ * `hop_length - 1` samples before the window does. Not thread-safe, like WindowStream.
+ */
+class FeatureCache {
+public:
+    /** @throws std::invalid_argument if `config` is invalid or `segment_length` is shorter than one frame */
+    FeatureCache(const FeatureConfig& config, std::size_t segment_length)
+            : m_front_end(config)
+              , m_segment_length(segment_length)
+              , m_num_frames(config.frames_per_window(segment_length))
+              , m_num_mels(static_cast<std::size_t>(config.n_mels)) {
+        if (m_num_frames == 0) {
+            throw std::invalid_argument("feature config: n_fft is longer than the model's segment length");
+        }
+
+        // mirrored, so that the latest frames are always contiguous
+        m_frames.assign(2 * m_num_frames * m_num_mels, 0.0f);
+    }
+
+
+    /** The next update() starts a new stream */
+    void reset() {
+        m_is_reset = true;
+    }
+
+
+    /**
+     * Computes the frames completed by the latest `num_new` samples of `window`.
+     * Starts a new stream from the entire window after a reset(), if `num_new` covers the entire window (e.g. after a
+     * gap in the stream), or if some of the pending frames would start before the window.
+     * @param window `segment_length` samples, the latest `num_new` of which haven't been passed before
+     */
+    void update(const float* window, std::size_t num_new) {
+        const auto hop = static_cast<std::size_t>(m_front_end.get_config().hop_length);
+        const auto fft_size = static_cast<std::size_t>(m_front_end.get_config().n_fft);
+
+        if (m_is_reset || num_new >= m_segment_length
+            || m_num_samples + num_new > m_segment_length + m_next_frame * hop) {
+            m_is_reset = false;
+            m_num_samples = 0;
+            m_next_frame = 0;
+            m_num_computed = 0;
+            num_new = m_segment_length;
+        }
+
+        m_num_samples += num_new;
+
+        while (m_next_frame * hop + fft_size <= m_num_samples) {
+            auto distance_to_end = m_num_samples - m_next_frame * hop;
+            auto slot = m_next_frame % m_num_frames;
+            float* frame = &m_frames[slot * m_num_mels];
+
+            m_front_end.compute_frame(window + (m_segment_length - distance_to_end), frame);
+            std::copy(frame, frame + m_num_mels, frame + m_num_frames * m_num_mels);
+
+            ++m_next_frame;
+            ++m_num_computed;
+        }
+    }
+
+
+    /** @returns the latest `num_frames() * num_mels()` features, oldest frame first, valid until the next update() */
+    const float* data() const {
+        return &m_frames[(m_next_frame % m_num_frames) * m_num_mels];
+    }
+
+
+    std::size_t size() const {
+        return m_num_frames * m_num_mels;
+    }
+
+
+    std::size_t num_frames() const {
+        return m_num_frames;
+    }
+
+
+    std::size_t num_mels() const {
+        return m_num_mels;
+    }
+
+
+    /** Number of frames computed since the start of the current stream */
+    std::size_t num_computed() const {
+        return m_num_computed;
+    }
+
+
+private:
+    SpectralFrontEnd m_front_end;
+    std::size_t m_segment_length;
+    std::size_t m_num_frames;
+    std::size_t m_num_mels;
+
+    std::vector<float> m_frames;
+
+    bool m_is_reset = true;
+    std::size_t m_num_samples = 0;   // since the start of the stream
+    std::size_t m_next_frame = 0;    // index of the next frame to compute, since the start of the stream
+    std::size_t m_num_computed = 0;
+};
+
+#endif //IPT_MAX_FEATURE_FRONTEND_H
@@ -0,0 +1,362 @@
+#ifndef IPT_MAX_INFERENCE_BATCHER_H
+#define IPT_MAX_INFERENCE_BATCHER_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+#include "model.h"
+#include "window_pool.h"
+
+
+/**
+ * Collects windows submitted from any number of threads / streams and classifies them in batches with one shared,
+ * read-only Model. A batch is run as soon as `max_batch_size` windows are pending, or when the deadline of any
+ * pending window is reached (by default `max_delay` after its submission), or on `flush()`. Results are handed back
+ * to each submitter through its own callback, called from one of the batcher's worker threads.
+ *
+ * Windows submitted from a WindowPool are copied straight from the pool into each worker's preallocated batch, so
+ * that neither the submitter nor the workers allocate in the steady state (outside of libtorch's forward pass).
+ */
+class InferenceBatcher {
+public:
+    using ResultCallback = std::function<void(ClassificationResult&&)>;
+    using ErrorCallback = std::function<void(std::exception_ptr)>;
+
+    struct Config {
+        std::size_t max_batch_size = 16;
+        std::chrono::microseconds max_delay{5000};
+
+        // submit() blocks when this many windows are waiting, to bound memory when producers outpace the model
+        std::size_t max_pending = 1024;
+
+        // number of threads running forward passes concurrently on the shared model
+        int num_workers = 1;
+
+        // intra-op threads used by each forward pass, or 0 for libtorch's default
+        int num_threads = 0;
+    };
+
+
+    explicit InferenceBatcher(std::shared_ptr<Model> model) : InferenceBatcher(std::move(model), Config{}) {}
+
+    InferenceBatcher(std::shared_ptr<Model> model, Config config)
+            : m_model(std::move(model))
+              , m_config(sanitize(config))
+              , m_window_length(static_cast<std::size_t>(m_model->get_segment_length()))
+              , m_pending(m_config.max_pending) {
+        for (int i = 0; i < m_config.num_workers; ++i) {
+            m_workers.emplace_back(&InferenceBatcher::worker_loop, this);
+        }
+    }
+
+
+    /** Classifies all pending windows before returning */
+    ~InferenceBatcher() {
+        {
+            std::lock_guard lock{m_mutex};
+            m_stopped = true;
+        }
+        m_pending_changed.notify_all();
+
+        for (auto& worker: m_workers) {
+            worker.join();
+        }
+    }
+
+    InferenceBatcher(const InferenceBatcher&) = delete;
+    InferenceBatcher& operator=(const InferenceBatcher&) = delete;
+
+
+    /**
+     * @param window must be exactly `get_model().get_segment_length()` samples long
+     * @note Blocks while `max_pending` windows are already waiting. Never call from the audio thread
+     * @throws std::invalid_argument if `window` has another length
+     */
+    void submit(std::vector<float> window, ResultCallback on_result, ErrorCallback on_error = {}) {
+        submit(std::move(window)
+               , std::chrono::steady_clock::now() + m_config.max_delay
+               , std::move(on_result)
+               , std::move(on_error));
+    }
+
+
+    /**
+     * Same as above, with a deadline specific to this window, e.g. for submitters with different latency requirements
+     * sharing one batcher. The batch containing the window is started no later than `deadline`
+     */
+    void submit(std::vector<float> window
+                , std::chrono::steady_clock::time_point deadline
+                , ResultCallback on_result
+                , ErrorCallback on_error = {}) {
+        if (window.size() != m_window_length) {
+            throw std::invalid_argument("window length does not match the model's segment length");
+        }
+
+        Request request;
+        request.window = std::move(window);
+        request.on_result = std::move(on_result);
+        request.on_error = std::move(on_error);
+        push(std::move(request), deadline);
+    }
+
+
+    /**
+     * Submits the window in `slot` of `pool`, which the caller has acquired and filled in place, without allocating.
+     * The pool's handler is called with `slot` from a worker thread, after which the slot is released to the pool
+     * @note Blocks while `max_pending` windows are already waiting. Never call from the audio thread
+     * @throws std::invalid_argument if the pool's windows aren't `get_model().get_segment_length()` samples long
+     */
+    void submit(const std::shared_ptr<WindowPool>& pool
+                , std::size_t slot
+                , std::chrono::steady_clock::time_point deadline) {
+        if (pool->get_window_length() != m_window_length) {
+            throw std::invalid_argument("window length does not match the model's segment length");
+        }
+
+        Request request;
+        request.pool = pool;
+        request.slot = slot;
+        push(std::move(request), deadline);
+    }
+
+
+    /** @throws c10::Error through the future if classification fails */
+    std::future<ClassificationResult> submit(std::vector<float> window) {
+        auto promise = std::make_shared<std::promise<ClassificationResult>>();
+        auto future = promise->get_future();
+
+        submit(std::move(window)
+               , [promise](ClassificationResult&& result) { promise->set_value(std::move(result)); }
+               , [promise](std::exception_ptr e) { promise->set_exception(e); });
+
+        return future;
+    }
+
+
+    /**
+     * Runs the windows pending at the time of the call immediately rather than waiting for a full batch or the
+     * deadline. Windows submitted afterwards are batched as usual
+     */
+    void flush() {
+        {
+            std::lock_guard lock{m_mutex};
+            m_flush_sequence = m_next_sequence;
+        }
+        m_pending_changed.notify_all();
+    }
+
+
+    const Model& get_model() const {
+        return *m_model;
+    }
+
+
+    std::size_t get_num_batches() const {
+        return m_num_batches;
+    }
+
+
+    std::size_t get_num_windows() const {
+        return m_num_windows;
+    }
+
+
+private:
+    /** Window submitted either as a vector with its own callbacks, or as a slot of a WindowPool */
+    struct Request {
+        std::vector<float> window;
+        ResultCallback on_result;
+        ErrorCallback on_error;
+
+        std::shared_ptr<WindowPool> pool;
+        std::size_t slot = 0;
+
+        std::chrono::steady_clock::time_point deadline;
+        std::uint64_t sequence = 0;
+
+
+        const float* samples() const {
+            return pool ? pool->window(slot) : window.data();
+        }
+
+
+        void on_success(const ClassificationResult& result) {
+            if (pool) {
+                pool->on_result(slot, result);
+                pool->release(slot);
+            } else if (on_result) {
+                on_result(ClassificationResult{result});
+            }
+        }
+
+
+        void on_failure(std::exception_ptr error) {
+            if (pool) {
+                pool->on_error(slot, error);
+                pool->release(slot);
+            } else if (on_error) {
+                on_error(error);
+            }
+        }
+    };
+
+
+    static Config sanitize(Config config) {
+        config.max_batch_size = std::max<std::size_t>(1, config.max_batch_size);
+        config.max_pending = std::max(config.max_pending, config.max_batch_size);
+        config.num_workers = std::max(1, config.num_workers);
+        return config;
+    }
+
+
+    void push(Request&& request, std::chrono::steady_clock::time_point deadline) {
+        std::unique_lock lock{m_mutex};
+        m_not_full.wait(lock, [this] { return m_num_pending < m_config.max_pending; });
+
+        request.deadline = deadline;
+        request.sequence = m_next_sequence++;
+        m_pending[(m_pending_front + m_num_pending) % m_pending.size()] = std::move(request);
+        m_num_pending += 1;
+
+        m_earliest_deadline = std::min(m_earliest_deadline, deadline);
+        lock.unlock();
+
+        // Note: notifying all workers, as the new window may advance the deadline one of them is waiting for
+        m_pending_changed.notify_all();
+    }
+
+
+    /** Moves the oldest pending request to the back of `batch`. Must be called with the lock held */
+    void pop_front_into(std::vector<Request>& batch) {
+        batch.push_back(std::move(m_pending[m_pending_front]));
+        m_pending_front = (m_pending_front + 1) % m_pending.size();
+        m_num_pending -= 1;
+    }
+
+
+    bool is_batch_due(std::chrono::steady_clock::time_point now) const {
+        return m_num_pending >= m_config.max_batch_size
+               || (m_num_pending > 0 && (m_stopped || is_flush_requested() || now >= m_earliest_deadline));
+    }
+
+
+    /** True while the oldest pending window was submitted before the last call to `flush()` */
+    bool is_flush_requested() const {
+        return m_pending[m_pending_front].sequence < m_flush_sequence;
+    }
+
+
+    void update_earliest_deadline() {
+        m_earliest_deadline = std::chrono::steady_clock::time_point::max();
+        for (std::size_t i = 0; i < m_num_pending; ++i) {
+            m_earliest_deadline = std::min(m_earliest_deadline
+                                           , m_pending[(m_pending_front + i) % m_pending.size()].deadline);
+        }
+    }
+
+
+    void worker_loop() {
+        at::init_num_threads();
+        Model::set_num_threads(m_config.num_threads);
+
+        // reused for every batch of this worker: the requests, their windows packed contiguously, and the results
+        std::vector<Request> batch;
+        batch.reserve(m_config.max_batch_size);
+        std::vector<float> inputs(m_config.max_batch_size * m_window_length);
+        Model::Workspace workspace;
+        workspace.results.resize(m_config.max_batch_size);
+
+        std::unique_lock lock{m_mutex};
+
+        while (true) {
+            auto now = std::chrono::steady_clock::now();
+            while (!is_batch_due(now) && !(m_stopped && m_num_pending == 0)) {
+                if (m_num_pending == 0) {
+                    m_pending_changed.wait(lock);
+                } else {
+                    m_pending_changed.wait_until(lock, m_earliest_deadline);
+                }
+                now = std::chrono::steady_clock::now();
+            }
+
+            if (m_num_pending == 0) {
+                return; // stopped and fully drained
+            }
+
+            auto batch_size = std::min(m_config.max_batch_size, m_num_pending);
+            for (std::size_t i = 0; i < batch_size; ++i) {
+                pop_front_into(batch);
+            }
+
+            update_earliest_deadline();
+
+            lock.unlock();
+            m_not_full.notify_all();
+
+            run_batch(batch, inputs, workspace);
+            batch.clear(); // releases the requests' pools and callbacks outside of the lock
+
+            lock.lock();
+        }
+    }
+
+
+    /** Packs the windows of `batch` into `inputs` and classifies them in a single forward pass */
+    void run_batch(std::vector<Request>& batch, std::vector<float>& inputs, Model::Workspace& workspace) {
+        for (std::size_t i = 0; i < batch.size(); ++i) {
+            std::copy_n(batch[i].samples(), m_window_length, inputs.data() + i * m_window_length);
+        }
+
+        try {
+            m_model->classify(inputs.data(), batch.size(), m_window_length, workspace);
+        } catch (...) {
+            auto error = std::current_exception();
+            for (auto& request: batch) {
+                request.on_failure(error);
+            }
+            return;
+        }
+
+        m_num_batches += 1;
+        m_num_windows += batch.size();
+
+        for (std::size_t i = 0; i < batch.size(); ++i) {
+            batch[i].on_success(workspace.results[i]);
+        }
+    }
+
+
+    std::shared_ptr<Model> m_model;
+    Config m_config;
+    std::size_t m_window_length;
+
+    // ring of `max_pending` requests, of which `m_num_pending` from `m_pending_front` on are waiting
+    std::vector<Request> m_pending;
+    std::size_t m_pending_front = 0;
+    std::size_t m_num_pending = 0;
+    std::chrono::steady_clock::time_point m_earliest_deadline = std::chrono::steady_clock::time_point::max();
+    bool m_stopped = false;
+    std::uint64_t m_next_sequence = 0;
+    std::uint64_t m_flush_sequence = 0;
+
+    std::atomic<std::size_t> m_num_batches{0};
+    std::atomic<std::size_t> m_num_windows{0};
+
+    std::mutex m_mutex;
+    std::condition_variable m_pending_changed;
+    std::condition_variable m_not_full;
+
+    std::vector<std::thread> m_workers;
+};
+
+#endif //IPT_MAX_INFERENCE_BATCHER_H
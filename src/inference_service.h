@@ -0,0 +1,65 @@
+#ifndef IPT_MAX_INFERENCE_SERVICE_H
+#define IPT_MAX_INFERENCE_SERVICE_H
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include "inference_batcher.h"
+#include "model.h"
+
+
+/**
+ * Process-wide InferenceBatcher per shared model, so that all instances running the same model
+ * (see ModelRegistry) submit their windows to a single batcher rather than each running its own forward passes.
+ *
+ * Like ModelRegistry, only weak references are kept: a batcher is stopped when its last user releases it.
+ */
+class InferenceService {
+public:
+    static constexpr std::size_t DEFAULT_MAX_BATCH_SIZE = 64;
+    static const inline std::chrono::microseconds DEFAULT_DEADLINE{5000};
+
+    static InferenceService& instance() {
+        static InferenceService service;
+        return service;
+    }
+
+    InferenceService(const InferenceService&) = delete;
+    InferenceService& operator=(const InferenceService&) = delete;
+
+
+    /** @returns the batcher of `model`, created with `config` if there is none yet (otherwise `config` is ignored) */
+    std::shared_ptr<InferenceBatcher> acquire(const std::shared_ptr<Model>& model, InferenceBatcher::Config config) {
+        std::lock_guard lock{m_mutex};
+
+        for (auto it = m_batchers.begin(); it != m_batchers.end();) {
+            it = it->second.expired() ? m_batchers.erase(it) : std::next(it);
+        }
+
+        if (auto batcher = m_batchers[model.get()].lock()) {
+            return batcher;
+        }
+
+        auto batcher = std::make_shared<InferenceBatcher>(model, config);
+        m_batchers[model.get()] = batcher;
+        return batcher;
+    }
+
+
+    std::shared_ptr<InferenceBatcher> acquire(const std::shared_ptr<Model>& model) {
+        InferenceBatcher::Config config;
+        config.max_batch_size = DEFAULT_MAX_BATCH_SIZE;
+        config.max_delay = DEFAULT_DEADLINE;
+        return acquire(model, config);
+    }
+
+
+private:
+    InferenceService() = default;
+
+    // Note: a batcher holds a strong reference to its model, so the key cannot dangle while the batcher is alive
+    std::map<const Model*, std::weak_ptr<InferenceBatcher>> m_batchers;
+    std::mutex m_mutex;
+};
+
+#endif //IPT_MAX_INFERENCE_SERVICE_H
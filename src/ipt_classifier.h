@@ -5,163 +5,505 @@
 #include <torch/script.h>
 #include <torch/torch.h>
 #include <chrono>
-#include "circular_buffer.h"
+#include <numeric>
 #include "utility.h"
 #include "model.h"
-#include "energy_threshold.h"
+#include "latency_stats.h"
+#include "model_registry.h"
+#include "feature_frontend.h"
+#include "window_stream.h"
 
 
+/** Window returned by the offline path, with its position in the input stream */
+struct ClassificationWindow {
+    std::vector<float> samples;
+
+    // number of input samples (at the input sample rate) received when the window was acquired,
+    // i.e. the position just after the last input sample contributing to the window
+    std::size_t end_sample;
+
+    // input channel of the window, in the multichannel path
+    std::size_t channel = 0;
+};
+
+
+/** Result of the multichannel path, with the index of the input channel it was classified from */
+struct ChannelResult {
+    std::size_t channel;
+    ClassificationResult result;
+
+    // number of samples received on the channel up to and including the last sample of the window
+    std::size_t end_sample = 0;
+};
+
+
+// ==============================================================================================
+
 class IptClassifier {
 public:
     static const inline std::string CLASSIFY_METHOD = "forward";
-    static const int DEFAULT_THRESHOLD_WINDOW_MS = 20;
+    static const int DEFAULT_THRESHOLD_WINDOW_MS = WindowStream::DEFAULT_THRESHOLD_WINDOW_MS;
+    static const int DEFAULT_HOP_MS = WindowStream::DEFAULT_HOP_MS;
+    static const int DEFAULT_WARM_UP_PASSES = 3;
 
     explicit IptClassifier(std::string path
                            , torch::DeviceType device
                            , double energy_threshold_db = EnergyThreshold::MINIMUM_THRESHOLD
-                           , int threshold_window_ms = DEFAULT_THRESHOLD_WINDOW_MS)
+                           , int threshold_window_ms = DEFAULT_THRESHOLD_WINDOW_MS
+                           , std::size_t num_channels = 1)
             : m_model_path(std::move(path))
-            , m_device(device)
-            , m_energy_threshold(energy_threshold_db)
-            , m_threshold_window_ms(threshold_window_ms) {}
+            , m_device(device) {
+        num_channels = std::max<std::size_t>(1, num_channels);
+        m_streams.reserve(num_channels);
+        for (std::size_t c = 0; c < num_channels; ++c) {
+            m_streams.emplace_back(energy_threshold_db, threshold_window_ms);
+            m_streams.back().set_stats(&m_stats);
+        }
+    }
 
     /**
+     * Loads the model, or shares the instance already loaded by another classifier with the same path and device.
      * @note Make sure to call this on the thread that will call `process()`
      * @throws c10::Error if model cannot be loaded
      * */
     void initialize_model() {
+        // the model may have been loaded on another thread: initialize this thread's intra-op pool as well
+        at::init_num_threads();
+
+        auto model = ModelRegistry::instance().acquire(m_model_path, m_device, get_model_options());
+
         std::lock_guard lock{m_mutex};
-        m_model = std::make_unique<Model>(m_model_path, m_device);
+        m_model = std::move(model);
 
         m_initialized = is_initialized();
     }
 
 
-    /** @note: should typically be called when dsp is started / restarted */
+    /**
+     * Warms up the current model for the batch sizes used by process(), from a single window to one window per
+     * channel, and for the shared batch size, if any (see set_shared_batch_size()).
+     * @note Does not block process() while running
+     * @returns the warm-up time in milliseconds, 0 if no model is loaded
+     * @throws c10::Error if classification fails
+     */
+    double warm_up(int num_passes = DEFAULT_WARM_UP_PASSES) {
+        auto model = get_model();
+        if (!model) {
+            return 0.0;
+        }
+        return model->warm_up(get_batch_sizes(), num_passes, get_stream_chunk_length(*model));
+    }
+
+
+    /**
+     * Warms up the current model for the shared batch size only, unless it already has been (see
+     * set_shared_batch_size()). Used when shared inference is enabled after the model has been warmed up
+     * @note Does not block process() while running
+     * @returns the warm-up time in milliseconds, 0 if there was nothing to warm up
+     * @throws c10::Error if classification fails
+     */
+    double warm_up_shared(int num_passes = DEFAULT_WARM_UP_PASSES) {
+        auto model = get_model();
+        std::size_t batch_size;
+        {
+            std::lock_guard lock{m_mutex};
+            batch_size = m_shared_batch_size;
+        }
+
+        if (!model || batch_size == 0 || model->is_warmed_up(batch_size)) {
+            return 0.0;
+        }
+        return model->warm_up({batch_size}, std::max(1, num_passes));
+    }
+
+
+    /**
+     * Loads another model (or acquires it from the registry) and warms it up, without blocking process(), which keeps
+     * classifying with the current model in the meantime. Use set_model() to switch to it.
+     * @note May be called from any thread
+     * @param warm_up_ms if provided, set to the warm-up time in milliseconds
+     * @throws c10::Error if model cannot be loaded or run
+     */
+    std::shared_ptr<Model> load_model(const std::string& path
+                                      , int num_warm_up_passes = DEFAULT_WARM_UP_PASSES
+                                      , double* warm_up_ms = nullptr) const {
+        at::init_num_threads();
+
+        auto model = ModelRegistry::instance().acquire(path, m_device, get_model_options());
+
+        // at least one pass, to make sure the model can run before it replaces the current one
+        auto ms = model->warm_up(get_batch_sizes(), std::max(1, num_warm_up_passes), get_stream_chunk_length(*model));
+        if (warm_up_ms) {
+            *warm_up_ms = ms;
+        }
+
+        return model;
+    }
+
+
+    /**
+     * Switches to another model between two calls to process(), i.e. at a hop boundary. The classification buffers
+     * are only rebuilt if the model's sample rate or segment length differs from the current one.
+     */
+    void set_model(std::shared_ptr<Model> model) {
+        assert(model);
+
+        std::lock_guard lock{m_mutex};
+        for (auto& stream: m_streams) {
+            stream.set_model_format(model->get_sample_rate(), model->get_segment_length());
+        }
+        m_model = std::move(model);
+        prepare_buffers();
+        reset_stream_states();
+
+        m_initialized = is_initialized();
+    }
+
+
+    /**
+     * Allocates the streams' buffers and the scratch buffers of process() for one window per channel, so that the
+     * steady state of process() doesn't allocate outside of libtorch.
+     * @note: should typically be called when dsp is started / restarted
+     */
     void initialize_buffers(int sr, int input_vector_length) {
         assert(m_model);
 
         std::lock_guard lock{m_mutex};
-        m_input_sr = sr;
-        m_threshold_buffer = std::make_unique<CircularBuffer<double>>(m_threshold_window_ms, sr);
+        for (auto& stream: m_streams) {
+            stream.initialize(sr, input_vector_length, m_model->get_sample_rate(), m_model->get_segment_length());
+        }
+        prepare_buffers();
+        reset_stream_states();
 
-        m_classification_buffer = std::make_unique<ResamplingBuffer>(m_model->get_segment_length()
-                                                                     , input_vector_length
-                                                                     , sr
-                                                                     , m_model->get_sample_rate());
+        m_initialized = is_initialized();
+    }
 
-        // TODO: Remove
-//        m_classification_buffer = std::make_unique<CircularBuffer<double>>(m_model->get_segment_length());
 
-        m_initialized = is_initialized();
+    /**
+     * Adds the input to the internal buffers and classifies the current window once for every hop of new audio.
+     * If the input spans several hops (e.g. when the caller has fallen behind), each due hop is classified in order.
+     * @returns one result per classified hop, possibly empty
+     * @throws c10::Error if classification fails
+     */
+    std::vector<ClassificationResult> process(std::vector<double>&& input) {
+        return process(input.data(), input.size());
     }
 
 
-    /** @throws c10::Error if classification fails */
-    std::optional<ClassificationResult> process(std::vector<double>&& input) {
+    /** Single channel path: classifies the first channel only.
+     *  @throws c10::Error if classification fails */
+    std::vector<ClassificationResult> process(const double* input, std::size_t num_samples) {
         // Note: using a mutex here is completely safe, as this is never called from the audio thread
         std::lock_guard lock{m_mutex};
 
         if (!m_initialized) {
-            return std::nullopt;
+            return {};
         }
 
-        m_threshold_buffer->add_samples(input);
-        m_classification_buffer->add_samples(input);
+        std::vector<ClassificationResult> results;
+        m_streams.front().for_each_due_window(input, num_samples, [this, &results](const float* window
+                                                                                   , std::size_t length) {
+            results.emplace_back(m_model->classify(window, length));
+        });
+
+        return results;
+    }
+
+
+    /**
+     * Multichannel path: same as process() for each channel, with independent windowing and gating per channel,
+     * but all due windows of all channels are classified together in a single batched forward pass.
+     * With a streaming model (see set_streaming()), each window is classified on its own instead, from its new samples
+     * only. With a feature front end (see set_features()), the batch holds each window's cached features instead.
+     * @param inputs `num_inputs` pointers to `num_samples` samples each. Inputs beyond `get_num_channels()` are ignored
+     * @returns one result per classified hop and channel, ordered by channel, possibly empty
+     * @throws c10::Error if classification fails
+     */
+    std::vector<ChannelResult> process(const double* const* inputs, std::size_t num_inputs, std::size_t num_samples) {
+        std::vector<ChannelResult> channel_results;
+        process(inputs, num_inputs, num_samples, [&channel_results](std::size_t channel
+                                                                    , std::size_t end_sample
+                                                                    , const ClassificationResult& result) {
+            channel_results.push_back(ChannelResult{channel, result, end_sample});
+        });
+        return channel_results;
+    }
+
 
-        if (!m_classification_buffer->is_fully_allocated()) {
-            return std::nullopt;
+    /**
+     * Same as above, calling `on_result(std::size_t channel, std::size_t end_sample, const ClassificationResult&)` for
+     * each result instead, with a reference into preallocated storage that is only valid during the call.
+     * `end_sample` is the number of samples received on the channel up to and including the window's last sample.
+     * As long as there is at most one due window per channel, this doesn't allocate outside of libtorch's forward pass
+     * (see initialize_buffers())
+     * @throws c10::Error if classification fails
+     */
+    template<typename Callback>
+    void process(const double* const* inputs, std::size_t num_inputs, std::size_t num_samples, Callback&& on_result) {
+        std::lock_guard lock{m_mutex};
+
+        if (!m_initialized) {
+            return;
         }
 
+        if (m_streaming && m_model->supports_streaming()) {
+            process_streaming(inputs, num_inputs, num_samples, on_result);
+            return;
+        }
 
-        if (m_active) {
-            auto samples = m_classification_buffer->get_samples();
+        m_batch.clear();
+        m_batch_channels.clear();
+        m_batch_end_samples.clear();
+
+        const bool use_features = m_use_features && !m_feature_caches.empty();
+
+        auto num_channels = std::min(num_inputs, m_streams.size());
+        for (std::size_t c = 0; c < num_channels; ++c) {
+            auto& stream = m_streams[c];
+            stream.for_each_due_window(inputs[c], num_samples, [this, c, &stream, use_features](const float* window
+                                                                                                , std::size_t length) {
+                auto t1 = LatencyHistogram::Clock::now();
+                if (use_features) {
+                    auto& cache = m_feature_caches[c];
+                    cache.update(window, stream.samples_since_window());
+                    auto t2 = LatencyHistogram::Clock::now();
+                    m_stats[Stage::features].record(t1, t2);
+
+                    t1 = t2;
+                    m_batch.insert(m_batch.end(), cache.data(), cache.data() + cache.size());
+                } else {
+                    m_batch.insert(m_batch.end(), window, window + length);
+                }
+                m_batch_channels.push_back(c);
+                m_batch_end_samples.push_back(stream.samples_received());
+                m_stats[Stage::window].record(t1, LatencyHistogram::Clock::now());
+            });
+        }
 
-            if (m_energy_threshold.is_above_threshold(samples)) {
-                return m_model->classify(util::to_floats(samples));
-            } else {
-                m_active = false;
-            }
+        if (m_batch_channels.empty()) {
+            return;
+        }
+
+        auto batch_size = m_batch_channels.size();
+        if (use_features) {
+            m_model->classify_features(m_batch.data(), batch_size, m_workspace);
         } else {
-            if (m_energy_threshold.is_above_threshold(m_threshold_buffer->samples_unordered())) {
-                m_active = true;
+            m_model->classify(m_batch.data(), batch_size, m_batch.size() / batch_size, m_workspace);
+        }
+        m_stats[Stage::forward].record(m_workspace.forward_time);
+        m_stats[Stage::softmax].record(m_workspace.output_time);
 
-                auto samples = m_classification_buffer->get_samples();
-                return m_model->classify(util::to_floats(samples));
-            }
+        for (std::size_t i = 0; i < batch_size; ++i) {
+            on_result(m_batch_channels[i], m_batch_end_samples[i], m_workspace.results[i]);
         }
+    }
 
-        /* Note: The conditions for activation and deactivation are different:
-         *   - activation: one energy threshold window is above silence,
-         *   - deactivation: one entire inference window is below threshold
-         *   we might therefore have some edge cases where an entire window is below threshold but still classified.
-         *   This is for the moment intentional by design, but might after experimenting need a rework at a later stage
-         */
 
-        return std::nullopt;
+    /** Offline batched path: same windowing, hop and energy gating as process() on the first channel,
+     *  but returns the windows to classify instead of running the model,
+     *  so the caller can collect windows and classify() them all in a single forward pass.
+     *  @returns one resampled window (get_segment_length() floats) per classified hop, possibly empty */
+    std::vector<ClassificationWindow> acquire_window(std::vector<double>&& input) {
+        return acquire_window(input.data(), input.size());
     }
 
 
-    /** Offline batched path: same windowing and energy gating as process(), 
-     *  but returns the window to classify instead of running the model, 
-     *  so the caller can collect windows and classify() them all in a single forward pass.
-     *  @returns the resampled window (get_segment_length() floats) or nullopt */
-    std::optional<std::vector<float>> acquire_window(std::vector<double>&& input) {
+    std::vector<ClassificationWindow> acquire_window(const double* input, std::size_t num_samples) {
         std::lock_guard lock{m_mutex};
 
         if (!m_initialized) {
-            return std::nullopt;
+            return {};
         }
 
-        m_threshold_buffer->add_samples(input);
-        m_classification_buffer->add_samples(input);
+        auto& stream = m_streams.front();
 
-        if (!m_classification_buffer->is_fully_allocated()) {
-            return std::nullopt;
-        }
+        std::vector<ClassificationWindow> windows;
+        stream.for_each_due_window(input, num_samples, [&stream, &windows](const float* window, std::size_t length) {
+            windows.push_back(ClassificationWindow{std::vector<float>(window, window + length)
+                                                   , stream.samples_received()});
+        });
 
-        if (m_active) {
-            auto samples = m_classification_buffer->get_samples();
-            if (m_energy_threshold.is_above_threshold(samples)) {
-                return util::to_floats(samples);
-            }
-            m_active = false;
-        } else if (m_energy_threshold.is_above_threshold(m_threshold_buffer->samples_unordered())) {
-            m_active = true;
-            return util::to_floats(m_classification_buffer->get_samples());
+        return windows;
+    }
+
+
+    /** Multichannel version of acquire_window(), with independent windowing and gating per channel,
+     *  e.g. to submit the windows of all channels to a shared InferenceBatcher rather than classifying them here.
+     *  Calls `on_window(channel, window, length, end_sample)` for each classified hop, ordered by channel, without
+     *  copying nor allocating: `window` is only valid for the duration of the call, see ClassificationWindow */
+    template<typename Callback>
+    void acquire_windows(const double* const* inputs
+                         , std::size_t num_inputs
+                         , std::size_t num_samples
+                         , Callback&& on_window) {
+        std::lock_guard lock{m_mutex};
+
+        if (!m_initialized) {
+            return;
         }
 
-        return std::nullopt;
+        auto num_channels = std::min(num_inputs, m_streams.size());
+        for (std::size_t c = 0; c < num_channels; ++c) {
+            auto& stream = m_streams[c];
+            stream.for_each_due_window(inputs[c], num_samples, [&stream, &on_window, c](const float* window
+                                                                                        , std::size_t length) {
+                on_window(c, window, length, stream.samples_received());
+            });
+        }
     }
 
 
     /** Batched classification of windows from acquire_window(), in one forward pass.
+     *  @note Does not block process() / acquire_window() while the model runs, so that windowing and
+     *        inference can be pipelined on separate threads
      *  @throws c10::Error if classification fails */
     std::vector<ClassificationResult> classify(const std::vector<std::vector<float>>& windows) {
-        std::lock_guard lock{m_mutex};
-        if (!m_model || windows.empty()) {
+        std::shared_ptr<Model> model;
+        {
+            std::lock_guard lock{m_mutex};
+            model = m_model;
+        }
+
+        if (!model || windows.empty()) {
             return {};
         }
-        return m_model->classify(windows);
+        return model->classify(windows);
     }
 
 
     void set_energy_threshold(double threshold_db) {
         std::lock_guard lock{m_mutex};
-        m_energy_threshold.set_threshold_db(threshold_db);
+        for (auto& stream: m_streams) {
+            stream.set_energy_threshold(threshold_db);
+        }
     }
 
     void set_threshold_window(int duration_ms) {
         std::lock_guard lock{m_mutex};
+        for (auto& stream: m_streams) {
+            stream.set_threshold_window(duration_ms);
+        }
+    }
 
-        duration_ms = std::max(0, duration_ms);
-        m_threshold_window_ms = duration_ms;
+    /** @param duration_ms hop between two consecutive classifications, or 0 to classify once per input vector */
+    void set_hop(int duration_ms) {
+        std::lock_guard lock{m_mutex};
+        m_hop_ms = std::max(0, duration_ms);
+        for (auto& stream: m_streams) {
+            stream.set_hop(duration_ms);
+        }
+    }
+
+
+    /**
+     * Classify with the model's streaming method in the multichannel process(), if it has one (enabled by default).
+     * The model then only processes the new samples of each hop instead of the full window, carrying its state from
+     * one hop to the next for each channel. Models without the method, and all other paths, use the full window.
+     */
+    void set_streaming(bool enabled) {
+        std::lock_guard lock{m_mutex};
+        if (enabled != m_streaming) {
+            m_streaming = enabled;
+            reset_stream_states();
+        }
+    }
+
+
+    /** @returns true if process() currently uses the model's streaming method */
+    bool is_streaming() const {
+        std::lock_guard lock{m_mutex};
+        return m_streaming && m_model && m_model->supports_streaming();
+    }
+
+
+    /**
+     * Classify with the model's feature front end in the multichannel process(), if it has one (enabled by default).
+     * The spectral features of each channel are then computed incrementally, only for the frames completed by the new
+     * samples of each hop, and the model classifies the features instead of the raw window. A streaming model (see
+     * set_streaming()) takes precedence. Models without a front end, and all other paths, use the full window.
+     */
+    void set_features(bool enabled) {
+        std::lock_guard lock{m_mutex};
+        if (enabled != m_use_features) {
+            m_use_features = enabled;
+            reset_stream_states();
+        }
+    }
+
+
+    /** @returns true if process() currently classifies cached features, see set_features() */
+    bool is_using_features() const {
+        std::lock_guard lock{m_mutex};
+        return m_use_features && !m_feature_caches.empty() && !(m_streaming && m_model->supports_streaming());
+    }
 
-        if (m_initialized) {
-            m_threshold_buffer->resize(duration_ms, *m_input_sr);
+
+    /**
+     * Also warm up batches of `batch_size` windows, i.e. the largest batch of the shared InferenceBatcher the windows
+     * of acquire_windows() are submitted to, or 0 if they aren't. Applies to the next warm_up(), warm_up_shared() or
+     * load_model(). Smaller batches, which the batcher runs when the deadline expires first, are not warmed up, as
+     * that would take up to `batch_size` times as long
+     */
+    void set_shared_batch_size(std::size_t batch_size) {
+        std::lock_guard lock{m_mutex};
+        m_shared_batch_size = batch_size;
+    }
+
+
+    void set_resampling_quality(ResamplingQuality quality) {
+        std::lock_guard lock{m_mutex};
+        for (auto& stream: m_streams) {
+            stream.set_resampling_quality(quality);
         }
     }
 
+
+    /** Latency added by resampling the input to the model's sample rate, in ms */
+    double get_resampling_latency_ms() const {
+        std::lock_guard lock{m_mutex};
+        return m_streams.front().resampling_latency_ms();
+    }
+
+
+    std::size_t get_num_channels() const {
+        return m_streams.size();
+    }
+
+
+    /** Options of the models loaded by subsequent calls to initialize_model() and load_model() */
+    void set_model_options(Model::Options options) {
+        std::lock_guard lock{m_mutex};
+        m_model_options = options;
+    }
+
+
+    Model::Options get_model_options() const {
+        std::lock_guard lock{m_mutex};
+        return m_model_options;
+    }
+
+
+    /**
+     * Per-stage latency histograms of process(): resampling, gating, window, features, forward and softmax are recorded
+     * here, the other stages of `Stage` are left to the caller. Lock-free: may be read and recorded to from any thread
+     */
+    LatencyStats& get_stats() {
+        return m_stats;
+    }
+
+
+    const LatencyStats& get_stats() const {
+        return m_stats;
+    }
+
+
+    /** @returns the loaded model, e.g. to share it with an InferenceBatcher, or nullptr if not loaded */
+    std::shared_ptr<Model> get_model() {
+        std::lock_guard lock{m_mutex};
+        return m_model;
+    }
+
+
     std::optional<std::vector<std::string>> get_class_names() {
         std::lock_guard lock{m_mutex};
         if (m_model) {
@@ -172,32 +514,136 @@ public:
 
 
 private:
+    /** Any number of channels may be due and gated on at once, so process() may run every batch size up to one
+     *  window per channel. Each new size would otherwise be specialised by the profiling executor on its first run */
+    std::vector<std::size_t> get_batch_sizes() const {
+        std::lock_guard lock{m_mutex};
+
+        std::vector<std::size_t> batch_sizes(m_streams.size());
+        std::iota(batch_sizes.begin(), batch_sizes.end(), 1);
+        if (m_shared_batch_size > m_streams.size()) {
+            batch_sizes.push_back(m_shared_batch_size);
+        }
+        return batch_sizes;
+    }
+
+
+    /** Streaming path of process(): classifies each due window as soon as it is windowed, in order, from its new samples */
+    template<typename Callback>
+    void process_streaming(const double* const* inputs
+                           , std::size_t num_inputs
+                           , std::size_t num_samples
+                           , Callback& on_result) {
+        auto num_channels = std::min(num_inputs, m_streams.size());
+        for (std::size_t c = 0; c < num_channels; ++c) {
+            auto& stream = m_streams[c];
+            auto& state = m_stream_states[c];
+            stream.for_each_due_window(inputs[c], num_samples, [&](const float* window, std::size_t length) {
+                // a new stream, or a gap since the previous window: start over from the full window
+                auto num_new = stream.samples_since_window();
+                if (num_new >= length || state.is_reset()) {
+                    state.reset();
+                    num_new = length;
+                }
+
+                m_model->classify_stream(window + (length - num_new), num_new, state, m_workspace);
+                m_stats[Stage::forward].record(m_workspace.forward_time);
+                m_stats[Stage::softmax].record(m_workspace.output_time);
+
+                on_result(c, stream.samples_received(), m_workspace.results[0]);
+            });
+        }
+    }
+
+
+    /** Chunk length of the streaming warm-up: one hop at the model's rate, or none when classifying every vector */
+    std::size_t get_stream_chunk_length(const Model& model) const {
+        std::lock_guard lock{m_mutex};
+        if (!m_streaming || m_hop_ms <= 0) {
+            return 0;
+        }
+        return util::mstosamples(m_hop_ms, model.get_sample_rate());
+    }
+
+
+    /** @note: called with the lock held */
+    void reset_stream_states() {
+        m_stream_states.resize(m_streams.size());
+        for (auto& state: m_stream_states) {
+            state.reset();
+        }
+        for (auto& cache: m_feature_caches) {
+            cache.reset();
+        }
+    }
+
+
+    /** @note: called with the lock held */
+    void prepare_buffers() {
+        if (!m_model) {
+            return;
+        }
+
+        auto num_channels = m_streams.size();
+        auto segment_length = static_cast<std::size_t>(m_model->get_segment_length());
+        auto window_size = segment_length;
+
+        m_feature_caches.clear();
+        if (const auto& config = m_model->get_feature_config()) {
+            m_feature_caches.reserve(num_channels);
+            for (std::size_t c = 0; c < num_channels; ++c) {
+                m_feature_caches.emplace_back(*config, segment_length);
+            }
+            window_size = std::max(window_size, m_feature_caches.front().size());
+        }
+
+        m_batch.reserve(num_channels * window_size);
+        m_batch_channels.reserve(num_channels);
+        m_batch_end_samples.reserve(num_channels);
+        m_model->prepare(m_workspace, num_channels);
+    }
+
 
     /** @note: Defines invariant for class */
     bool is_initialized() const {
-        return m_model && m_classification_buffer && m_threshold_buffer && m_input_sr;
+        return m_model && std::all_of(m_streams.begin(), m_streams.end(), [](const WindowStream& stream) {
+            return stream.is_initialized();
+        });
     }
 
     // Initialization parameters
     std::string m_model_path;
     torch::DeviceType m_device;
-    int m_threshold_window_ms;
-    std::optional<int> m_sr;
-
-    EnergyThreshold m_energy_threshold;
+    Model::Options m_model_options;
 
     bool m_initialized = false;
 
-    std::unique_ptr<Model> m_model;
+    std::shared_ptr<Model> m_model;
+
+    // one stream per input channel, all sharing the same model
+    std::vector<WindowStream> m_streams;
+
+    // scratch buffers of the multichannel path, reused between calls: contiguous due windows, channels and end samples
+    std::vector<float> m_batch;
+    std::vector<std::size_t> m_batch_channels;
+    std::vector<std::size_t> m_batch_end_samples;
+    Model::Workspace m_workspace;
+
+    // largest batch of the shared InferenceBatcher, if any, see set_shared_batch_size()
+    std::size_t m_shared_batch_size = 0;
 
-    std::unique_ptr<ResamplingBuffer> m_classification_buffer;
-    std::unique_ptr<CircularBuffer<double>> m_threshold_buffer;
+    // state of the model's streaming method for each channel, see set_streaming()
+    bool m_streaming = true;
+    int m_hop_ms = DEFAULT_HOP_MS;
+    std::vector<Model::StreamState> m_stream_states;
 
-    std::optional<int> m_input_sr;
+    // spectral features of each channel's latest window, if the model has a front end, see set_features()
+    bool m_use_features = true;
+    std::vector<FeatureCache> m_feature_caches;
 
-    bool m_active = false;
+    LatencyStats m_stats;
 
-    std::mutex m_mutex;
+    mutable std::mutex m_mutex;
 };
 
 #endif //IPT_MAX_IPT_CLASSIFIER_H
@@ -0,0 +1,214 @@
+#ifndef IPT_MAX_LATENCY_STATS_H
+#define IPT_MAX_LATENCY_STATS_H
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+
+/**
+ * Fixed-bucket latency histogram that may be recorded to from any number of threads without locking.
+ *
+ * Durations are bucketed in nanoseconds: exactly below 16 ns, then in 8 sub-buckets per power of two, i.e. with a
+ * relative error of at most 12.5%, up to about 18 minutes. Percentiles are reported as the upper bound of their bucket.
+ */
+class LatencyHistogram {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    static constexpr int SUB_BUCKET_BITS = 3;
+    static constexpr std::uint64_t SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+    static constexpr std::uint64_t LINEAR_LIMIT = 2 * SUB_BUCKETS;
+    static constexpr int MAX_EXPONENT = 40;
+    static constexpr std::size_t NUM_BUCKETS = LINEAR_LIMIT + (MAX_EXPONENT - SUB_BUCKET_BITS - 1) * SUB_BUCKETS;
+
+    struct Summary {
+        std::uint64_t count = 0;
+        double mean_ms = 0.0;
+        double p50_ms = 0.0;
+        double p95_ms = 0.0;
+        double p99_ms = 0.0;
+        double max_ms = 0.0;
+    };
+
+
+    void record(std::chrono::nanoseconds duration) {
+        auto ns = static_cast<std::uint64_t>(std::max<std::int64_t>(0, duration.count()));
+
+        m_buckets[bucket_index(ns)].fetch_add(1, std::memory_order_relaxed);
+        m_sum_ns.fetch_add(ns, std::memory_order_relaxed);
+
+        auto max = m_max_ns.load(std::memory_order_relaxed);
+        while (ns > max && !m_max_ns.compare_exchange_weak(max, ns, std::memory_order_relaxed)) {}
+    }
+
+
+    void record(Clock::time_point start, Clock::time_point end) {
+        record(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start));
+    }
+
+
+    /** @note Not a consistent snapshot while other threads record, which may skew it by the few values in flight */
+    Summary summary() const {
+        std::array<std::uint64_t, NUM_BUCKETS> counts{};
+        std::uint64_t count = 0;
+        for (std::size_t i = 0; i < NUM_BUCKETS; ++i) {
+            counts[i] = m_buckets[i].load(std::memory_order_relaxed);
+            count += counts[i];
+        }
+
+        Summary summary;
+        if (count == 0) {
+            return summary;
+        }
+
+        auto max_ns = m_max_ns.load(std::memory_order_relaxed);
+        summary.count = count;
+        summary.mean_ms = to_ms(m_sum_ns.load(std::memory_order_relaxed)) / static_cast<double>(count);
+        summary.p50_ms = to_ms(std::min(max_ns, percentile(counts, count, 0.50)));
+        summary.p95_ms = to_ms(std::min(max_ns, percentile(counts, count, 0.95)));
+        summary.p99_ms = to_ms(std::min(max_ns, percentile(counts, count, 0.99)));
+        summary.max_ms = to_ms(max_ns);
+        return summary;
+    }
+
+
+    void reset() {
+        for (auto& bucket: m_buckets) {
+            bucket.store(0, std::memory_order_relaxed);
+        }
+        m_sum_ns.store(0, std::memory_order_relaxed);
+        m_max_ns.store(0, std::memory_order_relaxed);
+    }
+
+
+    static std::size_t bucket_index(std::uint64_t ns) {
+        if (ns < LINEAR_LIMIT) {
+            return static_cast<std::size_t>(ns);
+        }
+
+        int exponent = 0;
+        for (auto v = ns; v > 1; v >>= 1) {
+            ++exponent;
+        }
+
+        auto sub_bucket = (ns >> (exponent - SUB_BUCKET_BITS)) & (SUB_BUCKETS - 1);
+        auto octave = static_cast<std::uint64_t>(exponent - SUB_BUCKET_BITS - 1);
+        auto index = LINEAR_LIMIT + octave * SUB_BUCKETS + sub_bucket;
+        return static_cast<std::size_t>(std::min<std::uint64_t>(index, NUM_BUCKETS - 1));
+    }
+
+
+    /** Largest duration in nanoseconds that falls into bucket `index` */
+    static std::uint64_t bucket_upper_bound(std::size_t index) {
+        if (index < LINEAR_LIMIT) {
+            return index;
+        }
+
+        auto offset = static_cast<std::uint64_t>(index) - LINEAR_LIMIT;
+        auto shift = static_cast<int>(offset / SUB_BUCKETS) + 1;
+        auto lower = (SUB_BUCKETS + offset % SUB_BUCKETS) << shift;
+        return lower + (std::uint64_t{1} << shift) - 1;
+    }
+
+
+private:
+    static std::uint64_t percentile(const std::array<std::uint64_t, NUM_BUCKETS>& counts
+                                    , std::uint64_t count
+                                    , double p) {
+        auto rank = static_cast<std::uint64_t>(p * static_cast<double>(count - 1)) + 1;
+        std::uint64_t cumulative = 0;
+        for (std::size_t i = 0; i < NUM_BUCKETS; ++i) {
+            cumulative += counts[i];
+            if (cumulative >= rank) {
+                return bucket_upper_bound(i);
+            }
+        }
+        return bucket_upper_bound(NUM_BUCKETS - 1);
+    }
+
+
+    static double to_ms(std::uint64_t ns) {
+        return static_cast<double>(ns) / 1e6;
+    }
+
+
+    std::array<std::atomic<std::uint64_t>, NUM_BUCKETS> m_buckets{};
+    std::atomic<std::uint64_t> m_sum_ns{0};
+    std::atomic<std::uint64_t> m_max_ns{0};
+};
+
+
+// ==============================================================================================
+
+/** Stages of the real-time classification path, in pipeline order */
+enum class Stage {
+    fifo_wait          // from new audio being signalled by the audio thread to the processing thread draining it
+    , resampling       // resampling the input to the model's rate, per input vector and channel
+    , gating           // energy threshold buffer and gating decisions, per input vector and channel
+    , window           // copying the due windows of all channels into one batch
+    , features         // updating the spectral features of a window, for models with a feature front end
+    , forward          // the model's forward pass
+    , softmax          // softmax and copy of the output back to the caller
+    , integrator       // smoothing of one result by the leaky integrator
+    , delivery         // from a result being enqueued by the processing thread to it being sent on the outlets
+    , count
+};
+
+
+/** One LatencyHistogram per Stage, see LatencyHistogram for thread safety */
+class LatencyStats {
+public:
+    static constexpr std::size_t NUM_STAGES = static_cast<std::size_t>(Stage::count);
+
+    LatencyHistogram& operator[](Stage stage) {
+        return m_histograms[static_cast<std::size_t>(stage)];
+    }
+
+
+    const LatencyHistogram& operator[](Stage stage) const {
+        return m_histograms[static_cast<std::size_t>(stage)];
+    }
+
+
+    void reset() {
+        for (auto& histogram: m_histograms) {
+            histogram.reset();
+        }
+    }
+
+
+    static std::string stage_name(Stage stage) {
+        switch (stage) {
+            case Stage::fifo_wait:
+                return "fifo";
+            case Stage::resampling:
+                return "resampling";
+            case Stage::gating:
+                return "gating";
+            case Stage::window:
+                return "window";
+            case Stage::features:
+                return "features";
+            case Stage::forward:
+                return "forward";
+            case Stage::softmax:
+                return "softmax";
+            case Stage::integrator:
+                return "integrator";
+            case Stage::delivery:
+                return "delivery";
+            default:
+                return "unknown";
+        }
+    }
+
+
+private:
+    std::array<LatencyHistogram, NUM_STAGES> m_histograms;
+};
+
+#endif //IPT_MAX_LATENCY_STATS_H
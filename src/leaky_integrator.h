@@ -5,54 +5,75 @@
 #include <chrono>
 #include <vector>
 #include <optional>
+#include "simd.h"
 
 class LeakyIntegrator {
 public:
-    std::vector<float> process(const std::vector<float>& input) {
-        return process(input, std::chrono::steady_clock::now());
+    using Clock = std::chrono::steady_clock;
+
+    const std::vector<float>& process(const std::vector<float>& input) {
+        return process(input, Clock::now());
+    }
+
+    /**
+     * @param current_time timestamp of when the input was produced, so batched results keep their real spacing
+     * @returns the integrated value, valid until the next call. Integrates in place: doesn't allocate once the
+     *          first input of a given size has been processed
+     */
+    const std::vector<float>& process(const std::vector<float>& input, Clock::time_point current_time) {
+        return process(input, std::chrono::duration<double, std::milli>(current_time.time_since_epoch()).count());
     }
 
-    // timestamp of when the input was produced, so batched results keep their real spacing
-    std::vector<float> process(const std::vector<float>& input,
-                               std::chrono::time_point<std::chrono::steady_clock> current_time) {
-        if (!m_last_callback || m_tau < 1e-6 || m_previous_value.size() != input.size()) {
-            m_last_callback = current_time;
-            m_previous_value = input;
-            return input;
+    /**
+     * Same as above on any monotonic timeline in milliseconds, typically audio time (see audio_time_ms()), which makes
+     * the output independent of when the inputs are processed: offline runs match real-time ones exactly.
+     * @note Don't mix timelines without a reset() in between
+     */
+    const std::vector<float>& process(const std::vector<float>& input, double current_time_ms) {
+        if (!m_last_time_ms || m_tau < 1e-6 || m_previous_value.size() != input.size()) {
+            m_last_time_ms = current_time_ms;
+            m_previous_value.assign(input.begin(), input.end());
+            return m_previous_value;
         }
 
-        auto elapsed_time = std::chrono::duration<double, std::milli>(
-                current_time - *m_last_callback).count();
+        auto elapsed_time = std::min(m_tau, std::max(0.0, current_time_ms - *m_last_time_ms));
 
-        elapsed_time = std::min(m_tau, std::max(0.0, elapsed_time));
+        integrate(input, elapsed_time);
+        m_last_time_ms = current_time_ms;
+
+        return m_previous_value;
+    }
 
-        auto output = integrate(input, elapsed_time);
-        m_previous_value = output;
-        m_last_callback = current_time;
 
-        return output;
+    /** Position of `sample` in milliseconds, as a timestamp for process() shared by all audio-time callers */
+    static double audio_time_ms(double sample, double sample_rate) {
+        return sample * 1000.0 / sample_rate;
     }
 
+
     void set_tau(double tau) {
         m_tau = tau;
     }
 
 
-private:
-    std::vector<float> integrate(const std::vector<float>& current_value, double elapsed_time) {
-        std::vector<float> result;
-        result.reserve(current_value.size());
+    /** Forgets the previous value, e.g. when the classes of the input change */
+    void reset() {
+        m_last_time_ms.reset();
+        m_previous_value.clear();
+    }
+
 
+private:
+    void integrate(const std::vector<float>& current_value, double elapsed_time) {
+        // Note: sizes are guaranteed to match by `process`. leaky_mix is element-wise, so output may alias previous
         auto dt = elapsed_time / m_tau;
 
-        for (std::size_t i = 0; i < current_value.size(); i++) {
-            result.emplace_back((1 - dt) * m_previous_value.at(i) + dt * current_value.at(i));
-        }
-        return result;
+        util::simd::leaky_mix(m_previous_value.data(), current_value.data(), m_previous_value.data()
+                              , m_previous_value.size(), dt);
     }
 
 
-    std::optional<std::chrono::time_point<std::chrono::steady_clock>> m_last_callback;
+    std::optional<double> m_last_time_ms;
     std::vector<float> m_previous_value;
 
     double m_tau = 0.0;
@@ -4,14 +4,26 @@
 
 #include <torch/script.h>
 #include <torch/torch.h>
+#include <torch/version.h>
+#include <torch/csrc/jit/runtime/graph_executor.h>
+#include <algorithm>
+#include <filesystem>
+#include <optional>
 #include <vector>
 #include <string>
 #include <memory>
+#include <mutex>
+#include "allocation_counter.h"
+#include "feature_frontend.h"
+#include "simd.h"
 
 
 struct ClassificationResult {
     std::vector<float> distribution;
-    double inference_latency_ms;
+    double inference_latency_ms = 0.0;
+
+    // forward pass and softmax of the whole batch the window was classified in, i.e. the compute time it waited for
+    double compute_ms = 0.0;
 };
 
 
@@ -21,44 +33,145 @@ class Model {
 public:
     static const inline std::string CLASSIFY_METHOD = "forward";
 
+    // optional: `forward_stream(chunk, state: Optional[...]) -> (logits, state)`, see `classify_stream()`
+    static const inline std::string STREAM_METHOD = "forward_stream";
+
+    // optional, together: `forward_features(features[batch, frames, mels])` classifies the output of a spectral front
+    // end described by `get_feature_config() -> Dict[str, float]`, see FeatureConfig and `classify_features()`
+    static const inline std::string FEATURES_METHOD = "forward_features";
+    static const inline std::string FEATURE_CONFIG_METHOD = "get_feature_config";
+
     static const inline std::string SAMPLE_RATE_METHOD = "get_sr";
     static const inline std::string SEGMENT_LENGTH_METHOD = "get_seglen";
     static const inline std::string CLASS_NAMES_METHOD = "get_classnames";
 
+    static const inline std::string OPTIMIZED_CACHE_SUFFIX = ".opt";
+
+    // bump whenever the optimisation changes what a cache contains, e.g. the methods preserved by freezing, so that
+    // caches written by earlier versions aren't loaded in place of the model
+    static const inline std::string OPTIMIZED_CACHE_VERSION = "v2";
+
+    /** TorchScript graph executor, see `set_executor_mode()` */
+    enum class ExecutorMode {
+        profiling  // libtorch's default: profiles the first runs, then specialises the graph for the observed shapes
+        , legacy   // specialises the graph on the first run, without profiling
+        , simple   // runs the graph as is, without any specialisation: no slow first runs, but no fusion either
+    };
+
+    /** Numerical precision of inference, see `Options::precision` */
+    enum class Precision {
+        fp32
+        , bf16  // weights and inputs converted to bfloat16: about half the memory traffic of fp32
+        , int8  // model quantised when exported (e.g. with dynamic quantisation of its linear / LSTM layers)
+    };
+
+    struct Options {
+        // freeze the module and optimise it for inference: constant folding, conv-bn fusion, dropout removal,
+        // and on CPU, conversion to MKLDNN layouts where beneficial
+        bool optimize = false;
+
+        // save the optimised module next to the model file, so that subsequent loads skip the optimisation
+        bool cache = true;
+
+        // bf16 is only used on devices where it is expected to be faster, i.e. not on CPUs without native bf16,
+        // see `get_precision()`. int8 selects a quantised engine supported by this CPU to run the quantised operators,
+        // and is rejected for models without quantised operators, which would otherwise silently run in fp32
+        Precision precision = Precision::fp32;
+    };
+
+    /**
+     * Storage owned by the caller and reused by successive calls to `classify(..., Workspace&)`, so that the shared,
+     * read-only model needs no per-caller state while the caller's steady state doesn't allocate
+     */
+    struct Workspace {
+        std::vector<torch::jit::IValue> inputs;
+
+        // never shrinks: only the first `batch_size` entries of the latest call are valid
+        std::vector<ClassificationResult> results;
+
+        // durations of the latest call: forward pass, and softmax with copy of the output back to `results`
+        std::chrono::nanoseconds forward_time{0};
+        std::chrono::nanoseconds output_time{0};
+    };
+
+    /** State of one stream classified with `classify_stream()`, owned by the caller like `Workspace` */
+    struct StreamState {
+        // opaque to the caller: whatever the model returned for the previous chunk, or None
+        torch::jit::IValue state;
+
+        /** The next chunk starts a new stream, and must then contain a full window */
+        void reset() {
+            state = torch::jit::IValue();
+        }
+
+        bool is_reset() const {
+            return state.isNone();
+        }
+    };
+
+
     /**
      * @note Make sure to initialize the object on the same thread that will call `classify()`
      * @throws c10::Error if model cannot be loaded
      * */
-    explicit Model(const std::string& model_path, torch::DeviceType device) : m_device(device) {
+    explicit Model(const std::string& model_path, torch::DeviceType device) : Model(model_path, device, Options{}) {}
+
+    /** @throws c10::Error if model cannot be loaded, or if int8 is requested for a model that isn't quantised */
+    Model(const std::string& model_path, torch::DeviceType device, Options options)
+            : m_device(device)
+              , m_precision(supported_precision(options.precision, device)) {
         at::init_num_threads();
 
-        m_model = torch::jit::load(model_path);
-        m_model.eval();
-        m_model.to(m_device);
+        options.precision = m_precision;
+        if (m_precision == Precision::int8) {
+            select_quantized_engine();
+        }
+
+        m_model = load_module(model_path, device, options);
+        TORCH_CHECK(m_precision != Precision::int8 || has_quantized_operators(m_model)
+                    , "int8 precision requires a model quantised at export, but ", model_path
+                    , " has no quantized operators");
+
+        m_input_type = m_precision == Precision::bf16 ? torch::kBFloat16 : torch::kFloat32;
 
         m_sample_rate = parse_sample_rate(m_model);
         m_segment_length = parse_segment_length(m_model);
         m_class_names = parse_class_names(m_model);
+        m_supports_streaming = m_model.find_method(STREAM_METHOD).has_value();
+        m_feature_config = parse_feature_config(m_model, m_sample_rate, m_segment_length);
     }
 
     /** @throws c10::Error if classification fails */
     ClassificationResult classify(std::vector<float> windowed_buffer) {
-        auto tensor_in = vector2tensor(windowed_buffer);
+        return classify(windowed_buffer.data(), windowed_buffer.size());
+    }
+
+
+    /** Classify a window in place, without copying it on CPU.
+     *  @param window must stay valid for the duration of the call, and is not modified
+     *  @throws c10::Error if classification fails */
+    ClassificationResult classify(const float* window, std::size_t length) {
+        // from_blob requires a non-const pointer, but the tensor is only used as input to a forward pass
+        auto tensor_in = torch::from_blob(const_cast<float*>(window)
+                                          , {1, 1, static_cast<long long>(length)}
+                                          , torch::kFloat32);
 
-        tensor_in = tensor_in.to(m_device);
+        tensor_in = tensor_in.to(m_device).to(m_input_type);
         std::vector<torch::jit::IValue> inputs = {tensor_in};
         auto t1 = std::chrono::high_resolution_clock::now();
         auto tensor_out = m_model.get_method("forward")(inputs).toTensor();
         auto t2 = std::chrono::high_resolution_clock::now();
         
-        tensor_out = torch::softmax(tensor_out, /*dim=*/-1);
+        tensor_out = torch::softmax(tensor_out.to(torch::kFloat32), /*dim=*/-1);
         
         tensor_out = tensor_out.to(torch::kCPU);
 
         auto v = tensor2vector(tensor_out);
         auto latency_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(t2 - t1).count();
+        auto compute_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::high_resolution_clock::now() - t1).count();
 
-        return ClassificationResult{v, static_cast<double>(latency_ns) / 1e6};
+        return ClassificationResult{v, static_cast<double>(latency_ns) / 1e6, static_cast<double>(compute_ns) / 1e6};
     }
 
 
@@ -71,41 +184,182 @@ public:
             return {};
         }
 
-        const long batch = static_cast<long>(windows.size());
-        const long length = static_cast<long>(windows.front().size());
+        const std::size_t length = windows.front().size();
 
         // pack the windows contiguously into a [batch, 1, length] tensor
         std::vector<float> flat;
-        flat.reserve(static_cast<std::size_t>(batch) * static_cast<std::size_t>(length));
+        flat.reserve(windows.size() * length);
         for (const auto& w: windows) {
             flat.insert(flat.end(), w.begin(), w.end());
         }
 
-        auto tensor_in = torch::from_blob(flat.data(), {batch, 1, length}, torch::kFloat32).to(m_device);
-        std::vector<torch::jit::IValue> inputs = {tensor_in};
+        return classify(flat.data(), windows.size(), length);
+    }
+
 
+    /** Classify `batch_size` windows stored contiguously in `windows`, in a single forward pass, without copying them
+     *  on CPU.
+     *  @param windows `batch_size * length` samples, must stay valid for the duration of the call, and is not modified
+     *  @returns one ClassificationResult per window, in the same order
+     *  @throws c10::Error if classification fails */
+    std::vector<ClassificationResult> classify(const float* windows, std::size_t batch_size, std::size_t length) {
+        Workspace workspace;
+        classify(windows, batch_size, length, workspace);
+        workspace.results.resize(batch_size);
+        return std::move(workspace.results);
+    }
+
+
+    /**
+     * Same as above, writing the results to the first `batch_size` entries of `workspace.results` instead.
+     * Once `workspace` has been prepared for `batch_size`, this doesn't allocate outside of libtorch
+     * @throws c10::Error if classification fails
+     */
+    void classify(const float* windows, std::size_t batch_size, std::size_t length, Workspace& workspace) {
+        forward_batch(CLASSIFY_METHOD, windows, {static_cast<long>(batch_size), 1, static_cast<long>(length)}
+                      , batch_size, workspace);
+    }
+
+
+    /**
+     * Same as above with the features of `batch_size` windows, stored contiguously as [batch, frames, mels], e.g. from
+     * a FeatureCache, which are classified with the model's `forward_features` method.
+     * @note Only available if `get_feature_config()`
+     * @throws c10::Error if classification fails
+     */
+    void classify_features(const float* features, std::size_t batch_size, Workspace& workspace) {
+        auto num_frames = m_feature_config->frames_per_window(static_cast<std::size_t>(m_segment_length));
+        forward_batch(FEATURES_METHOD
+                      , features
+                      , {static_cast<long>(batch_size), static_cast<long>(num_frames), m_feature_config->n_mels}
+                      , batch_size
+                      , workspace);
+    }
+
+
+    /**
+     * Classifies the latest `length` samples of a stream with the model's streaming method, which only processes
+     * these new samples and carries whatever it needs from the previous ones (e.g. convolution or recurrent state)
+     * in `stream`. The result is written to `workspace.results[0]`.
+     *
+     * The first chunk after `stream.reset()` must be a full window: it is passed with a None state, and gives the
+     * model the same context as `classify()`. Chunks must then follow each other without gaps.
+     * @note Only available if `supports_streaming()`
+     * @throws c10::Error if classification fails
+     */
+    void classify_stream(const float* chunk, std::size_t length, StreamState& stream, Workspace& workspace) {
+        if (workspace.results.empty()) {
+            workspace.results.resize(1);
+        }
+
+        workspace.inputs.clear();
+        workspace.inputs.emplace_back(wrap_input(chunk, {1, 1, static_cast<long>(length)}));
+        workspace.inputs.emplace_back(std::move(stream.state));
+
+        c10::intrusive_ptr<c10::ivalue::Tuple> output;
         auto t1 = std::chrono::high_resolution_clock::now();
-        auto tensor_out = m_model.get_method("forward")(inputs).toTensor();
+        {
+            util::allocation_counter::Exclude exclude; // libtorch's forward pass
+            output = m_model.get_method(STREAM_METHOD)(workspace.inputs).toTuple();
+        }
         auto t2 = std::chrono::high_resolution_clock::now();
 
-        tensor_out = torch::softmax(tensor_out, /*dim=*/-1).to(torch::kCPU).contiguous();
+        const auto& elements = output->elements();
+        stream.state = elements[1];
+        auto tensor_out = softmax(elements[0].toTensor());
+        output.reset();
+        workspace.inputs.clear();
 
-        const long num_classes = tensor_out.size(-1);
+        const auto num_classes = static_cast<std::size_t>(tensor_out.size(-1));
         const float* out_ptr = tensor_out.data_ptr<float>();
 
-        // share the (single) forward-pass cost evenly across the batch
-        auto latency_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(t2 - t1).count();
-        double latency_per_window = static_cast<double>(latency_ns) / 1e6 / static_cast<double>(batch);
+        workspace.forward_time = std::chrono::duration_cast<std::chrono::nanoseconds>(t2 - t1);
+        workspace.output_time = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::high_resolution_clock::now() - t2);
 
-        std::vector<ClassificationResult> results;
-        results.reserve(static_cast<std::size_t>(batch));
-        for (long b = 0; b < batch; ++b) {
-            const float* row = out_ptr + b * num_classes;
-            results.push_back(ClassificationResult{std::vector<float>(row, row + num_classes),
-                                                   latency_per_window});
+        auto& result = workspace.results[0];
+        result.distribution.assign(out_ptr, out_ptr + num_classes);
+        result.inference_latency_ms = static_cast<double>(workspace.forward_time.count()) / 1e6;
+        result.compute_ms = static_cast<double>((workspace.forward_time + workspace.output_time).count()) / 1e6;
+    }
+
+
+    /** Preallocates `workspace` for batches of up to `max_batch_size` windows of this model */
+    void prepare(Workspace& workspace, std::size_t max_batch_size) const {
+        workspace.inputs.reserve(2);
+        if (workspace.results.size() < max_batch_size) {
+            workspace.results.resize(max_batch_size);
+        }
+        for (auto& result: workspace.results) {
+            result.distribution.reserve(m_class_names.size());
         }
+    }
+
+
+    /**
+     * Runs `num_passes` forward passes on silence for each of `batch_sizes`, so that the graph executor has profiled
+     * and specialised the graph for the input shapes that will actually be used before the first real window.
+     * Models with a feature front end are warmed up on features as well.
+     * @param stream_chunk_length if > 0 and the model supports streaming, also runs `num_passes` streams of a full
+     *                            window followed by a chunk of this length
+     * @returns the total warm-up time in milliseconds
+     * @throws c10::Error if classification fails
+     */
+    double warm_up(const std::vector<std::size_t>& batch_sizes, int num_passes, std::size_t stream_chunk_length = 0) {
+        auto length = static_cast<std::size_t>(m_segment_length);
+
+        auto t1 = std::chrono::high_resolution_clock::now();
+        for (auto batch_size: batch_sizes) {
+            std::vector<float> silence(batch_size * length, 0.0f);
+            for (int i = 0; i < num_passes; ++i) {
+                classify(silence.data(), batch_size, length);
+            }
+        }
+
+        if (m_feature_config) {
+            auto num_frames = m_feature_config->frames_per_window(length);
+            auto size = num_frames * static_cast<std::size_t>(m_feature_config->n_mels);
+            Workspace workspace;
+            for (auto batch_size: batch_sizes) {
+                std::vector<float> silence(batch_size * size, 0.0f);
+                for (int i = 0; i < num_passes; ++i) {
+                    classify_features(silence.data(), batch_size, workspace);
+                }
+            }
+        }
+
+        if (m_supports_streaming && stream_chunk_length > 0) {
+            std::vector<float> silence(length, 0.0f);
+            Workspace workspace;
+            for (int i = 0; i < num_passes; ++i) {
+                StreamState stream;
+                classify_stream(silence.data(), length, stream, workspace);
+                classify_stream(silence.data(), std::min(stream_chunk_length, length), stream, workspace);
+            }
+        }
+        auto t2 = std::chrono::high_resolution_clock::now();
+
+        if (num_passes > 0) {
+            std::lock_guard lock{m_warm_up_mutex};
+            for (auto batch_size: batch_sizes) {
+                if (std::find(m_warm_batch_sizes.begin(), m_warm_batch_sizes.end(), batch_size)
+                    == m_warm_batch_sizes.end()) {
+                    m_warm_batch_sizes.push_back(batch_size);
+                }
+            }
+        }
+
+        return static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(t2 - t1).count()) / 1e6;
+    }
 
-        return results;
+
+    /**
+     * @returns true if warm_up() has already run batches of `batch_size` windows on this model, possibly on behalf of
+     *          another user of the same model, see ModelRegistry
+     */
+    bool is_warmed_up(std::size_t batch_size) const {
+        std::lock_guard lock{m_warm_up_mutex};
+        return std::find(m_warm_batch_sizes.begin(), m_warm_batch_sizes.end(), batch_size) != m_warm_batch_sizes.end();
     }
 
 
@@ -124,6 +378,116 @@ public:
     }
 
 
+    /** @returns the model's front end if it has a `forward_features` method, see `classify_features()` */
+    const std::optional<FeatureConfig>& get_feature_config() const {
+        return m_feature_config;
+    }
+
+
+    /** @returns true if the model has a `forward_stream` method, see `classify_stream()` */
+    bool supports_streaming() const {
+        return m_supports_streaming;
+    }
+
+
+    /** Selects the graph executor of all TorchScript models in the process, as this is a global libtorch setting */
+    static void set_executor_mode(ExecutorMode mode) {
+        torch::jit::getExecutorMode() = mode != ExecutorMode::simple;
+        torch::jit::getProfilingMode() = mode == ExecutorMode::profiling;
+    }
+
+
+    /**
+     * Sets the number of threads used by a forward pass (intra-op parallelism), or restores libtorch's default,
+     * see `default_num_threads()`, if `num_threads` <= 0.
+     * @note With the OpenMP backend of libtorch, this only applies to the calling thread, so it must be called
+     *       on the thread that calls `classify()`. With other backends, it applies to the whole process
+     */
+    static void set_num_threads(int num_threads) {
+        if (num_threads <= 0) {
+            num_threads = default_num_threads();
+        }
+
+        if (at::get_num_threads() != num_threads) {
+            at::set_num_threads(num_threads);
+        }
+    }
+
+
+    /** @returns libtorch's number of intra-op threads, as it was before the first call to `set_num_threads()` */
+    static int default_num_threads() {
+        static const int num_threads = at::get_num_threads();
+        return num_threads;
+    }
+
+
+    /**
+     * Sets the number of threads running independent operators of a graph concurrently (inter-op parallelism)
+     * for the whole process, if `num_threads` > 0.
+     * @returns false if it could not be set, as libtorch only allows it before the first inter-op task has run
+     */
+    static bool set_num_interop_threads(int num_threads) {
+        if (num_threads <= 0 || at::get_num_interop_threads() == num_threads) {
+            return true;
+        }
+
+        try {
+            at::set_num_interop_threads(num_threads);
+            return true;
+        } catch (const c10::Error&) {
+            return false;
+        }
+    }
+
+
+    /** @returns the file the optimised version of `model_path` is cached to. Specific to device, precision, libtorch
+     *           version and cache version, as all affect the result of the optimisation */
+    static std::string get_optimized_cache_path(const std::string& model_path
+                                                , torch::DeviceType device
+                                                , Precision precision = Precision::fp32) {
+        return model_path + OPTIMIZED_CACHE_SUFFIX + "-" + c10::DeviceTypeName(device, true)
+               + "-" + precision_name(precision) + "-" + TORCH_VERSION + "-" + OPTIMIZED_CACHE_VERSION;
+    }
+
+
+    static std::string precision_name(Precision precision) {
+        switch (precision) {
+            case Precision::bf16:
+                return "bf16";
+            case Precision::int8:
+                return "int8";
+            default:
+                return "fp32";
+        }
+    }
+
+
+    /** @throws std::invalid_argument if `name` is not one of fp32, bf16 or int8 */
+    static Precision parse_precision(const std::string& name) {
+        for (auto precision: {Precision::fp32, Precision::bf16, Precision::int8}) {
+            if (name == precision_name(precision)) {
+                return precision;
+            }
+        }
+        throw std::invalid_argument("unknown precision \"" + name + "\"");
+    }
+
+
+    /** @returns the precision a model loaded with `requested` on `device` will actually use */
+    static Precision supported_precision(Precision requested, torch::DeviceType device) {
+        if (requested == Precision::bf16 && device == torch::kCPU && !util::simd::has_native_bf16()) {
+            return Precision::fp32; // emulated bf16 is slower than fp32
+        }
+        return requested;
+    }
+
+
+    /** @returns the precision actually used, which may differ from the requested one, see `Options::precision` */
+    Precision get_precision() const {
+        return m_precision;
+    }
+
+
     static std::vector<float> tensor2vector(const at::Tensor& tensor) {
         std::vector<float> v;
         v.reserve(tensor.numel());
@@ -141,6 +505,193 @@ public:
 
 
 private:
+    /** Runs `method` on `input` of `shape` ([batch_size, ...]), then softmax into `workspace`, see classify() */
+    void forward_batch(const std::string& method
+                       , const float* input
+                       , c10::IntArrayRef shape
+                       , std::size_t batch_size
+                       , Workspace& workspace) {
+        if (batch_size == 0) {
+            return;
+        }
+
+        if (workspace.results.size() < batch_size) {
+            workspace.results.resize(batch_size);
+        }
+
+        workspace.inputs.clear();
+        workspace.inputs.emplace_back(wrap_input(input, shape));
+
+        torch::Tensor logits;
+        auto t1 = std::chrono::high_resolution_clock::now();
+        {
+            util::allocation_counter::Exclude exclude; // libtorch's forward pass
+            logits = m_model.get_method(method)(workspace.inputs).toTensor();
+        }
+        auto t2 = std::chrono::high_resolution_clock::now();
+
+        auto tensor_out = softmax(logits);
+        logits.reset();
+        workspace.inputs.clear();
+
+        const auto num_classes = static_cast<std::size_t>(tensor_out.size(-1));
+        const float* out_ptr = tensor_out.data_ptr<float>();
+
+        // share the (single) forward-pass cost evenly across the batch
+        auto latency_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(t2 - t1).count();
+        double latency_per_window = static_cast<double>(latency_ns) / 1e6 / static_cast<double>(batch_size);
+
+        for (std::size_t b = 0; b < batch_size; ++b) {
+            const float* row = out_ptr + b * num_classes;
+            workspace.results[b].distribution.assign(row, row + num_classes);
+            workspace.results[b].inference_latency_ms = latency_per_window;
+        }
+
+        workspace.forward_time = std::chrono::duration_cast<std::chrono::nanoseconds>(t2 - t1);
+        workspace.output_time = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::high_resolution_clock::now() - t2);
+
+        auto compute_ms = static_cast<double>((workspace.forward_time + workspace.output_time).count()) / 1e6;
+        for (std::size_t b = 0; b < batch_size; ++b) {
+            workspace.results[b].compute_ms = compute_ms;
+        }
+    }
+
+
+    /**
+     * Input tensor of `shape` viewing `input` without copying, on the model's device and in its input type.
+     * @note from_blob allocates the tensor's metadata (TensorImpl and StorageImpl): the only allocation of the
+     *       steady-state path besides the forward pass and `softmax()`, excluded from the allocation count
+     */
+    torch::Tensor wrap_input(const float* input, c10::IntArrayRef shape) const {
+        torch::Tensor tensor;
+        {
+            util::allocation_counter::Exclude exclude;
+
+            // from_blob requires a non-const pointer, but the tensor is only used as input to a forward pass
+            tensor = torch::from_blob(const_cast<float*>(input), shape, torch::kFloat32);
+        }
+        return tensor.to(m_device).to(m_input_type);
+    }
+
+
+    /**
+     * Softmax of the model's output, as contiguous float32 probabilities on the CPU.
+     * @note The softmax allocates its output tensor, excluded from the allocation count
+     */
+    static torch::Tensor softmax(const torch::Tensor& logits) {
+        torch::Tensor probabilities;
+        {
+            util::allocation_counter::Exclude exclude;
+            probabilities = torch::softmax(logits.to(torch::kFloat32), /*dim=*/-1);
+        }
+        return probabilities.to(torch::kCPU).contiguous();
+    }
+
+
+    /** @throws c10::Error if model cannot be loaded */
+    static torch::jit::Module load_module(const std::string& model_path, torch::DeviceType device, Options options) {
+        auto cache_path = get_optimized_cache_path(model_path, device, options.precision);
+
+        if (options.optimize && options.cache && is_cache_valid(model_path, cache_path)) {
+            try {
+                return torch::jit::load(cache_path, device);
+            } catch (const c10::Error&) {
+                // corrupt or incompatible cache: optimise again and overwrite it
+            }
+        }
+
+        auto module = torch::jit::load(model_path);
+        module.eval();
+        module.to(device);
+
+        if (options.precision == Precision::bf16) {
+            module.to(torch::kBFloat16);
+        }
+
+        if (!options.optimize) {
+            return module;
+        }
+
+        // the metadata methods must be preserved explicitly, as freezing removes every method but `forward`
+        std::vector<std::string> preserved{SAMPLE_RATE_METHOD, SEGMENT_LENGTH_METHOD, CLASS_NAMES_METHOD};
+        for (const auto& method: {STREAM_METHOD, FEATURES_METHOD, FEATURE_CONFIG_METHOD}) {
+            if (module.find_method(method)) {
+                preserved.push_back(method);
+            }
+        }
+
+        auto optimized = torch::jit::freeze(module, preserved);
+
+        // Note: the MKLDNN conversions of optimize_for_inference don't apply to quantised operators
+        if (device == torch::kCPU && options.precision != Precision::int8) {
+            optimized = torch::jit::optimize_for_inference(optimized, preserved);
+        }
+
+        if (options.cache) {
+            try {
+                optimized.save(cache_path);
+            } catch (const std::exception&) {
+                // e.g. read-only model directory: the cache is only an optimisation
+            }
+        }
+
+        return optimized;
+    }
+
+
+    /** Quantised operators need a quantised engine, which isn't necessarily selected by default (e.g. on arm64) */
+    static void select_quantized_engine() {
+        const auto& engines = at::globalContext().supportedQEngines();
+        for (auto engine: {at::QEngine::X86, at::QEngine::FBGEMM, at::QEngine::QNNPACK}) {
+            if (std::find(engines.begin(), engines.end(), engine) != engines.end()) {
+                at::globalContext().setQEngine(engine);
+                return;
+            }
+        }
+    }
+
+
+    /** @returns true if any method of `module` or its submodules calls an operator of the `quantized::` namespace */
+    static bool has_quantized_operators(const torch::jit::Module& module) {
+        for (const auto& submodule: module.modules()) {
+            for (const auto& method: submodule.get_methods()) {
+                if (has_quantized_operators(method.graph()->block())) {
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+
+    static bool has_quantized_operators(const torch::jit::Block* block) {
+        for (const auto* node: block->nodes()) {
+            if (std::string(node->kind().toQualString()).rfind("quantized::", 0) == 0) {
+                return true;
+            }
+            for (const auto* sub_block: node->blocks()) {
+                if (has_quantized_operators(sub_block)) {
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+
+    static bool is_cache_valid(const std::string& model_path, const std::string& cache_path) {
+        std::error_code error;
+        auto cache_time = std::filesystem::last_write_time(cache_path, error);
+        if (error) {
+            return false;
+        }
+
+        auto model_time = std::filesystem::last_write_time(model_path, error);
+        return !error && cache_time >= model_time;
+    }
+
+
     /** @throws c10::Error if model cannot parse sample rate */
     static int parse_sample_rate(torch::jit::Module& model) {
         return model.get_method(SAMPLE_RATE_METHOD)(std::vector<c10::IValue>()).to<int>();
@@ -165,13 +716,70 @@ private:
     }
 
 
+    /**
+     * @returns nullopt unless the model has both `forward_features` and `get_feature_config`
+     * @throws c10::Error if the config is invalid, e.g. frames longer than the model's segment length
+     */
+    static std::optional<FeatureConfig> parse_feature_config(torch::jit::Module& model
+                                                             , int sample_rate
+                                                             , int segment_length) {
+        if (!model.find_method(FEATURES_METHOD) || !model.find_method(FEATURE_CONFIG_METHOD)) {
+            return std::nullopt;
+        }
+
+        FeatureConfig config;
+        config.sample_rate = sample_rate;
+
+        auto entries = model.get_method(FEATURE_CONFIG_METHOD)(std::vector<c10::IValue>()).toGenericDict();
+        for (const auto& entry: entries) {
+            const auto& key = entry.key().toStringRef();
+            auto value = entry.value().isInt() ? static_cast<double>(entry.value().toInt()) : entry.value().toDouble();
+
+            if (key == "n_fft") {
+                config.n_fft = static_cast<int>(value);
+            } else if (key == "win_length") {
+                config.win_length = static_cast<int>(value);
+            } else if (key == "hop_length") {
+                config.hop_length = static_cast<int>(value);
+            } else if (key == "n_mels") {
+                config.n_mels = static_cast<int>(value);
+            } else if (key == "f_min") {
+                config.f_min = value;
+            } else if (key == "f_max") {
+                config.f_max = value;
+            } else if (key == "power") {
+                config.power = value;
+            } else if (key == "log_offset") {
+                config.log_offset = value;
+            }
+        }
+
+        try {
+            config.validate();
+        } catch (const std::invalid_argument& e) {
+            TORCH_CHECK(false, e.what());
+        }
+        TORCH_CHECK(config.frames_per_window(static_cast<std::size_t>(segment_length)) > 0
+                    , "feature config: n_fft is longer than the model's segment length");
+
+        return config;
+    }
+
+
     torch::DeviceType m_device;
+    Precision m_precision;
+    c10::ScalarType m_input_type = torch::kFloat32;
 
     torch::jit::Module m_model;
 
     int m_sample_rate;
     int m_segment_length;
     std::vector<std::string> m_class_names;
+    bool m_supports_streaming = false;
+    std::optional<FeatureConfig> m_feature_config;
+
+    mutable std::mutex m_warm_up_mutex;
+    std::vector<std::size_t> m_warm_batch_sizes;  // see is_warmed_up()
 };
 
 
@@ -0,0 +1,110 @@
+#ifndef IPT_MAX_MODEL_REGISTRY_H
+#define IPT_MAX_MODEL_REGISTRY_H
+
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <tuple>
+#include "model.h"
+
+
+/**
+ * Process-wide cache of loaded models, keyed by model path, device, precision and whether the model is optimised.
+ *
+ * All callers asking for the same model share one loaded instance (weights and metadata), which stays loaded for as
+ * long as at least one caller holds on to it: the registry itself only keeps weak references. A Model is never
+ * modified after construction, so a shared instance may be used by several threads concurrently.
+ */
+class ModelRegistry {
+public:
+    static ModelRegistry& instance() {
+        static ModelRegistry registry;
+        return registry;
+    }
+
+    ModelRegistry(const ModelRegistry&) = delete;
+    ModelRegistry& operator=(const ModelRegistry&) = delete;
+
+
+    /**
+     * @returns the cached model if it is currently loaded, otherwise loads it.
+     *          Concurrent requests for the same model wait for a single load rather than loading it twice,
+     *          while requests for other models proceed independently
+     * @throws c10::Error if model cannot be loaded
+     */
+    std::shared_ptr<Model> acquire(const std::string& model_path
+                                   , torch::DeviceType device
+                                   , Model::Options options = {}) {
+        auto precision = Model::supported_precision(options.precision, device);
+        auto slot = get_slot(Key{canonical_path(model_path), device, options.optimize, precision});
+
+        std::lock_guard lock{slot->mutex};
+        if (auto model = slot->model.lock()) {
+            return model;
+        }
+
+        auto model = std::make_shared<Model>(model_path, device, options);
+        slot->model = model;
+        return model;
+    }
+
+
+    /** Number of distinct models currently loaded */
+    std::size_t size() {
+        std::lock_guard lock{m_mutex};
+        std::size_t count = 0;
+        for (const auto& [key, slot]: m_slots) {
+            std::lock_guard slot_lock{slot->mutex};
+            count += slot->model.expired() ? 0 : 1;
+        }
+        return count;
+    }
+
+
+private:
+    using Key = std::tuple<std::string, torch::DeviceType, bool, Model::Precision>;
+
+    struct Slot {
+        std::mutex mutex;
+        std::weak_ptr<Model> model;
+    };
+
+
+    ModelRegistry() = default;
+
+
+    std::shared_ptr<Slot> get_slot(const Key& key) {
+        std::lock_guard lock{m_mutex};
+
+        // drop slots of unloaded models, unless another caller is currently loading into them
+        for (auto it = m_slots.begin(); it != m_slots.end();) {
+            if (it->first != key && it->second.use_count() == 1 && it->second->model.expired()) {
+                it = m_slots.erase(it);
+            } else {
+                ++it;
+            }
+        }
+
+        auto& slot = m_slots[key];
+        if (!slot) {
+            slot = std::make_shared<Slot>();
+        }
+        return slot;
+    }
+
+
+    /** Resolves relative paths, `..` and symlinks so that different spellings of a path share one entry */
+    static std::string canonical_path(const std::string& path) {
+        std::error_code error;
+        auto canonical = std::filesystem::weakly_canonical(std::filesystem::absolute(path, error), error);
+        return error ? path : canonical.string();
+    }
+
+
+    std::map<Key, std::shared_ptr<Slot>> m_slots;
+    std::mutex m_mutex;
+};
+
+#endif //IPT_MAX_MODEL_REGISTRY_H
@@ -0,0 +1,601 @@
+#ifndef IPT_MAX_SIMD_H
+#define IPT_MAX_SIMD_H
+
+#include <algorithm>
+#include <cstddef>
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define IPT_SIMD_X86 1
+#include <cpuid.h>
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#define IPT_SIMD_NEON 1
+#include <arm_neon.h>
+#if defined(__APPLE__)
+#include <sys/sysctl.h>
+#elif defined(__linux__)
+#include <sys/auxv.h>
+#endif
+#endif
+
+/**
+ * Vectorised kernels for the per-hop utility loops, with the instruction set selected once at runtime.
+ *
+ * On x86, SSE2 is the baseline and AVX2 / AVX-512 kernels are compiled with function-level target attributes,
+ * so no global compiler flags are needed. On arm64, NEON is always available. Every kernel has a scalar reference
+ * implementation, which is also used for the tails that don't fill an entire vector:
+ *   - `to_floats`, `max_value` and `argmax` are bit-exact with respect to the scalar reference,
+ *   - `sum_of_squares` and `leaky_mix` only differ by summation order / fused multiply-add rounding.
+ */
+namespace util::simd {
+
+enum class Isa {
+    scalar, sse2, avx2, avx512, neon
+};
+
+
+struct Kernels {
+    Isa isa;
+    const char* name;
+    void (* to_floats)(const double* input, float* output, std::size_t n);
+    double (* sum_of_squares_d)(const double* input, std::size_t n);
+    double (* sum_of_squares_f)(const float* input, std::size_t n);
+    float (* max_value)(const float* input, std::size_t n);
+    void (* leaky_mix)(const float* previous, const float* current, float* output, std::size_t n, double dt);
+};
+
+
+// ==============================================================================================
+
+namespace scalar {
+
+inline void to_floats(const double* input, float* output, std::size_t n) {
+    for (std::size_t i = 0; i < n; ++i) {
+        output[i] = static_cast<float>(input[i]);
+    }
+}
+
+
+template<typename T>
+inline double sum_of_squares(const T* input, std::size_t n) {
+    double sum = 0.0;
+    for (std::size_t i = 0; i < n; ++i) {
+        auto x = static_cast<double>(input[i]);
+        sum += x * x;
+    }
+    return sum;
+}
+
+
+inline float max_value(const float* input, std::size_t n) {
+    float max = input[0];
+    for (std::size_t i = 1; i < n; ++i) {
+        if (input[i] > max) {
+            max = input[i];
+        }
+    }
+    return max;
+}
+
+
+inline void leaky_mix(const float* previous, const float* current, float* output, std::size_t n, double dt) {
+    for (std::size_t i = 0; i < n; ++i) {
+        output[i] = static_cast<float>((1 - dt) * previous[i] + dt * current[i]);
+    }
+}
+
+
+inline const Kernels& kernels() {
+    static const Kernels k{Isa::scalar, "scalar", to_floats, sum_of_squares<double>, sum_of_squares<float>
+                           , max_value, leaky_mix};
+    return k;
+}
+
+} // namespace scalar
+
+
+// ==============================================================================================
+
+#if IPT_SIMD_X86
+
+namespace sse2 {
+
+__attribute__((target("sse2")))
+inline void to_floats(const double* input, float* output, std::size_t n) {
+    std::size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128 lo = _mm_cvtpd_ps(_mm_loadu_pd(input + i));
+        __m128 hi = _mm_cvtpd_ps(_mm_loadu_pd(input + i + 2));
+        _mm_storeu_ps(output + i, _mm_movelh_ps(lo, hi));
+    }
+    scalar::to_floats(input + i, output + i, n - i);
+}
+
+
+__attribute__((target("sse2")))
+inline double sum_of_squares_d(const double* input, std::size_t n) {
+    __m128d acc0 = _mm_setzero_pd();
+    __m128d acc1 = _mm_setzero_pd();
+    std::size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128d a = _mm_loadu_pd(input + i);
+        __m128d b = _mm_loadu_pd(input + i + 2);
+        acc0 = _mm_add_pd(acc0, _mm_mul_pd(a, a));
+        acc1 = _mm_add_pd(acc1, _mm_mul_pd(b, b));
+    }
+    double lanes[2];
+    _mm_storeu_pd(lanes, _mm_add_pd(acc0, acc1));
+    return lanes[0] + lanes[1] + scalar::sum_of_squares(input + i, n - i);
+}
+
+
+__attribute__((target("sse2")))
+inline double sum_of_squares_f(const float* input, std::size_t n) {
+    __m128d acc0 = _mm_setzero_pd();
+    __m128d acc1 = _mm_setzero_pd();
+    std::size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128 x = _mm_loadu_ps(input + i);
+        __m128d a = _mm_cvtps_pd(x);
+        __m128d b = _mm_cvtps_pd(_mm_movehl_ps(x, x));
+        acc0 = _mm_add_pd(acc0, _mm_mul_pd(a, a));
+        acc1 = _mm_add_pd(acc1, _mm_mul_pd(b, b));
+    }
+    double lanes[2];
+    _mm_storeu_pd(lanes, _mm_add_pd(acc0, acc1));
+    return lanes[0] + lanes[1] + scalar::sum_of_squares(input + i, n - i);
+}
+
+
+__attribute__((target("sse2")))
+inline float max_value(const float* input, std::size_t n) {
+    if (n < 4) {
+        return scalar::max_value(input, n);
+    }
+
+    __m128 acc = _mm_loadu_ps(input);
+    std::size_t i = 4;
+    for (; i + 4 <= n; i += 4) {
+        acc = _mm_max_ps(acc, _mm_loadu_ps(input + i));
+    }
+    float lanes[4];
+    _mm_storeu_ps(lanes, acc);
+    float max = scalar::max_value(lanes, 4);
+    return i < n ? std::max(max, scalar::max_value(input + i, n - i)) : max;
+}
+
+
+__attribute__((target("sse2")))
+inline void leaky_mix(const float* previous, const float* current, float* output, std::size_t n, double dt) {
+    const __m128d a = _mm_set1_pd(1 - dt);
+    const __m128d b = _mm_set1_pd(dt);
+    std::size_t i = 0;
+    for (; i + 2 <= n; i += 2) {
+        __m128d p = _mm_cvtps_pd(_mm_castpd_ps(_mm_load_sd(reinterpret_cast<const double*>(previous + i))));
+        __m128d c = _mm_cvtps_pd(_mm_castpd_ps(_mm_load_sd(reinterpret_cast<const double*>(current + i))));
+        __m128 r = _mm_cvtpd_ps(_mm_add_pd(_mm_mul_pd(a, p), _mm_mul_pd(b, c)));
+        _mm_store_sd(reinterpret_cast<double*>(output + i), _mm_castps_pd(r));
+    }
+    scalar::leaky_mix(previous + i, current + i, output + i, n - i, dt);
+}
+
+
+inline const Kernels& kernels() {
+    static const Kernels k{Isa::sse2, "sse2", to_floats, sum_of_squares_d, sum_of_squares_f, max_value, leaky_mix};
+    return k;
+}
+
+} // namespace sse2
+
+
+// ==============================================================================================
+
+namespace avx2 {
+
+__attribute__((target("avx2")))
+inline void to_floats(const double* input, float* output, std::size_t n) {
+    std::size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128 lo = _mm256_cvtpd_ps(_mm256_loadu_pd(input + i));
+        __m128 hi = _mm256_cvtpd_ps(_mm256_loadu_pd(input + i + 4));
+        _mm256_storeu_ps(output + i, _mm256_set_m128(hi, lo));
+    }
+    scalar::to_floats(input + i, output + i, n - i);
+}
+
+
+__attribute__((target("avx2")))
+inline double reduce_add(__m256d v) {
+    __m128d sum = _mm_add_pd(_mm256_castpd256_pd128(v), _mm256_extractf128_pd(v, 1));
+    double lanes[2];
+    _mm_storeu_pd(lanes, sum);
+    return lanes[0] + lanes[1];
+}
+
+
+__attribute__((target("avx2")))
+inline double sum_of_squares_d(const double* input, std::size_t n) {
+    __m256d acc0 = _mm256_setzero_pd();
+    __m256d acc1 = _mm256_setzero_pd();
+    std::size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256d a = _mm256_loadu_pd(input + i);
+        __m256d b = _mm256_loadu_pd(input + i + 4);
+        acc0 = _mm256_add_pd(acc0, _mm256_mul_pd(a, a));
+        acc1 = _mm256_add_pd(acc1, _mm256_mul_pd(b, b));
+    }
+    return reduce_add(_mm256_add_pd(acc0, acc1)) + scalar::sum_of_squares(input + i, n - i);
+}
+
+
+__attribute__((target("avx2")))
+inline double sum_of_squares_f(const float* input, std::size_t n) {
+    __m256d acc0 = _mm256_setzero_pd();
+    __m256d acc1 = _mm256_setzero_pd();
+    std::size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256d a = _mm256_cvtps_pd(_mm_loadu_ps(input + i));
+        __m256d b = _mm256_cvtps_pd(_mm_loadu_ps(input + i + 4));
+        acc0 = _mm256_add_pd(acc0, _mm256_mul_pd(a, a));
+        acc1 = _mm256_add_pd(acc1, _mm256_mul_pd(b, b));
+    }
+    return reduce_add(_mm256_add_pd(acc0, acc1)) + scalar::sum_of_squares(input + i, n - i);
+}
+
+
+__attribute__((target("avx2")))
+inline float max_value(const float* input, std::size_t n) {
+    if (n < 8) {
+        return sse2::max_value(input, n);
+    }
+
+    __m256 acc = _mm256_loadu_ps(input);
+    std::size_t i = 8;
+    for (; i + 8 <= n; i += 8) {
+        acc = _mm256_max_ps(acc, _mm256_loadu_ps(input + i));
+    }
+    float lanes[8];
+    _mm256_storeu_ps(lanes, acc);
+    float max = scalar::max_value(lanes, 8);
+    return i < n ? std::max(max, scalar::max_value(input + i, n - i)) : max;
+}
+
+
+__attribute__((target("avx2")))
+inline void leaky_mix(const float* previous, const float* current, float* output, std::size_t n, double dt) {
+    const __m256d a = _mm256_set1_pd(1 - dt);
+    const __m256d b = _mm256_set1_pd(dt);
+    std::size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256d p = _mm256_cvtps_pd(_mm_loadu_ps(previous + i));
+        __m256d c = _mm256_cvtps_pd(_mm_loadu_ps(current + i));
+        _mm_storeu_ps(output + i, _mm256_cvtpd_ps(_mm256_add_pd(_mm256_mul_pd(a, p), _mm256_mul_pd(b, c))));
+    }
+    scalar::leaky_mix(previous + i, current + i, output + i, n - i, dt);
+}
+
+
+inline const Kernels& kernels() {
+    static const Kernels k{Isa::avx2, "avx2", to_floats, sum_of_squares_d, sum_of_squares_f, max_value, leaky_mix};
+    return k;
+}
+
+} // namespace avx2
+
+
+// ==============================================================================================
+
+namespace avx512 {
+
+__attribute__((target("avx512f")))
+inline void to_floats(const double* input, float* output, std::size_t n) {
+    std::size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m256 lo = _mm512_cvtpd_ps(_mm512_loadu_pd(input + i));
+        __m256 hi = _mm512_cvtpd_ps(_mm512_loadu_pd(input + i + 8));
+        _mm256_storeu_ps(output + i, lo);
+        _mm256_storeu_ps(output + i + 8, hi);
+    }
+    scalar::to_floats(input + i, output + i, n - i);
+}
+
+
+__attribute__((target("avx512f")))
+inline double sum_of_squares_d(const double* input, std::size_t n) {
+    __m512d acc0 = _mm512_setzero_pd();
+    __m512d acc1 = _mm512_setzero_pd();
+    std::size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m512d a = _mm512_loadu_pd(input + i);
+        __m512d b = _mm512_loadu_pd(input + i + 8);
+        acc0 = _mm512_add_pd(acc0, _mm512_mul_pd(a, a));
+        acc1 = _mm512_add_pd(acc1, _mm512_mul_pd(b, b));
+    }
+    return _mm512_reduce_add_pd(_mm512_add_pd(acc0, acc1)) + scalar::sum_of_squares(input + i, n - i);
+}
+
+
+__attribute__((target("avx512f")))
+inline double sum_of_squares_f(const float* input, std::size_t n) {
+    __m512d acc0 = _mm512_setzero_pd();
+    __m512d acc1 = _mm512_setzero_pd();
+    std::size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m512d a = _mm512_cvtps_pd(_mm256_loadu_ps(input + i));
+        __m512d b = _mm512_cvtps_pd(_mm256_loadu_ps(input + i + 8));
+        acc0 = _mm512_add_pd(acc0, _mm512_mul_pd(a, a));
+        acc1 = _mm512_add_pd(acc1, _mm512_mul_pd(b, b));
+    }
+    return _mm512_reduce_add_pd(_mm512_add_pd(acc0, acc1)) + scalar::sum_of_squares(input + i, n - i);
+}
+
+
+__attribute__((target("avx512f")))
+inline float max_value(const float* input, std::size_t n) {
+    if (n < 16) {
+        return avx2::max_value(input, n);
+    }
+
+    __m512 acc = _mm512_loadu_ps(input);
+    std::size_t i = 16;
+    for (; i + 16 <= n; i += 16) {
+        acc = _mm512_max_ps(acc, _mm512_loadu_ps(input + i));
+    }
+    float max = _mm512_reduce_max_ps(acc);
+    return i < n ? std::max(max, scalar::max_value(input + i, n - i)) : max;
+}
+
+
+__attribute__((target("avx512f")))
+inline void leaky_mix(const float* previous, const float* current, float* output, std::size_t n, double dt) {
+    const __m512d a = _mm512_set1_pd(1 - dt);
+    const __m512d b = _mm512_set1_pd(dt);
+    std::size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m512d p = _mm512_cvtps_pd(_mm256_loadu_ps(previous + i));
+        __m512d c = _mm512_cvtps_pd(_mm256_loadu_ps(current + i));
+        _mm256_storeu_ps(output + i, _mm512_cvtpd_ps(_mm512_add_pd(_mm512_mul_pd(a, p), _mm512_mul_pd(b, c))));
+    }
+    scalar::leaky_mix(previous + i, current + i, output + i, n - i, dt);
+}
+
+
+inline const Kernels& kernels() {
+    static const Kernels k{Isa::avx512, "avx512", to_floats, sum_of_squares_d, sum_of_squares_f, max_value
+                           , leaky_mix};
+    return k;
+}
+
+} // namespace avx512
+
+#endif // IPT_SIMD_X86
+
+
+// ==============================================================================================
+
+#if IPT_SIMD_NEON
+
+namespace neon {
+
+inline void to_floats(const double* input, float* output, std::size_t n) {
+    std::size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        float32x2_t lo = vcvt_f32_f64(vld1q_f64(input + i));
+        vst1q_f32(output + i, vcvt_high_f32_f64(lo, vld1q_f64(input + i + 2)));
+    }
+    scalar::to_floats(input + i, output + i, n - i);
+}
+
+
+inline double sum_of_squares_d(const double* input, std::size_t n) {
+    float64x2_t acc0 = vdupq_n_f64(0.0);
+    float64x2_t acc1 = vdupq_n_f64(0.0);
+    std::size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        float64x2_t a = vld1q_f64(input + i);
+        float64x2_t b = vld1q_f64(input + i + 2);
+        acc0 = vaddq_f64(acc0, vmulq_f64(a, a));
+        acc1 = vaddq_f64(acc1, vmulq_f64(b, b));
+    }
+    return vaddvq_f64(vaddq_f64(acc0, acc1)) + scalar::sum_of_squares(input + i, n - i);
+}
+
+
+inline double sum_of_squares_f(const float* input, std::size_t n) {
+    float64x2_t acc0 = vdupq_n_f64(0.0);
+    float64x2_t acc1 = vdupq_n_f64(0.0);
+    std::size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        float32x4_t x = vld1q_f32(input + i);
+        float64x2_t a = vcvt_f64_f32(vget_low_f32(x));
+        float64x2_t b = vcvt_high_f64_f32(x);
+        acc0 = vaddq_f64(acc0, vmulq_f64(a, a));
+        acc1 = vaddq_f64(acc1, vmulq_f64(b, b));
+    }
+    return vaddvq_f64(vaddq_f64(acc0, acc1)) + scalar::sum_of_squares(input + i, n - i);
+}
+
+
+inline float max_value(const float* input, std::size_t n) {
+    if (n < 4) {
+        return scalar::max_value(input, n);
+    }
+
+    float32x4_t acc = vld1q_f32(input);
+    std::size_t i = 4;
+    for (; i + 4 <= n; i += 4) {
+        acc = vmaxq_f32(acc, vld1q_f32(input + i));
+    }
+    float max = vmaxvq_f32(acc);
+    return i < n ? std::max(max, scalar::max_value(input + i, n - i)) : max;
+}
+
+
+inline void leaky_mix(const float* previous, const float* current, float* output, std::size_t n, double dt) {
+    const float64x2_t a = vdupq_n_f64(1 - dt);
+    const float64x2_t b = vdupq_n_f64(dt);
+    std::size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        float32x4_t p = vld1q_f32(previous + i);
+        float32x4_t c = vld1q_f32(current + i);
+        float64x2_t lo = vaddq_f64(vmulq_f64(a, vcvt_f64_f32(vget_low_f32(p))), vmulq_f64(b, vcvt_f64_f32(vget_low_f32(c))));
+        float64x2_t hi = vaddq_f64(vmulq_f64(a, vcvt_high_f64_f32(p)), vmulq_f64(b, vcvt_high_f64_f32(c)));
+        vst1q_f32(output + i, vcvt_high_f32_f64(vcvt_f32_f64(lo), hi));
+    }
+    scalar::leaky_mix(previous + i, current + i, output + i, n - i, dt);
+}
+
+
+inline const Kernels& kernels() {
+    static const Kernels k{Isa::neon, "neon", to_floats, sum_of_squares_d, sum_of_squares_f, max_value, leaky_mix};
+    return k;
+}
+
+} // namespace neon
+
+#endif // IPT_SIMD_NEON
+
+
+// ==============================================================================================
+
+inline bool is_supported(Isa isa) {
+    switch (isa) {
+        case Isa::scalar:
+            return true;
+#if IPT_SIMD_X86
+        case Isa::sse2:
+            return __builtin_cpu_supports("sse2");
+        case Isa::avx2:
+            return __builtin_cpu_supports("avx2");
+        case Isa::avx512:
+            return __builtin_cpu_supports("avx512f");
+#endif
+#if IPT_SIMD_NEON
+        case Isa::neon:
+            return true;
+#endif
+        default:
+            return false;
+    }
+}
+
+
+#if IPT_SIMD_X86
+/** @returns true if the OS saves the AMX tile state (XCR0 bits 17 and 18), without which AMX instructions fault */
+inline bool has_os_amx_support() {
+    unsigned int eax = 0, ebx = 0, ecx = 0, edx = 0;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx) || !(ecx & (1u << 27))) { // OSXSAVE, i.e. xgetbv is available
+        return false;
+    }
+
+    unsigned int xcr0_lo = 0, xcr0_hi = 0;
+    __asm__ volatile("xgetbv" : "=a"(xcr0_lo), "=d"(xcr0_hi) : "c"(0));
+    const unsigned int tile_state = (1u << 17) | (1u << 18); // XTILECFG and XTILEDATA
+    return (xcr0_lo & tile_state) == tile_state;
+}
+#endif
+
+
+/**
+ * @returns true if the CPU has native bf16 arithmetic (AVX512-BF16 or AMX-BF16 on x86, FEAT_BF16 on arm64),
+ *          i.e. if bf16 inference can be expected to be faster than fp32 rather than emulated
+ */
+inline bool has_native_bf16() {
+#if IPT_SIMD_X86
+    unsigned int eax = 0, ebx = 0, ecx = 0, edx = 0;
+    bool avx512_bf16 = __get_cpuid_count(7, 1, &eax, &ebx, &ecx, &edx) && (eax & (1u << 5));
+    // e.g. in a VM or with a kernel without AMX support, the CPUID bit is set but the tile state isn't enabled
+    bool amx_bf16 = __get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) && (edx & (1u << 22)) && has_os_amx_support();
+    return (avx512_bf16 && is_supported(Isa::avx512)) || amx_bf16;
+#elif IPT_SIMD_NEON && defined(__APPLE__)
+    int value = 0;
+    std::size_t size = sizeof(value);
+    return sysctlbyname("hw.optional.arm.FEAT_BF16", &value, &size, nullptr, 0) == 0 && value != 0;
+#elif IPT_SIMD_NEON && defined(__linux__)
+    return (getauxval(AT_HWCAP2) & (1ul << 14)) != 0; // HWCAP2_BF16
+#else
+    return false;
+#endif
+}
+
+
+/** @returns the kernels for the given instruction set, or the scalar kernels if unsupported on this machine */
+inline const Kernels& kernels(Isa isa) {
+    if (!is_supported(isa)) {
+        return scalar::kernels();
+    }
+
+    switch (isa) {
+#if IPT_SIMD_X86
+        case Isa::sse2:
+            return sse2::kernels();
+        case Isa::avx2:
+            return avx2::kernels();
+        case Isa::avx512:
+            return avx512::kernels();
+#endif
+#if IPT_SIMD_NEON
+        case Isa::neon:
+            return neon::kernels();
+#endif
+        default:
+            return scalar::kernels();
+    }
+}
+
+
+/** Kernels for the best instruction set available on this machine, detected once */
+inline const Kernels& active() {
+    static const Kernels& k = [] () -> const Kernels& {
+        for (auto isa: {Isa::avx512, Isa::avx2, Isa::sse2, Isa::neon}) {
+            if (is_supported(isa)) {
+                return kernels(isa);
+            }
+        }
+        return scalar::kernels();
+    }();
+    return k;
+}
+
+
+// ==============================================================================================
+
+inline void to_floats(const double* input, float* output, std::size_t n) {
+    active().to_floats(input, output, n);
+}
+
+
+inline double sum_of_squares(const double* input, std::size_t n) {
+    return active().sum_of_squares_d(input, n);
+}
+
+
+inline double sum_of_squares(const float* input, std::size_t n) {
+    return active().sum_of_squares_f(input, n);
+}
+
+
+/** @returns the index of the first occurrence of the maximum value, or 0 if `n` is 0 */
+inline std::size_t argmax(const float* input, std::size_t n) {
+    if (n == 0) {
+        return 0;
+    }
+
+    auto max = active().max_value(input, n);
+    for (std::size_t i = 0; i < n; ++i) {
+        if (input[i] == max) {
+            return i;
+        }
+    }
+    return 0;
+}
+
+
+/** output[i] = (1 - dt) * previous[i] + dt * current[i], computed in double precision */
+inline void leaky_mix(const float* previous, const float* current, float* output, std::size_t n, double dt) {
+    active().leaky_mix(previous, current, output, n, dt);
+}
+
+} // namespace util::simd
+
+#endif //IPT_MAX_SIMD_H
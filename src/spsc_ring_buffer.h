@@ -0,0 +1,170 @@
+#ifndef IPT_MAX_SPSC_RING_BUFFER_H
+#define IPT_MAX_SPSC_RING_BUFFER_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <type_traits>
+#include <vector>
+
+
+/**
+ * Lock-free single-producer / single-consumer ring buffer operating on blocks of samples.
+ *
+ * The producer (audio thread) writes an entire signal vector at once with `write()`, and the consumer
+ * (worker thread) reads the pending samples in place through `readable_region()` followed by `consume()`.
+ * There is exactly one atomic store per block on each side, as opposed to one per sample.
+ *
+ * Multiple channels are stored planar and share a single pair of indices, so that they are always written,
+ * dropped and consumed in lockstep.
+ */
+template<typename T, typename = std::enable_if_t<std::is_trivially_copyable_v<T>>>
+class SpscRingBuffer {
+public:
+    /** Contiguous, read-only view of pending samples */
+    struct Region {
+        const T* data;
+        std::size_t size;
+    };
+
+
+    /** @param capacity minimum capacity in samples per channel, rounded up to the nearest power of two */
+    explicit SpscRingBuffer(std::size_t capacity, std::size_t num_channels = 1)
+            : m_capacity(next_power_of_two(capacity))
+              , m_mask(m_capacity - 1)
+              , m_num_channels(std::max<std::size_t>(1, num_channels))
+              , m_buffer(m_capacity * m_num_channels) {}
+
+
+    /**
+     * Writes the entire block, or nothing at all if there isn't enough space for it.
+     * @note Producer side only. Never blocks nor allocates
+     * @returns false if the block was dropped, in which case the drop is counted in `take_dropped()`
+     */
+    bool write(const T* samples, std::size_t num_samples) {
+        return write(&samples, 1, num_samples);
+    }
+
+
+    /**
+     * Writes the same number of samples to each channel, or nothing at all if there isn't enough space for them.
+     * Channels beyond `num_input_channels` are filled with zeros.
+     * @note Producer side only. Never blocks nor allocates
+     * @returns false if the block was dropped, in which case the drop is counted (once, not per channel) in `take_dropped()`
+     */
+    bool write(const T* const* channels, std::size_t num_input_channels, std::size_t num_samples) {
+        auto write_index = m_write_index.load(std::memory_order_relaxed);
+        auto read_index = m_read_index.load(std::memory_order_acquire);
+
+        if (num_samples > capacity() - (write_index - read_index)) {
+            m_dropped.fetch_add(num_samples, std::memory_order_relaxed);
+            return false;
+        }
+
+        auto offset = write_index & m_mask;
+        auto first = std::min(num_samples, m_capacity - offset);
+
+        for (std::size_t c = 0; c < m_num_channels; ++c) {
+            T* plane = m_buffer.data() + c * m_capacity;
+
+            if (c < num_input_channels) {
+                std::memcpy(plane + offset, channels[c], first * sizeof(T));
+                std::memcpy(plane, channels[c] + first, (num_samples - first) * sizeof(T));
+            } else {
+                std::fill(plane + offset, plane + offset + first, T{});
+                std::fill(plane, plane + (num_samples - first), T{});
+            }
+        }
+
+        m_write_index.store(write_index + num_samples, std::memory_order_release);
+        return true;
+    }
+
+
+    /**
+     * Oldest pending samples, as a single contiguous region of the internal storage. When the pending samples
+     * wrap around the end of the storage, only the part up to the end is returned: call `consume()` and
+     * query again to get the remainder.
+     * @note Consumer side only. The region stays valid until `consume()` is called
+     */
+    Region readable_region(std::size_t channel = 0) const {
+        auto read_index = m_read_index.load(std::memory_order_relaxed);
+        auto write_index = m_write_index.load(std::memory_order_acquire);
+
+        auto offset = read_index & m_mask;
+        auto num_samples = std::min(write_index - read_index, m_capacity - offset);
+
+        return Region{m_buffer.data() + channel * m_capacity + offset, num_samples};
+    }
+
+
+    /**
+     * Same as `readable_region()`, for all channels at once: the start of each channel's region is written to
+     * `channels`, which must hold `num_channels()` pointers.
+     * @returns the number of samples in each region
+     */
+    std::size_t readable_regions(const T** channels) const {
+        auto region = readable_region();
+        for (std::size_t c = 0; c < m_num_channels; ++c) {
+            channels[c] = region.data + c * m_capacity;
+        }
+        return region.size;
+    }
+
+
+    /** Consumes samples of all channels.
+     *  @note Consumer side only. `num_samples` must not exceed the size of the last `readable_region()` */
+    void consume(std::size_t num_samples) {
+        auto read_index = m_read_index.load(std::memory_order_relaxed);
+        m_read_index.store(read_index + num_samples, std::memory_order_release);
+    }
+
+
+    /** @note Consumer side only */
+    std::size_t available() const {
+        return m_write_index.load(std::memory_order_acquire) - m_read_index.load(std::memory_order_relaxed);
+    }
+
+
+    /** Number of samples dropped due to overflow since the last call, resetting the count */
+    std::size_t take_dropped() {
+        return m_dropped.exchange(0, std::memory_order_relaxed);
+    }
+
+
+    /** Capacity per channel, in samples */
+    std::size_t capacity() const {
+        return m_capacity;
+    }
+
+
+    std::size_t num_channels() const {
+        return m_num_channels;
+    }
+
+
+private:
+    static std::size_t next_power_of_two(std::size_t n) {
+        std::size_t p = 1;
+        while (p < n) {
+            p <<= 1;
+        }
+        return p;
+    }
+
+
+    std::size_t m_capacity;
+    std::size_t m_mask;
+    std::size_t m_num_channels;
+
+    // planar: channel c occupies [c * m_capacity, (c + 1) * m_capacity)
+    std::vector<T> m_buffer;
+
+    // indices increase monotonically and are only masked on access, so that full and empty can be told apart
+    alignas(64) std::atomic<std::size_t> m_write_index{0};
+    alignas(64) std::atomic<std::size_t> m_read_index{0};
+    alignas(64) std::atomic<std::size_t> m_dropped{0};
+};
+
+
+#endif //IPT_MAX_SPSC_RING_BUFFER_H
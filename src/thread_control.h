@@ -0,0 +1,74 @@
+#ifndef IPT_MAX_THREAD_CONTROL_H
+#define IPT_MAX_THREAD_CONTROL_H
+
+#include <algorithm>
+#include <vector>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#elif defined(__APPLE__)
+#include <pthread.h>
+#include <pthread/qos.h>
+#endif
+
+
+/**
+ * Scheduling control of the calling thread, e.g. so that inference workers don't compete with the audio thread.
+ * All functions apply to the current thread only, and return false where unsupported or not permitted.
+ */
+namespace util::thread_control {
+
+/**
+ * Restricts the current thread to the given cores. An empty list allows all cores again.
+ * @note Only supported on Linux. macOS has no hard affinity
+ */
+inline bool set_affinity(const std::vector<int>& cores) {
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+
+    if (cores.empty()) {
+        for (int i = 0; i < CPU_SETSIZE; ++i) {
+            CPU_SET(i, &set);
+        }
+    } else {
+        for (auto core: cores) {
+            if (core >= 0 && core < CPU_SETSIZE) {
+                CPU_SET(core, &set);
+            }
+        }
+    }
+
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    return cores.empty();
+#endif
+}
+
+
+/**
+ * @param priority 0 for normal scheduling, or 1 (lowest) to 99 (highest) for real-time scheduling.
+ *        On Linux, real-time scheduling is SCHED_FIFO, which requires CAP_SYS_NICE or a suitable RLIMIT_RTPRIO.
+ *        On macOS, any priority above 0 maps to the user-interactive QoS class
+ */
+inline bool set_priority(int priority) {
+#if defined(__linux__)
+    sched_param param{};
+    if (priority <= 0) {
+        param.sched_priority = 0;
+        return pthread_setschedparam(pthread_self(), SCHED_OTHER, &param) == 0;
+    }
+
+    param.sched_priority = std::min(priority, sched_get_priority_max(SCHED_FIFO));
+    return pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) == 0;
+#elif defined(__APPLE__)
+    return pthread_set_qos_class_self_np(priority > 0 ? QOS_CLASS_USER_INTERACTIVE : QOS_CLASS_DEFAULT, 0) == 0;
+#else
+    return priority <= 0;
+#endif
+}
+
+} // namespace util::thread_control
+
+#endif //IPT_MAX_THREAD_CONTROL_H
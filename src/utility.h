@@ -3,19 +3,12 @@
 #define IPT_MAX_UTILITY_H
 
 #include <vector>
+#include "simd.h"
 
 namespace util {
 
 static inline std::size_t argmax(const std::vector<float>& v) {
-    float max = v[0];
-    std::size_t index = 0;
-    for (std::size_t i = 1; i < v.size(); i++) {
-        if (v[i] > max) {
-            max = v[i];
-            index = i;
-        }
-    }
-    return index;
+    return simd::argmax(v.data(), v.size());
 }
 
 
@@ -42,11 +35,8 @@ static inline T clamp(T x, T low, T high) {
 // ==============================================================================================
 
 static inline std::vector<float> to_floats(const std::vector<double>& v) {
-    std::vector<float> f;
-    f.reserve(v.size());
-    for (auto i : v) {
-        f.push_back(static_cast<float>(i));
-    }
+    std::vector<float> f(v.size());
+    simd::to_floats(v.data(), f.data(), v.size());
     return f;
 }
 
@@ -0,0 +1,121 @@
+#ifndef IPT_MAX_WINDOW_POOL_H
+#define IPT_MAX_WINDOW_POOL_H
+
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <numeric>
+#include <optional>
+#include <vector>
+#include "model.h"
+
+
+/**
+ * Fixed number of preallocated windows of one submitter to an InferenceBatcher. The submitter fills a free window in
+ * place and submits it by its slot index rather than as a newly allocated vector, and the batcher releases the slot
+ * once the window's result has been passed to the pool's handler. Neither side allocates in the steady state.
+ *
+ * The handlers are set once for the whole pool and receive the slot, so that the submitter can look up whatever it
+ * needs to route the result in storage indexed by slot, rather than capturing it in a new callback per window.
+ */
+class WindowPool {
+public:
+    using ResultHandler = std::function<void(std::size_t slot, const ClassificationResult&)>;
+    using ErrorHandler = std::function<void(std::size_t slot, std::exception_ptr)>;
+
+
+    WindowPool(std::size_t num_windows
+               , std::size_t window_length
+               , ResultHandler on_result
+               , ErrorHandler on_error = {})
+            : m_num_windows(num_windows)
+              , m_window_length(window_length)
+              , m_samples(num_windows * window_length, 0.0f)
+              , m_free_slots(num_windows)
+              , m_on_result(std::move(on_result))
+              , m_on_error(std::move(on_error)) {
+        // handed out from the back, i.e. from slot 0 on
+        std::iota(m_free_slots.rbegin(), m_free_slots.rend(), std::size_t{0});
+    }
+
+    WindowPool(const WindowPool&) = delete;
+    WindowPool& operator=(const WindowPool&) = delete;
+
+
+    /**
+     * @returns the slot of a free window, or std::nullopt if all of them are in flight
+     * @note Never allocates, but locks a mutex shared with the batcher's workers. Never call from the audio thread
+     */
+    std::optional<std::size_t> acquire() {
+        std::lock_guard lock{m_mutex};
+        if (m_free_slots.empty()) {
+            return std::nullopt;
+        }
+
+        auto slot = m_free_slots.back();
+        m_free_slots.pop_back();
+        return slot;
+    }
+
+
+    /** Called by the batcher once the result of the window in `slot` has been handled */
+    void release(std::size_t slot) {
+        std::lock_guard lock{m_mutex};
+        m_free_slots.push_back(slot); // never exceeds the initial capacity
+    }
+
+
+    /** @returns the `get_window_length()` samples of the window in `slot` */
+    float* window(std::size_t slot) {
+        return m_samples.data() + slot * m_window_length;
+    }
+
+
+    const float* window(std::size_t slot) const {
+        return m_samples.data() + slot * m_window_length;
+    }
+
+
+    void on_result(std::size_t slot, const ClassificationResult& result) const {
+        if (m_on_result) {
+            m_on_result(slot, result);
+        }
+    }
+
+
+    void on_error(std::size_t slot, std::exception_ptr error) const {
+        if (m_on_error) {
+            m_on_error(slot, error);
+        }
+    }
+
+
+    std::size_t get_window_length() const {
+        return m_window_length;
+    }
+
+
+    std::size_t get_num_windows() const {
+        return m_num_windows;
+    }
+
+
+    std::size_t get_num_free() const {
+        std::lock_guard lock{m_mutex};
+        return m_free_slots.size();
+    }
+
+
+private:
+    std::size_t m_num_windows;
+    std::size_t m_window_length;
+    std::vector<float> m_samples;
+
+    mutable std::mutex m_mutex;
+    std::vector<std::size_t> m_free_slots;
+
+    ResultHandler m_on_result;
+    ErrorHandler m_on_error;
+};
+
+#endif //IPT_MAX_WINDOW_POOL_H
@@ -0,0 +1,268 @@
+#ifndef IPT_MAX_WINDOW_STREAM_H
+#define IPT_MAX_WINDOW_STREAM_H
+
+#include <algorithm>
+#include <limits>
+#include <memory>
+#include <optional>
+#include "circular_buffer.h"
+#include "energy_threshold.h"
+#include "latency_stats.h"
+#include "utility.h"
+
+
+/**
+ * Per-stream windowing state: resampling to the model's rate, hop counting and energy gating of one audio stream.
+ *
+ * This holds no reference to the model, so that any number of streams can share a single model instance,
+ * and it performs no locking: each instance must only be used by one thread at a time.
+ */
+class WindowStream {
+public:
+    static const int DEFAULT_THRESHOLD_WINDOW_MS = 20;
+    static const int DEFAULT_HOP_MS = 0;
+    static constexpr std::size_t NO_PREVIOUS_WINDOW = std::numeric_limits<std::size_t>::max() / 2;
+
+    explicit WindowStream(double energy_threshold_db = EnergyThreshold::MINIMUM_THRESHOLD
+                          , int threshold_window_ms = DEFAULT_THRESHOLD_WINDOW_MS
+                          , int hop_ms = DEFAULT_HOP_MS)
+            : m_threshold_window_ms(threshold_window_ms)
+              , m_hop_ms(hop_ms)
+              , m_energy_threshold(energy_threshold_db) {}
+
+
+    /** @note: should typically be called when dsp is started / restarted, or for each new file */
+    void initialize(int input_sr, int input_vector_length, int model_sr, int segment_length) {
+        m_input_sr = input_sr;
+        m_model_sr = model_sr;
+        m_segment_length = segment_length;
+        m_input_vector_length = static_cast<std::size_t>(std::max(1, input_vector_length));
+        m_threshold_buffer = std::make_unique<CircularBuffer<double>>(m_threshold_window_ms, input_sr);
+
+        m_classification_buffer = std::make_unique<ResamplingBuffer>(static_cast<std::size_t>(segment_length)
+                                                                     , m_input_vector_length
+                                                                     , input_sr
+                                                                     , model_sr
+                                                                     , m_resampling_quality);
+
+        m_samples_since_hop = 0;
+        m_samples_since_window = NO_PREVIOUS_WINDOW;
+        m_samples_received = 0;
+        m_active = false;
+    }
+
+
+    bool is_initialized() const {
+        return m_classification_buffer && m_threshold_buffer && m_input_sr;
+    }
+
+
+    /**
+     * Feeds the input one vector at a time and calls `on_window(const float*, std::size_t)` with a view of the
+     * current window for each hop boundary crossed, subject to energy gating. The view points directly into the
+     * classification buffer and is only valid during the call. Hop boundaries are counted in samples at the model's
+     * sample rate, so the classification rate only depends on the amount of audio, not on how the input is chunked.
+     */
+    template<typename Callback>
+    void for_each_due_window(const double* input, std::size_t num_samples, Callback&& on_window) {
+        if (!is_initialized()) {
+            return;
+        }
+
+        auto hop = hop_size();
+
+        std::size_t start = 0;
+        while (start < num_samples) {
+            auto chunk_size = std::min(m_input_vector_length, num_samples - start);
+
+            auto t0 = now();
+            m_threshold_buffer->add_samples(input + start, chunk_size);
+            auto t1 = now();
+            auto num_added = m_classification_buffer->add_samples(input + start, chunk_size);
+            m_samples_since_hop += num_added;
+            m_samples_since_window = std::min(NO_PREVIOUS_WINDOW, m_samples_since_window + num_added);
+            record(Stage::resampling, t1, now());
+
+            m_samples_received += chunk_size;
+            start += chunk_size;
+
+            if (!m_classification_buffer->is_fully_allocated() || m_samples_since_hop < hop) {
+                record(Stage::gating, t0, t1);
+                continue;
+            }
+
+            // Hops shorter than a vector would all see the same window: classify it only once
+            m_samples_since_hop %= hop;
+
+            const float* window = m_classification_buffer->data();
+            auto window_length = m_classification_buffer->size();
+
+            // Note: gating uses the buffers' running rms, i.e. costs O(new samples) rather than O(window) per hop
+            auto t2 = now();
+            m_active = m_active
+                       ? m_energy_threshold.is_above_threshold(m_classification_buffer->rms())
+                       : m_energy_threshold.is_above_threshold(m_threshold_buffer->rms());
+            record(Stage::gating, t0, t1 + (now() - t2));
+
+            if (m_active) {
+                on_window(window, window_length);
+                m_samples_since_window = 0;
+            }
+
+            /* Note: The conditions for activation and deactivation are different:
+             *   - activation: one energy threshold window is above silence,
+             *   - deactivation: one entire inference window is below threshold
+             *   we might therefore have some edge cases where an entire window is below threshold but still classified.
+             *   This is for the moment intentional by design, but might after experimenting need a rework at a later stage
+             */
+        }
+    }
+
+
+    /**
+     * Adapts the stream to a model with another sample rate and / or segment length. The classification buffer is
+     * only rebuilt if either changed, in which case it is prefilled with the current window, so that no hop is
+     * skipped while the new buffer fills up.
+     */
+    void set_model_format(int model_sr, int segment_length) {
+        if (!is_initialized() || (model_sr == m_model_sr && segment_length == m_segment_length)) {
+            m_model_sr = model_sr;
+            m_segment_length = segment_length;
+            return;
+        }
+
+        auto previous_sr = m_model_sr;
+        m_model_sr = model_sr;
+        m_segment_length = segment_length;
+        rebuild_classification_buffer(previous_sr);
+    }
+
+
+    /** Rebuilds the classification buffer if the quality changed, prefilled with the current window like above */
+    void set_resampling_quality(ResamplingQuality quality) {
+        if (quality == m_resampling_quality) {
+            return;
+        }
+
+        m_resampling_quality = quality;
+        if (is_initialized() && *m_input_sr != m_model_sr) {
+            rebuild_classification_buffer(m_model_sr);
+        }
+    }
+
+
+    /** Latency added by resampling the input to the model's rate, in ms. Zero when the rates match */
+    double resampling_latency_ms() const {
+        if (!is_initialized()) {
+            return 0.0;
+        }
+        return 1000.0 * m_classification_buffer->latency() / static_cast<double>(*m_input_sr);
+    }
+
+
+    void set_energy_threshold(double threshold_db) {
+        m_energy_threshold.set_threshold_db(threshold_db);
+    }
+
+
+    void set_threshold_window(int duration_ms) {
+        m_threshold_window_ms = std::max(0, duration_ms);
+
+        if (is_initialized()) {
+            m_threshold_buffer->resize(m_threshold_window_ms, *m_input_sr);
+        }
+    }
+
+
+    /** @param duration_ms hop between two consecutive classifications, or 0 to classify once per input vector */
+    void set_hop(int duration_ms) {
+        m_hop_ms = std::max(0, duration_ms);
+    }
+
+
+    /** Records the duration of resampling and gating into `stats`, if not null. `stats` must outlive the stream */
+    void set_stats(LatencyStats* stats) {
+        m_stats = stats;
+    }
+
+
+    /**
+     * Number of samples at the end of the current window that weren't part of the previous window passed to
+     * `on_window`, i.e. the new audio a streaming model has to be fed. At least the window's length if there is no
+     * previous window, as after `initialize()`, or if the stream was gated off in between.
+     * @note Only meaningful during a call to `on_window`
+     */
+    std::size_t samples_since_window() const {
+        return m_samples_since_window;
+    }
+
+
+    /** Number of input samples (at the input sample rate) received since `initialize()` */
+    std::size_t samples_received() const {
+        return m_samples_received;
+    }
+
+
+private:
+    /** @param previous_sr sample rate of the current classification buffer, whose latest window is carried over */
+    void rebuild_classification_buffer(int previous_sr) {
+        auto previous_window = m_classification_buffer->get_samples();
+        auto was_full = m_classification_buffer->is_fully_allocated();
+
+        m_classification_buffer = std::make_unique<ResamplingBuffer>(static_cast<std::size_t>(m_segment_length)
+                                                                     , m_input_vector_length
+                                                                     , *m_input_sr
+                                                                     , m_model_sr
+                                                                     , m_resampling_quality);
+
+        if (was_full) {
+            m_classification_buffer->prefill(previous_window.data(), previous_window.size(), previous_sr);
+        }
+        m_samples_since_window = NO_PREVIOUS_WINDOW;
+    }
+
+
+    LatencyHistogram::Clock::time_point now() const {
+        return m_stats ? LatencyHistogram::Clock::now() : LatencyHistogram::Clock::time_point{};
+    }
+
+
+    void record(Stage stage, LatencyHistogram::Clock::time_point start, LatencyHistogram::Clock::time_point end) {
+        if (m_stats) {
+            (*m_stats)[stage].record(start, end);
+        }
+    }
+
+
+    /** Hop size in samples at the model's sample rate, at least one sample */
+    std::size_t hop_size() const {
+        if (m_hop_ms <= 0) {
+            return 1;
+        }
+        return std::max<std::size_t>(1, util::mstosamples(m_hop_ms, m_model_sr));
+    }
+
+
+    int m_threshold_window_ms;
+    int m_hop_ms;
+
+    EnergyThreshold m_energy_threshold;
+
+    std::unique_ptr<ResamplingBuffer> m_classification_buffer;
+    std::unique_ptr<CircularBuffer<double>> m_threshold_buffer;
+
+    std::optional<int> m_input_sr;
+    int m_model_sr = 0;
+    int m_segment_length = 0;
+    ResamplingQuality m_resampling_quality = ResamplingQuality::high;
+    std::size_t m_input_vector_length = 1;
+
+    std::size_t m_samples_since_hop = 0;
+    std::size_t m_samples_since_window = NO_PREVIOUS_WINDOW;
+    std::size_t m_samples_received = 0;
+    bool m_active = false;
+
+    LatencyStats* m_stats = nullptr;
+};
+
+#endif //IPT_MAX_WINDOW_STREAM_H
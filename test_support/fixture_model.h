@@ -0,0 +1,182 @@
+#ifndef IPT_MAX_FIXTURE_MODEL_H
+#define IPT_MAX_FIXTURE_MODEL_H
+
+#include <torch/script.h>
+#include <torch/torch.h>
+#include <ATen/CPUGeneratorImpl.h>
+#include <cmath>
+#include <filesystem>
+#include <random>
+#include <string>
+
+
+/**
+ * Small TorchScript classifier exposing the same interface as the models trained with ipt_recognition
+ * (`forward`, `get_sr`, `get_seglen`, `get_classnames`), generated on the fly so that benchmarks and tests don't
+ * depend on any external file. The architecture (strided conv front end, pooling, linear head) is only meant to be
+ * representative in shape, not in accuracy.
+ *
+ * The streaming variant also exports `forward_stream`, whose state is simply the latest window: its results are
+ * identical to `forward` on the same windows, which allows comparing the streaming and full-window paths.
+ *
+ * The features variant classifies a log mel spectrogram instead, and also exports its front end as `forward_features`
+ * and `get_feature_config`: `forward` computes the same features with torch.stft, for comparison with FeatureCache.
+ */
+struct FixtureModel {
+    static const int SAMPLE_RATE = 24000;
+    static const int SEGMENT_LENGTH = 7680;
+    static const int NUM_CLASSES = 8;
+
+    // front end of the features variant, see `get_feature_config`
+    static const int N_FFT = 512;
+    static const int WIN_LENGTH = 400;
+    static const int HOP_LENGTH = 160;
+    static const int N_MELS = 40;
+
+    enum class Variant {
+        plain
+        , streaming  // with `forward_stream`
+        , features   // with `forward_features` and `get_feature_config`
+    };
+
+
+    /**
+     * Deterministic: the weights are drawn from a generator of its own, seeded identically on every call, without
+     * touching libtorch's global generator.
+     * @param segment_length window length of the model, e.g. to swap between models of different formats
+     * @returns path to the saved TorchScript file
+     */
+    static std::string generate(const std::filesystem::path& directory = FixtureModel::directory()
+                                , Variant variant = Variant::plain
+                                , int segment_length = SEGMENT_LENGTH) {
+        auto generator = at::detail::createCPUGenerator(0);
+
+        torch::jit::Module module("IptFixture");
+        module.register_parameter("conv_weight", torch::randn({32, 1, 256}, generator) * 0.01, false);
+        module.register_parameter("linear_weight", torch::randn({NUM_CLASSES, 32}, generator) * 0.1, false);
+
+        std::string class_names;
+        for (int i = 0; i < NUM_CLASSES; ++i) {
+            class_names += (i > 0 ? ", " : "") + std::string("\"class_") + std::to_string(i) + "\"";
+        }
+
+        module.define(R"(
+def get_sr(self) -> int:
+    return )" + std::to_string(SAMPLE_RATE) + R"(
+
+def get_seglen(self) -> int:
+    return )" + std::to_string(segment_length) + R"(
+
+def get_classnames(self) -> List[str]:
+    return [)" + class_names + R"(]
+)");
+
+        if (variant == Variant::features) {
+            module.register_parameter("feature_weight", torch::randn({N_MELS, 32}, generator) * 0.1, false);
+            module.register_buffer("mel_filterbank", mel_filterbank());
+            module.register_attribute("n_fft", c10::IntType::get(), N_FFT);
+            module.register_attribute("win_length", c10::IntType::get(), WIN_LENGTH);
+            module.register_attribute("hop_length", c10::IntType::get(), HOP_LENGTH);
+            module.define(R"(
+def mel_spectrogram(self, x):
+    window = torch.hann_window(self.win_length, dtype=x.dtype)
+    spectrum = torch.stft(x.squeeze(1), self.n_fft, hop_length=self.hop_length, win_length=self.win_length,
+                          window=window, center=False, return_complex=True)
+    mel = torch.matmul(spectrum.abs().pow(2.0).transpose(1, 2), self.mel_filterbank)
+    return torch.log(mel + 1e-6)
+
+def forward_features(self, features):
+    y = torch.relu(torch.matmul(features, self.feature_weight))
+    return torch.matmul(y.mean(dim=1), self.linear_weight.t())
+
+def forward(self, x):
+    return self.forward_features(self.mel_spectrogram(x))
+
+def get_feature_config(self) -> Dict[str, float]:
+    return {"n_fft": float(self.n_fft), "win_length": float(self.win_length), "hop_length": float(self.hop_length),
+            "n_mels": float(self.mel_filterbank.size(1)), "log_offset": 1e-6}
+)");
+        } else {
+            module.define(R"(
+def forward(self, x):
+    y = torch.relu(torch.conv1d(x, self.conv_weight, stride=128))
+    return torch.matmul(y.mean(dim=-1), self.linear_weight.t())
+)");
+        }
+
+        if (variant == Variant::streaming) {
+            module.define(R"(
+def forward_stream(self, x, state: Optional[torch.Tensor]):
+    if state is None:
+        history = x
+    else:
+        history = torch.cat([state, x], dim=-1)
+    history = history[:, :, -)" + std::to_string(segment_length) + R"(:]
+    return self.forward(history), history
+)");
+        }
+
+        auto path = (directory / file_name(variant, segment_length)).string();
+        module.save(path);
+        return path;
+    }
+
+
+    /**
+     * Directory of this process' fixtures, created on first use in the system's temp directory. Unique to the process,
+     * so that concurrent test or benchmark runs don't overwrite each other's files, nor ModelRegistry hand out a
+     * model loaded from a file another run has regenerated since
+     */
+    static const std::filesystem::path& directory() {
+        static const std::filesystem::path path = [] {
+            std::random_device random;
+            while (true) {
+                auto candidate = std::filesystem::temp_directory_path()
+                                 / ("ipt_fixtures_" + std::to_string(random()) + std::to_string(random()));
+                if (std::filesystem::create_directory(candidate)) {
+                    return candidate;
+                }
+            }
+        }();
+        return path;
+    }
+
+
+private:
+    static std::string file_name(Variant variant, int segment_length) {
+        std::string name = "ipt_fixture_model";
+        switch (variant) {
+            case Variant::streaming:
+                name += "_streaming";
+                break;
+            case Variant::features:
+                name += "_features";
+                break;
+            default:
+                break;
+        }
+
+        if (segment_length != SEGMENT_LENGTH) {
+            name += "_" + std::to_string(segment_length);
+        }
+        return name + ".ts";
+    }
+
+
+    /** HTK mel filterbank [frequency bins, mels] without normalisation, as torchaudio.functional.melscale_fbanks */
+    static torch::Tensor mel_filterbank() {
+        auto hz_to_mel = [](double hz) { return 2595.0 * std::log10(1.0 + hz / 700.0); };
+
+        auto frequencies = torch::linspace(0.0, SAMPLE_RATE / 2.0, N_FFT / 2 + 1, torch::kFloat64);
+        auto mels = torch::linspace(hz_to_mel(0.0), hz_to_mel(SAMPLE_RATE / 2.0), N_MELS + 2, torch::kFloat64);
+        auto corners = 700.0 * (torch::pow(10.0, mels / 2595.0) - 1.0);
+
+        auto widths = corners.slice(0, 1) - corners.slice(0, 0, -1);
+        auto slopes = corners.unsqueeze(0) - frequencies.unsqueeze(1);
+        auto down = -slopes.slice(1, 0, -2) / widths.slice(0, 0, -1);
+        auto up = slopes.slice(1, 2) / widths.slice(0, 1);
+        return torch::clamp_min(torch::min(down, up), 0.0).to(torch::kFloat32);
+    }
+};
+
+#endif //IPT_MAX_FIXTURE_MODEL_H